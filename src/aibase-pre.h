@@ -38,6 +38,7 @@ namespace Game
 		extern int paths;
 		
 		extern int numLuaAIThreads;
+		extern int numSimpleAIThreads; // Threads sharing the per-unit SimpleAI work; 0 for one per processor
 
 		enum UnitAction // different actions
 		{
@@ -139,11 +139,14 @@ namespace Game
 
 		void ApplyScheduledCommandUnits()
 		{
+			// The lua handlers pass the orders on to the units, so that their paths are calculated as the player's
+			UnitLuaInterface::SetForwardingPlayerOrders(true);
 			for (std::vector<ScheduledCommand>::iterator it = scheduledCommands.begin(); it != scheduledCommands.end(); it++)
 			{
 				const ScheduledCommand& command = *it;
 				SendCommandUnitToLua(command);
 			}
+			UnitLuaInterface::SetForwardingPlayerOrders(false);
 			scheduledCommands.clear();
 		}
 
@@ -350,20 +353,20 @@ namespace Game
 			for (vector<gc_ptr<Dimension::Unit> >::iterator it = Dimension::pWorld->vUnits.begin(); it != it_end; it++)
 			{
 				const gc_ptr<Dimension::Unit>& pUnit = *it;
-				pUnit->hasPower = true;
-				if (pUnit->isCompleted && pUnit->isDisplayed && pUnit->pMovementData->action.action != ACTION_DIE)
+				pUnit->SetHasPower(true);
+				if (pUnit->IsCompleted() && pUnit->IsDisplayed() && pUnit->pMovementData->action.action != ACTION_DIE)
 				{
 
 					power_usage = (pUnit->type->powerUsage + pUnit->type->lightPowerUsage) / aiFps;
 					
 					if (pUnit->owner->resources.power < power_usage)
 					{
-						pUnit->hasPower = false;
+						pUnit->SetHasPower(false);
 						NotEnoughPowerForLight(pUnit);
 						continue;
 					}
 						
-					pUnit->hasPower = true;
+					pUnit->SetHasPower(true);
 					EnoughPowerForLight(pUnit);
 
 					pUnit->owner->resources.power -= power_usage;
@@ -387,7 +390,7 @@ namespace Game
 				}
 				else
 				{
-					pUnit->hasPower = false;
+					pUnit->SetHasPower(false);
 				}
 			}
 			
@@ -400,7 +403,7 @@ namespace Game
 			
 			HandleProjectiles(pUnit);
 
-			if (pUnit->isCompleted && pUnit->hasPower && pUnit->isDisplayed && pUnit->pMovementData->action.action != ACTION_DIE)
+			if (pUnit->IsCompleted() && pUnit->HasPower() && pUnit->IsDisplayed() && pUnit->pMovementData->action.action != ACTION_DIE)
 			{
 			
 				action = pUnit->pMovementData->action.action;
@@ -465,10 +468,10 @@ namespace Game
 					}
 					else
 					{
-						pUnit->isMoving = false;
+						pUnit->SetMoving(false);
 					}
 					
-					if (pUnit->isMoving)
+					if (pUnit->IsMoving())
 					{
 						if (!pUnit->soundNodes[Audio::SFX_ACT_MOVE_RPT].active)
 						{
@@ -488,70 +491,319 @@ namespace Game
 				else
 				{
 					pUnit->isWaiting = false;
-					pUnit->isMoving = false;
+					pUnit->SetMoving(false);
 				}
 			}
 		}
 
-		void PerformVerySimpleAI(const gc_ptr<Dimension::Unit>& pUnit)
+		//
+		// The per-unit bookkeeping of the SimpleAI frame: power usage and
+		// generation, regeneration and removal of dead units. vUnits is split into
+		// fixed-size chunks that a pool of worker threads compute in parallel. A
+		// chunk only reads the units and writes the results of its own units, which
+		// hold every side effect: the changes to the owner's power, the new health
+		// and power, and whether the unit is to be deleted. The results are then
+		// applied on the calling thread in vUnits order, as the power of a player
+		// is drawn from unit by unit, so that the outcome is the same whatever the
+		// number of threads is.
+		//
+
+		const int SIMPLEAI_CHUNK_SIZE = 128;
+
+		struct UnitFrameResult
 		{
-			double power_usage;
-			if (pUnit->isCompleted && pUnit->isDisplayed && pUnit->pMovementData->action.action != ACTION_DIE)
+			bool active;           // Completed, displayed and not dying
+			double powerUsage;
+			bool hasPowerIncrement;
+			double powerIncrement;
+			float power, health;   // After regeneration
+			bool stopsMoving;
+			bool shouldBeDeleted;
+		};
+
+		int numSimpleAIThreads = 0;
+
+		// The values of a unit type that the bookkeeping of its units needs, worked out once per frame
+		struct UnitTypeFrameData
+		{
+			double powerUsage;
+			bool hasPowerIncrement;
+			double powerIncrement;
+			float regenPower, regenHealth;
+			int maxPower, maxHealth;
+		};
+
+		std::vector<UnitFrameResult> unitFrameResults;     // Indexed as vUnits, so each chunk has its own part
+		std::vector<UnitTypeFrameData> unitTypeFrameData; // Indexed by Dimension::unitComponents.typeIndex
+		bool isDaylight;
+		double daylightFactor;
+
+		SDL_Thread **simpleAIWorkers = NULL;
+		int numSimpleAIWorkers = 0;
+		SDL_mutex *simpleAIWorkMutex;
+		SDL_cond *simpleAIWorkCond;
+		SDL_cond *simpleAIWorkDoneCond;
+		int simpleAINextChunk, simpleAINumChunks, simpleAIChunksDone;
+		Uint32 simpleAIWorkGeneration = 0;
+		bool quitSimpleAIWorkers;
+
+		// index is the index of the unit in vUnits, and thereby in Dimension::unitComponents
+		void ComputeUnitFrame(const gc_ptr<Dimension::Unit>& pUnit, int index, UnitFrameResult& result)
+		{
+			Uint8 flags = Dimension::unitComponents.flags[index];
+			AI::UnitAction action = pUnit->pMovementData->action.action;
+
+			result.active = (flags & Dimension::UNITFLAG_COMPLETED) && (flags & Dimension::UNITFLAG_DISPLAYED) && action != ACTION_DIE;
+			if (result.active)
 			{
+				const UnitTypeFrameData& type = unitTypeFrameData[Dimension::unitComponents.typeIndex[index]];
 
-				power_usage = (pUnit->type->powerUsage + pUnit->type->lightPowerUsage) / aiFps;
-				
-				if (pUnit->owner->resources.power < power_usage)
+				result.powerUsage = type.powerUsage;
+
+				float power = Dimension::unitComponents.power[index];
+				result.power = power +  type.regenPower > type.maxPower ? type.maxPower : power + type.regenPower;
+					
+				float health = Dimension::unitComponents.health[index];
+				result.health = health +  type.regenHealth > type.maxHealth ? type.maxHealth : health + type.regenHealth;
+
+				result.hasPowerIncrement = type.hasPowerIncrement;
+				result.powerIncrement = type.powerIncrement;
+
+				result.stopsMoving = action == AI::ACTION_NONE || action == AI::ACTION_NETWORK_AWAITING_SYNC;
+			}
+			result.shouldBeDeleted = action == ACTION_DIE && currentFrame - pUnit->lastAttacked > (unsigned) aiFps;
+		}
+
+		void ApplyUnitFrame(const gc_ptr<Dimension::Unit>& pUnit, int index, const UnitFrameResult& result)
+		{
+			if (result.active)
+			{
+				Dimension::Resources& resources = Dimension::pWorld->vPlayers[Dimension::unitComponents.ownerIndex[index]]->resources;
+				if (resources.power < result.powerUsage)
 				{
-					pUnit->hasPower = false;
+					pUnit->SetHasPower(false);
 					NotEnoughPowerForLight(pUnit);
-					return;
 				}
+				else
+				{
+					Dimension::unitComponents.power[index] = result.power;
+					Dimension::unitComponents.health[index] = result.health;
+						
+					pUnit->SetHasPower(true);
+					EnoughPowerForLight(pUnit);
 
-				float power_inc = pUnit->type->regenPower / aiFps;
-				pUnit->power = pUnit->power +  power_inc > pUnit->type->maxPower ? pUnit->type->maxPower : pUnit->power + power_inc;
-					
-				float health_inc = pUnit->type->regenHealth / aiFps;
-				pUnit->health = pUnit->health +  health_inc > pUnit->type->maxHealth ? pUnit->type->maxHealth : pUnit->health + health_inc;
-					
-				pUnit->hasPower = true;
-				EnoughPowerForLight(pUnit);
+					resources.power -= result.powerUsage;
+					if (result.hasPowerIncrement)
+					{
+						resources.power += result.powerIncrement;
+					}
+				
+					if (result.stopsMoving)
+					{
+						pUnit->SetMoving(false);
+					}
+				}
+			}
+			else
+			{
+				pUnit->SetHasPower(false);
+			}
+
+			if (result.shouldBeDeleted)
+			{
+#ifdef CHECKSUM_DEBUG_HIGH
+				Networking::checksum_output << "SCHEDULEUNITDELETION " << AI::currentFrame << ": " << pUnit->GetHandle() << "\n";
+#endif
+				ScheduleUnitDeletion(pUnit);
+			}
+		}
 
-				pUnit->owner->resources.power -= power_usage;
-				if (pUnit->type->powerIncrement > 0.0)
+		void UpdateUnitTypeFrameData()
+		{
+			for (vector<gc_ptr<Dimension::UnitType> >::iterator it = Dimension::pWorld->vAllUnitTypes.begin(); it != Dimension::pWorld->vAllUnitTypes.end(); it++)
+			{
+				const gc_ptr<Dimension::UnitType>& type = *it;
+				unsigned index = type->GetHandle() - Dimension::HandleTraits<Dimension::UnitType>::base;
+				if (index >= unitTypeFrameData.size())
 				{
-					if (pUnit->type->powerType == Game::Dimension::POWERTYPE_DAYLIGHT)
+					unitTypeFrameData.resize(index + 1);
+				}
+
+				UnitTypeFrameData& data = unitTypeFrameData[index];
+				data.powerUsage = (type->powerUsage + type->lightPowerUsage) / aiFps;
+				data.regenPower = type->regenPower / aiFps;
+				data.regenHealth = type->regenHealth / aiFps;
+				data.maxPower = type->maxPower;
+				data.maxHealth = type->maxHealth;
+
+				data.hasPowerIncrement = false;
+				if (type->powerIncrement > 0.0)
+				{
+					if (type->powerType == Game::Dimension::POWERTYPE_DAYLIGHT)
 					{
-						Dimension::Environment::FourthDimension* pDimension = Dimension::Environment::FourthDimension::Instance();
-						double curh = pDimension->GetCurrentHour();
-						if (curh >= 6.0 && curh <= 18.0)
+						if (isDaylight)
 						{
-							pUnit->owner->resources.power += (pUnit->type->powerIncrement / aiFps) * (pow(sin((curh-6.0)/12*PI), 1.0/3) * 0.8 + 0.2);
-
+							data.hasPowerIncrement = true;
+							data.powerIncrement = (type->powerIncrement / aiFps) * daylightFactor;
 						}
 					}
 					else
 					{
-						pUnit->owner->resources.power += pUnit->type->powerIncrement / aiFps;
+						data.hasPowerIncrement = true;
+						data.powerIncrement = type->powerIncrement / aiFps;
 					}
 				}
-			
-				if (pUnit->pMovementData->action.action == AI::ACTION_NONE || pUnit->pMovementData->action.action == AI::ACTION_NETWORK_AWAITING_SYNC)
+			}
+		}
+
+		// Computes chunks until there are none left. Called with simpleAIWorkMutex locked.
+		void ComputeUnitFrameChunks()
+		{
+			const vector<gc_ptr<Dimension::Unit> >& units = Dimension::pWorld->vUnits;
+			while (simpleAINextChunk < simpleAINumChunks)
+			{
+				int chunk = simpleAINextChunk++;
+				int start = chunk * SIMPLEAI_CHUNK_SIZE;
+				int end = min(start + SIMPLEAI_CHUNK_SIZE, (int) units.size());
+
+				SDL_UnlockMutex(simpleAIWorkMutex);
+				for (int i = start; i < end; i++)
 				{
-					pUnit->isMoving = false;
+					ComputeUnitFrame(units[i], i, unitFrameResults[i]);
 				}
+				SDL_LockMutex(simpleAIWorkMutex);
 
+				if (++simpleAIChunksDone == simpleAINumChunks)
+				{
+					SDL_CondBroadcast(simpleAIWorkDoneCond);
+				}
+			}
+		}
+
+		int _SimpleAIWorkerThread(void* arg)
+		{
+			SDL_LockMutex(simpleAIWorkMutex);
+			Uint32 generation = simpleAIWorkGeneration;
+			while (1)
+			{
+				while (simpleAIWorkGeneration == generation && !quitSimpleAIWorkers)
+				{
+					SDL_CondWait(simpleAIWorkCond, simpleAIWorkMutex);
+				}
+				if (quitSimpleAIWorkers)
+				{
+					break;
+				}
+				generation = simpleAIWorkGeneration;
+				ComputeUnitFrameChunks();
+			}
+			SDL_UnlockMutex(simpleAIWorkMutex);
+			return 0;
+		}
+
+		void PerformVerySimpleAIForAllUnits()
+		{
+			const vector<gc_ptr<Dimension::Unit> >& units = Dimension::pWorld->vUnits;
+			int num_units = units.size();
+
+			// The hour only changes between frames, so the daylight factor used for
+			// the power of solar units is calculated once per frame, not per unit
+			double curh = Dimension::Environment::FourthDimension::Instance()->GetCurrentHour();
+			isDaylight = curh >= 6.0 && curh <= 18.0;
+			daylightFactor = isDaylight ? pow(sin((curh-6.0)/12*PI), 1.0/3) * 0.8 + 0.2 : 0.0;
+
+			UpdateUnitTypeFrameData();
+
+			if (unitFrameResults.size() < (unsigned) num_units)
+			{
+				unitFrameResults.resize(num_units);
+			}
+
+			if (numSimpleAIWorkers && num_units > SIMPLEAI_CHUNK_SIZE)
+			{
+				SDL_LockMutex(simpleAIWorkMutex);
+				simpleAINextChunk = 0;
+				simpleAINumChunks = (num_units + SIMPLEAI_CHUNK_SIZE - 1) / SIMPLEAI_CHUNK_SIZE;
+				simpleAIChunksDone = 0;
+				simpleAIWorkGeneration++;
+				SDL_CondBroadcast(simpleAIWorkCond);
+
+				ComputeUnitFrameChunks();
+				while (simpleAIChunksDone < simpleAINumChunks)
+				{
+					SDL_CondWait(simpleAIWorkDoneCond, simpleAIWorkMutex);
+				}
+				SDL_UnlockMutex(simpleAIWorkMutex);
 			}
 			else
 			{
-				pUnit->hasPower = false;
+				for (int i = 0; i < num_units; i++)
+				{
+					ComputeUnitFrame(units[i], i, unitFrameResults[i]);
+				}
+			}
+
+			for (int i = 0; i < num_units; i++)
+			{
+				ApplyUnitFrame(units[i], i, unitFrameResults[i]);
 			}
-			
+		}
+
+		void InitSimpleAIWorkers()
+		{
+			if (numSimpleAIThreads <= 0)
+			{
+				numSimpleAIThreads = Utilities::GetNumProcessors();
+			}
+
+			// The thread running the SimpleAI frame does its share of the chunks too
+			numSimpleAIWorkers = numSimpleAIThreads - 1;
+			if (numSimpleAIWorkers <= 0)
+			{
+				numSimpleAIWorkers = 0;
+				return;
+			}
+
+			quitSimpleAIWorkers = false;
+			simpleAIWorkMutex = SDL_CreateMutex();
+			simpleAIWorkCond = SDL_CreateCond();
+			simpleAIWorkDoneCond = SDL_CreateCond();
+
+			simpleAIWorkers = new SDL_Thread*[numSimpleAIWorkers];
+			for (int i = 0; i < numSimpleAIWorkers; i++)
+			{
+				simpleAIWorkers[i] = SDL_CreateThread(_SimpleAIWorkerThread, NULL);
+			}
+		}
+
+		void QuitSimpleAIWorkers()
+		{
+			if (!numSimpleAIWorkers)
+			{
+				return;
+			}
+
+			SDL_LockMutex(simpleAIWorkMutex);
+			quitSimpleAIWorkers = true;
+			SDL_CondBroadcast(simpleAIWorkCond);
+			SDL_UnlockMutex(simpleAIWorkMutex);
+
+			for (int i = 0; i < numSimpleAIWorkers; i++)
+			{
+				SDL_WaitThread(simpleAIWorkers[i], NULL);
+			}
+			delete[] simpleAIWorkers;
+			simpleAIWorkers = NULL;
+			numSimpleAIWorkers = 0;
+
+			SDL_DestroyCond(simpleAIWorkCond);
+			SDL_DestroyCond(simpleAIWorkDoneCond);
+			SDL_DestroyMutex(simpleAIWorkMutex);
 		}
 
 		void PerformLuaUnitAI(const gc_ptr<Dimension::Unit>& pUnit)
 		{
-			if (pUnit->hasPower)
+			if (pUnit->HasPower())
 			{
 
 				pUnit->aiFrame++;
@@ -643,18 +895,7 @@ namespace Game
 					HandleProjectiles(*it);
 				}
 
-				for (vector<gc_ptr<Dimension::Unit> >::iterator it = Dimension::pWorld->vUnits.begin(); it != Dimension::pWorld->vUnits.end(); it++)
-				{
-					const gc_ptr<Dimension::Unit>& pUnit = *it;
-					PerformVerySimpleAI(pUnit);
-					if (pUnit->pMovementData->action.action == ACTION_DIE && currentFrame - pUnit->lastAttacked > (unsigned) aiFps)
-					{
-#ifdef CHECKSUM_DEBUG_HIGH
-						Networking::checksum_output << "SCHEDULEUNITDELETION " << AI::currentFrame << ": " << pUnit->GetHandle() << "\n";
-#endif
-						ScheduleUnitDeletion(pUnit);
-					}
-				}
+				PerformVerySimpleAIForAllUnits();
 
 				for (vector<gc_ptr<Dimension::Unit> >::iterator it = Dimension::pWorld->vUnitsWithAI.begin(); it != Dimension::pWorld->vUnitsWithAI.end(); it++)
 				{
@@ -734,6 +975,8 @@ namespace Game
 
 		void InitAIThreads()
 		{
+			InitSimpleAIWorkers();
+
 			if (numLuaAIThreads)
 			{
 
@@ -800,6 +1043,8 @@ namespace Game
 
 		void QuitAIThreads()
 		{
+			QuitSimpleAIWorkers();
+
 			if (numLuaAIThreads)
 			{
 				quitAIThreads = true;
@@ -856,6 +1101,9 @@ namespace Game
 
 				ApplyAllNewPaths();
 
+				// Find targets for idle units in one sweep, before the lua ai asks for them
+				Dimension::AcquireTargets();
+
 				for (vector<gc_ptr<Dimension::Player> >::iterator it = Dimension::pWorld->vPlayers.begin(); it != Dimension::pWorld->vPlayers.end(); it++)
 				{
 					const gc_ptr<Dimension::Player>& player = *it;
@@ -921,15 +1169,7 @@ namespace Game
 						}
 					}
 
-					for (vector<gc_ptr<Dimension::Unit> >::iterator it = Dimension::pWorld->vUnits.begin(); it != Dimension::pWorld->vUnits.end(); it++)
-					{
-						const gc_ptr<Dimension::Unit>& pUnit = *it;
-						PerformVerySimpleAI(pUnit);
-						if (pUnit->pMovementData->action.action == ACTION_DIE && currentFrame - pUnit->lastAttacked > (unsigned) aiFps)
-						{
-							ScheduleUnitDeletion(pUnit);
-						}
-					}
+					PerformVerySimpleAIForAllUnits();
 
 					for (vector<gc_ptr<Dimension::Unit> >::iterator it = Dimension::pWorld->vUnitsWithAI.begin(); it != Dimension::pWorld->vUnitsWithAI.end(); it++)
 					{
@@ -1085,7 +1325,7 @@ namespace Game
 			if (pUnit->owner != Dimension::currentPlayer)
 				return;
 
-			if (pUnit->isCompleted && pUnit->pMovementData->action.action != ACTION_DIE)
+			if (pUnit->IsCompleted() && pUnit->pMovementData->action.action != ACTION_DIE)
 			{
 				float rotation = Utilities::RandomDegree();
 				Dimension::ActionQueueItem actiondata(x, y, NULL, action, args, rotation, true);
@@ -1120,7 +1360,7 @@ namespace Game
 			if (pUnit->owner != Dimension::currentPlayer)
 				return;
 
-			if (pUnit->isCompleted && pUnit->pMovementData->action.action != ACTION_DIE)
+			if (pUnit->IsCompleted() && pUnit->pMovementData->action.action != ACTION_DIE)
 			{
 				float rotation = Utilities::RandomDegree();
 				Dimension::ActionQueueItem actiondata(0, 0, destination, action, args, rotation, true);
@@ -1188,7 +1428,6 @@ namespace Game
 			pUnit->pMovementData->action.action = ACTION_NONE;
 			pUnit->pMovementData->action.goal.unit = NULL;
 			DeallocPathfindingNodes(pUnit);
-			pUnit->pMovementData->pCurGoalNode = NULL;
 
 			while (pUnit->actionQueue.size())
 			{
@@ -1244,7 +1483,6 @@ namespace Game
 			pUnit->pMovementData->action.action = ACTION_NONE;
 			pUnit->pMovementData->action.goal.unit = NULL;
 			DeallocPathfindingNodes(pUnit);
-			pUnit->pMovementData->pCurGoalNode = NULL;
 
 //			std::cout << "cancel" << std::endl;
 
@@ -1275,7 +1513,6 @@ namespace Game
 			pUnit->pMovementData->action.action = ACTION_NONE;
 			pUnit->pMovementData->action.goal.unit = NULL;
 			DeallocPathfindingNodes(pUnit);
-			pUnit->pMovementData->pCurGoalNode = NULL;
 			pUnit->actionQueue.clear();
 		}
 		
@@ -1350,7 +1587,6 @@ namespace Game
 			}
 			
 			DeallocPathfindingNodes(pUnit);
-			pUnit->pMovementData->pCurGoalNode = NULL;
 			
 			pUnit->pMovementData->action.action = action;
 			pUnit->pMovementData->action.goal.unit = target;
@@ -1361,7 +1597,7 @@ namespace Game
 			pUnit->action_completeness = 0.0;
 			if (pUnit->type->isMobile)
 			{
-				pUnit->isMoving = true;
+				pUnit->SetMoving(true);
 			}
 			pUnit->faceTarget = Dimension::FACETARGET_NONE;
 			AI::SendUnitEventToLua_NewCommand(pUnit);
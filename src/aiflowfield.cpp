@@ -0,0 +1,343 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Flow fields for units moving to a common goal.
+ *
+ * When many units are ordered to the same square, they would all
+ * search more or less the same area of the map. Instead, a single
+ * field holding the cost of reaching the goal from every square is
+ * calculated with Dijkstra's algorithm, starting from the goal. The
+ * path of each unit is then found by always stepping to the
+ * neighbour that is cheapest to reach the goal from, which takes
+ * time proportional to the length of the path.
+ *
+ * A few fields are kept, the least recently used one being thrown
+ * away when room is needed for a new one.
+ *
+ * A field is calculated without holding the cache lock. While it is
+ * being calculated, other requests for the same goal fall back to an
+ * ordinary search instead of waiting for it.
+ */
+
+#include "aiflowfield.h"
+
+#include "aibase.h"
+#include "dimension.h"
+#include "unitsquares.h"
+#include "sdlheader.h"
+#include <queue>
+#include <functional>
+#include <algorithm>
+
+#define FLOWFIELD_CACHE_SIZE 8
+// A field is calculated when a second unit asks for the same goal within this many frames
+#define FLOWFIELD_REQUEST_WINDOW 20
+
+using namespace std;
+
+namespace Game
+{
+	namespace AI
+	{
+		struct FlowField
+		{
+			int goalX, goalY;
+			int size, mt;
+			Uint32 lastUsed;
+			int* costs; // Cost of reaching the goal, per square, or -1; NULL until calculated
+			bool calculating; // A thread is calculating costs outside of gpmxFlowField
+			Uint32 version;   // Bumped whenever the field is thrown away
+		};
+
+		typedef pair<int, int> FlowQueueItem;
+		typedef priority_queue<FlowQueueItem, vector<FlowQueueItem>, greater<FlowQueueItem> > FlowQueue;
+
+		FlowField   flowFields[FLOWFIELD_CACHE_SIZE];
+		SDL_mutex*  gpmxFlowField = NULL;
+		int         flowWidth, flowHeight;
+
+		inline bool IsWalkable_FlowField(int size, int mt, int x, int y)
+		{
+			return Dimension::MovementTypeCanWalkOnSquare_Pathfinding((Dimension::MovementType) mt, size, x, y);
+		}
+
+		// Returns the cost of reaching the goal from every square. Doesn't touch the cache.
+		int* CalculateFlowField(int size, int mt, int goal_x, int goal_y)
+		{
+			int num_squares = flowWidth * flowHeight;
+			FlowQueue queue;
+
+			int* costs = new int[num_squares];
+			fill(costs, costs + num_squares, -1);
+
+			int goal = goal_y * flowWidth + goal_x;
+			costs[goal] = 0;
+			queue.push(FlowQueueItem(0, goal));
+
+			while (!queue.empty())
+			{
+				FlowQueueItem item = queue.top();
+				queue.pop();
+				if (item.first != costs[item.second])
+				{
+					continue;
+				}
+
+				int x = item.second % flowWidth;
+				int y = item.second / flowWidth;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					int new_y = y + dy;
+					if (new_y < 0 || new_y >= flowHeight)
+						continue;
+
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int new_x = x + dx;
+						if ((!dx && !dy) || new_x < 0 || new_x >= flowWidth)
+							continue;
+
+						// Searching backwards from the goal; the cost is that of stepping from the new square to this one
+						int index = new_y * flowWidth + new_x;
+						int cost = item.first + Dimension::GetTraversalTimeBySize(size, new_x, new_y, -dx, -dy);
+						if (costs[index] != -1 && costs[index] <= cost)
+							continue;
+
+						if (!IsWalkable_FlowField(size, mt, new_x, new_y))
+							continue;
+
+						costs[index] = cost;
+						queue.push(FlowQueueItem(cost, index));
+					}
+				}
+			}
+			return costs;
+		}
+
+		bool FollowFlowField(const FlowField& field, int start_x, int start_y, vector<Dimension::IntPosition>& path)
+		{
+			int x = start_x, y = start_y;
+
+			if (field.costs[y * flowWidth + x] == -1)
+			{
+				return false;
+			}
+
+			path.clear();
+			while (x != field.goalX || y != field.goalY)
+			{
+				int best_cost = -1, best_x = x, best_y = y;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					int new_y = y + dy;
+					if (new_y < 0 || new_y >= flowHeight)
+						continue;
+
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int new_x = x + dx;
+						if ((!dx && !dy) || new_x < 0 || new_x >= flowWidth)
+							continue;
+
+						int cost = field.costs[new_y * flowWidth + new_x];
+						if (cost == -1)
+							continue;
+
+						cost += Dimension::GetTraversalTimeBySize(field.size, x, y, dx, dy);
+						if (best_cost == -1 || cost < best_cost)
+						{
+							best_cost = cost;
+							best_x = new_x;
+							best_y = new_y;
+						}
+					}
+				}
+
+				if (best_cost == -1)
+				{
+					return false;
+				}
+
+				x = best_x;
+				y = best_y;
+				path.push_back(Dimension::IntPosition(x, y));
+			}
+			return true;
+		}
+
+		void FreeFlowField(FlowField& field)
+		{
+			if (field.costs)
+			{
+				delete[] field.costs;
+				field.costs = NULL;
+			}
+			field.goalX = -1;
+			field.goalY = -1;
+			field.calculating = false;
+			field.version++;
+		}
+
+		bool GetFlowFieldPath(int size, int mt, int start_x, int start_y, int goal_x, int goal_y, vector<Dimension::IntPosition>& path)
+		{
+			if (gpmxFlowField == NULL)
+			{
+				return false;
+			}
+
+			SDL_LockMutex(gpmxFlowField);
+
+			FlowField* field = NULL;
+			FlowField* oldest = &flowFields[0];
+			for (int i = 0; i < FLOWFIELD_CACHE_SIZE; i++)
+			{
+				FlowField& cur = flowFields[i];
+				if (cur.goalX == goal_x && cur.goalY == goal_y && cur.size == size && cur.mt == mt)
+				{
+					field = &cur;
+					break;
+				}
+				if (cur.lastUsed < oldest->lastUsed)
+				{
+					oldest = &cur;
+				}
+			}
+
+			if (!field)
+			{
+				// First request for this goal; remember it, but let the unit search on its own
+				FreeFlowField(*oldest);
+				oldest->goalX = goal_x;
+				oldest->goalY = goal_y;
+				oldest->size = size;
+				oldest->mt = mt;
+				oldest->lastUsed = currentFrame;
+				SDL_UnlockMutex(gpmxFlowField);
+				return false;
+			}
+
+			if (!field->costs)
+			{
+				if (field->calculating)
+				{
+					SDL_UnlockMutex(gpmxFlowField);
+					return false;
+				}
+
+				if (currentFrame - field->lastUsed > FLOWFIELD_REQUEST_WINDOW)
+				{
+					field->lastUsed = currentFrame;
+					SDL_UnlockMutex(gpmxFlowField);
+					return false;
+				}
+
+				if (!IsWalkable_FlowField(size, mt, goal_x, goal_y))
+				{
+					field->lastUsed = currentFrame;
+					SDL_UnlockMutex(gpmxFlowField);
+					return false;
+				}
+
+				field->calculating = true;
+				field->lastUsed = currentFrame;
+				Uint32 version = field->version;
+				SDL_UnlockMutex(gpmxFlowField);
+
+				int* costs = CalculateFlowField(size, mt, goal_x, goal_y);
+
+				SDL_LockMutex(gpmxFlowField);
+
+				// The field may have been invalidated or evicted in the meantime
+				if (field->version != version)
+				{
+					SDL_UnlockMutex(gpmxFlowField);
+					delete[] costs;
+					return false;
+				}
+
+				field->costs = costs;
+				field->calculating = false;
+			}
+
+			field->lastUsed = currentFrame;
+
+			bool found = FollowFlowField(*field, start_x, start_y, path);
+
+			SDL_UnlockMutex(gpmxFlowField);
+
+			return found;
+		}
+
+		void InvalidateFlowFields()
+		{
+			if (gpmxFlowField == NULL)
+			{
+				return;
+			}
+
+			SDL_LockMutex(gpmxFlowField);
+			for (int i = 0; i < FLOWFIELD_CACHE_SIZE; i++)
+			{
+				FreeFlowField(flowFields[i]);
+			}
+			SDL_UnlockMutex(gpmxFlowField);
+		}
+
+		void InitFlowFields()
+		{
+			if (gpmxFlowField != NULL)
+			{
+				return;
+			}
+
+			flowWidth = Dimension::pWorld->width;
+			flowHeight = Dimension::pWorld->height;
+
+			for (int i = 0; i < FLOWFIELD_CACHE_SIZE; i++)
+			{
+				flowFields[i].costs = NULL;
+				flowFields[i].size = -1;
+				flowFields[i].mt = -1;
+				flowFields[i].lastUsed = 0;
+				flowFields[i].version = 0;
+				FreeFlowField(flowFields[i]);
+			}
+
+			gpmxFlowField = SDL_CreateMutex();
+		}
+
+		void QuitFlowFields()
+		{
+			if (gpmxFlowField == NULL)
+			{
+				return;
+			}
+
+			for (int i = 0; i < FLOWFIELD_CACHE_SIZE; i++)
+			{
+				FreeFlowField(flowFields[i]);
+			}
+
+			SDL_DestroyMutex(gpmxFlowField);
+			gpmxFlowField = NULL;
+		}
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AIFLOWFIELD_H
+#define AIFLOWFIELD_H
+
+#ifdef DEBUG_DEP
+#warning "aiflowfield.h"
+#endif
+
+#include "dimension-pre.h"
+
+#include <vector>
+
+namespace Game
+{
+	namespace AI
+	{
+		//
+		// Allocate the flow field cache for the current map.
+		//
+		void InitFlowFields();
+
+		//
+		// Free all cached flow fields.
+		//
+		void QuitFlowFields();
+
+		//
+		// Get a path from the start to the goal by following a cached flow field.
+		// A field is only calculated once several units have asked for a path to
+		// the same goal within a short time, as is the case when a group is
+		// ordered to move somewhere. The path, excluding the starting position
+		// and ending with the goal, is placed in path.
+		//
+		// Returns false if there is no field to use; the caller should then do an
+		// ordinary search.
+		//
+		// Safe to call from any pathfinding thread.
+		//
+		bool GetFlowFieldPath(int size, int mt, int start_x, int start_y, int goal_x, int goal_y, std::vector<Dimension::IntPosition>& path);
+
+		//
+		// Throw away all cached flow fields. Call when an immobile unit has been
+		// placed or removed.
+		//
+		void InvalidateFlowFields();
+	}
+}
+
+#ifdef DEBUG_DEP
+#warning "aiflowfield.h-end"
+#endif
+
+#endif
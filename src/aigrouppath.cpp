@@ -0,0 +1,331 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Paths for groups of units sent to the same goal.
+ *
+ * When the player sends a large army somewhere, searching for a path
+ * for each unit separately means doing nearly the same long search
+ * over and over again. Instead, only the unit closest to the centre
+ * of the group gets an ordinary request. The others are assigned a
+ * slot around the goal at about the same place relative to the leader
+ * as they have now, and their requests are held back until the path of
+ * the leader is known. Each of them is then handed that path, followed
+ * by a straight line to its slot, and the pathfinding thread only has
+ * to find a way onto it, the same way blocked paths are repaired.
+ *
+ * Everything here is done by the main thread, so the groups need no
+ * locking of their own.
+ */
+
+#include "aigrouppath.h"
+
+#include "aipathfinding.h"
+#include "aipathrepair.h"
+#include "aibase.h"
+#include "dimension.h"
+#include "unit.h"
+#include "unitsquares.h"
+#include <map>
+#include <cmath>
+
+// Smaller groups are cheap enough to send one unit at a time
+#define GROUPPATH_MIN_UNITS 4
+#define GROUPPATH_MAX_WAIT 100
+
+using namespace std;
+
+namespace Game
+{
+	namespace AI
+	{
+		struct GroupFollower
+		{
+			gc_ptr<Dimension::Unit> unit;
+			int slotX, slotY;
+		};
+
+		struct PathGroup
+		{
+			int goalX, goalY;
+			Uint32 frame;
+			vector<GroupFollower> followers;
+		};
+
+		map<int, PathGroup> pathGroups; // Indexed by handle of the leader
+
+		inline bool IsWalkable_Group(const gc_ptr<Dimension::Unit>& unit, int x, int y)
+		{
+			return Dimension::MovementTypeCanWalkOnSquare_Pathfinding(unit->type->movementType, unit->type->heightOnMap-1, x, y);
+		}
+
+		inline int Clamp_Group(int value, int min, int max)
+		{
+			return value < min ? min : (value > max ? max : value);
+		}
+
+		//
+		// Add a straight line of squares from the last square of the path to the
+		// given slot. Returns false if the line is blocked.
+		//
+		bool AppendConnector(const gc_ptr<Dimension::Unit>& unit, vector<Dimension::IntPosition>& path, int slot_x, int slot_y)
+		{
+			int x = path.back().x, y = path.back().y;
+
+			while (x != slot_x || y != slot_y)
+			{
+				int dx = slot_x > x ? 1 : (slot_x < x ? -1 : 0);
+				int dy = slot_y > y ? 1 : (slot_y < y ? -1 : 0);
+
+				if (!IsWalkable_Group(unit, x + dx, y + dy))
+				{
+					return false;
+				}
+
+				// Do not cut corners
+				if (dx && dy && (!IsWalkable_Group(unit, x + dx, y) || !IsWalkable_Group(unit, x, y + dy)))
+				{
+					return false;
+				}
+
+				x += dx;
+				y += dy;
+				path.push_back(Dimension::IntPosition(x, y));
+			}
+
+			return true;
+		}
+
+		//
+		// Queue the requests of the followers of a group. leader_path is the path
+		// of the leader to the goal of the group, or NULL if there is none.
+		//
+		void ReleaseFollowers(PathGroup& group, const vector<Dimension::IntPosition>* leader_path)
+		{
+			for (vector<GroupFollower>::iterator it = group.followers.begin(); it != group.followers.end(); it++)
+			{
+				const GroupFollower& follower = *it;
+
+				if (!IsPathfindingHeld(follower.unit))
+				{
+					// Already let go of when it was given another command
+					continue;
+				}
+
+				if (leader_path)
+				{
+					vector<Dimension::IntPosition> path(*leader_path);
+					if (AppendConnector(follower.unit, path, follower.slotX, follower.slotY))
+					{
+						StoreSharedPath(follower.unit, follower.slotX, follower.slotY, path);
+					}
+				}
+
+				ReleasePathfinding(follower.unit);
+			}
+		}
+
+		void CommandGroupOfKind(const vector<gc_ptr<Dimension::Unit> >& units, int goal_x, int goal_y, UnitAction action, const Dimension::ActionArguments& args, float rotation, PathPriority priority)
+		{
+			int num_units = units.size();
+
+			if (num_units < GROUPPATH_MIN_UNITS)
+			{
+				for (vector<gc_ptr<Dimension::Unit> >::const_iterator it = units.begin(); it != units.end(); it++)
+				{
+					const gc_ptr<Dimension::Unit>& unit = *it;
+					CommandPathfinding(unit, unit->curAssociatedSquare.x, unit->curAssociatedSquare.y, goal_x, goal_y, action, NULL, args, rotation, priority);
+				}
+				return;
+			}
+
+			int center_x = 0, center_y = 0;
+			for (int i = 0; i < num_units; i++)
+			{
+				center_x += units[i]->curAssociatedSquare.x;
+				center_y += units[i]->curAssociatedSquare.y;
+			}
+			center_x /= num_units;
+			center_y /= num_units;
+
+			// Prefer a leader that is not busy with an earlier request, as the
+			// group would otherwise be handed the path found for that one
+			int leader = -1;
+			int best_score = 0;
+			for (int i = 0; i < num_units; i++)
+			{
+				int dx = units[i]->curAssociatedSquare.x - center_x;
+				int dy = units[i]->curAssociatedSquare.y - center_y;
+				int score = dx * dx + dy * dy;
+				if (IsUndergoingPathCalc(units[i]))
+				{
+					score += Dimension::pWorld->width * Dimension::pWorld->width + Dimension::pWorld->height * Dimension::pWorld->height;
+				}
+				if (leader == -1 || score < best_score)
+				{
+					leader = i;
+					best_score = score;
+				}
+			}
+
+			// Keep the formation about as deep as it is wide, even if the units are spread out
+			int spread = ((int) ceil(sqrt((double) num_units)) / 2 + 1) * units[leader]->type->heightOnMap;
+
+			PathGroup group;
+			group.goalX = goal_x;
+			group.goalY = goal_y;
+			group.frame = currentFrame;
+
+			for (int i = 0; i < num_units; i++)
+			{
+				const gc_ptr<Dimension::Unit>& unit = units[i];
+				GroupFollower follower;
+
+				if (i == leader)
+				{
+					continue;
+				}
+
+				follower.unit = unit;
+				follower.slotX = Clamp_Group(goal_x + Clamp_Group(unit->curAssociatedSquare.x - center_x, -spread, spread), 0, Dimension::pWorld->width-1);
+				follower.slotY = Clamp_Group(goal_y + Clamp_Group(unit->curAssociatedSquare.y - center_y, -spread, spread), 0, Dimension::pWorld->height-1);
+				if (!IsWalkable_Group(unit, follower.slotX, follower.slotY))
+				{
+					follower.slotX = goal_x;
+					follower.slotY = goal_y;
+				}
+
+				if (IsUndergoingPathCalc(unit))
+				{
+					// Its request is already queued, so it cannot be held back
+					CommandPathfinding(unit, unit->curAssociatedSquare.x, unit->curAssociatedSquare.y, follower.slotX, follower.slotY, action, NULL, args, rotation, priority);
+					continue;
+				}
+
+				HoldPathfinding(unit);
+				CommandPathfinding(unit, unit->curAssociatedSquare.x, unit->curAssociatedSquare.y, follower.slotX, follower.slotY, action, NULL, args, rotation, priority);
+				group.followers.push_back(follower);
+			}
+
+			const gc_ptr<Dimension::Unit>& leader_unit = units[leader];
+			CommandPathfinding(leader_unit, leader_unit->curAssociatedSquare.x, leader_unit->curAssociatedSquare.y, goal_x, goal_y, action, NULL, args, rotation, priority);
+
+			if (group.followers.size())
+			{
+				map<int, PathGroup>::iterator it = pathGroups.find(leader_unit->GetHandle());
+				if (it != pathGroups.end())
+				{
+					// The leader is no longer heading for the goal of its old group
+					ReleaseFollowers(it->second, NULL);
+				}
+				pathGroups[leader_unit->GetHandle()] = group;
+			}
+		}
+
+		void CommandGroupPathfinding(const vector<gc_ptr<Dimension::Unit> >& units, int goal_x, int goal_y, UnitAction action, const Dimension::ActionArguments& args, float rotation, PathPriority priority)
+		{
+			// Only units that can walk on the same squares can share a path
+			map<pair<int, int>, vector<gc_ptr<Dimension::Unit> > > kinds;
+
+			goal_x = Clamp_Group(goal_x, 0, Dimension::pWorld->width-1);
+			goal_y = Clamp_Group(goal_y, 0, Dimension::pWorld->height-1);
+
+			for (vector<gc_ptr<Dimension::Unit> >::const_iterator it = units.begin(); it != units.end(); it++)
+			{
+				const gc_ptr<Dimension::Unit>& unit = *it;
+
+				if (!unit->type->isMobile)
+				{
+					continue;
+				}
+
+				if (IsPathfindingHeld(unit))
+				{
+					// Waiting for the leader of an earlier group; that request is obsolete now
+					ReleasePathfinding(unit);
+				}
+
+				kinds[make_pair((int) unit->type->movementType, unit->type->heightOnMap)].push_back(unit);
+			}
+
+			for (map<pair<int, int>, vector<gc_ptr<Dimension::Unit> > >::iterator it = kinds.begin(); it != kinds.end(); it++)
+			{
+				CommandGroupOfKind(it->second, goal_x, goal_y, action, args, rotation, priority);
+			}
+		}
+
+		void ReleaseGroupFollowers(const gc_ptr<Dimension::Unit>& leader, Path* path)
+		{
+			map<int, PathGroup>::iterator it = pathGroups.find(leader->GetHandle());
+			if (it == pathGroups.end())
+			{
+				return;
+			}
+
+			PathGroup& group = it->second;
+
+			if (path && path->numNodes && path->Goal().x == group.goalX && path->Goal().y == group.goalY)
+			{
+				vector<Dimension::IntPosition> leader_path;
+				leader_path.reserve(path->numNodes);
+				for (int i = 0; i < path->numNodes; i++)
+				{
+					leader_path.push_back(Dimension::IntPosition(path->nodes[i].x, path->nodes[i].y));
+				}
+				ReleaseFollowers(group, &leader_path);
+			}
+			else
+			{
+				// The leader was sent elsewhere in the meantime, or the goal could not be reached
+				ReleaseFollowers(group, NULL);
+			}
+
+			pathGroups.erase(it);
+		}
+
+		void ReleaseStaleGroupFollowers()
+		{
+			map<int, PathGroup>::iterator it = pathGroups.begin();
+			while (it != pathGroups.end())
+			{
+				if (currentFrame - it->second.frame > GROUPPATH_MAX_WAIT)
+				{
+					ReleaseFollowers(it->second, NULL);
+					pathGroups.erase(it++);
+				}
+				else
+				{
+					it++;
+				}
+			}
+		}
+
+		void InitGroupPathfinding()
+		{
+			pathGroups.clear();
+		}
+
+		void QuitGroupPathfinding()
+		{
+			// The pathfinding threads are gone, so the followers are not queued
+			pathGroups.clear();
+		}
+	}
+}
@@ -0,0 +1,82 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AIGROUPPATH_H
+#define AIGROUPPATH_H
+
+#ifdef DEBUG_DEP
+#warning "aigrouppath.h"
+#endif
+
+#include "dimension-pre.h"
+#include "unit-pre.h"
+#include "aibase-pre.h"
+#include "action-pre.h"
+#include "aipathfinding-pre.h"
+#include "ainode.h"
+
+#include <vector>
+
+namespace Game
+{
+	namespace AI
+	{
+		//
+		// Prepare the bookkeeping of groups waiting for their leaders' paths.
+		//
+		void InitGroupPathfinding();
+
+		//
+		// Let all waiting groups go and forget them.
+		//
+		void QuitGroupPathfinding();
+
+		//
+		// Send a group of units to a goal with one long search instead of one
+		// per unit. Units that can walk on the same squares are led by the one
+		// closest to their centre; the others are given a slot around the goal
+		// keeping their place in the formation, and their requests are held
+		// back until the leader has its path. Each of them then only needs a
+		// short search to get onto that path, which it follows to its slot.
+		//
+		// Must be called from the main thread.
+		//
+		void CommandGroupPathfinding(const std::vector<gc_ptr<Dimension::Unit> >& units, int goal_x, int goal_y, UnitAction action, const Dimension::ActionArguments& args, float rotation, PathPriority priority = PATHPRIORITY_REPATH);
+
+		//
+		// Let the units following the given unit go, handing them path when it
+		// leads to their goal. path is NULL if no path was found. Called by
+		// ApplyAllNewPaths() for every unit whose path has been calculated.
+		//
+		void ReleaseGroupFollowers(const gc_ptr<Dimension::Unit>& leader, Path* path);
+
+		//
+		// Let go of the units whose leader has not got a path within
+		// GROUPPATH_MAX_WAIT frames, for example because it died.
+		//
+		void ReleaseStaleGroupFollowers();
+	}
+}
+
+#ifdef DEBUG_DEP
+#warning "aigrouppath.h-end"
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Pool of paths.
+ *
+ * Every path calculated used to be a new[]:ed array of nodes, and
+ * units get new paths all the time. Freed paths are instead kept in
+ * one free list per size class, each class holding paths with room
+ * for twice as many squares as the one before, and handed out again.
+ * The free lists are shared by the pathfinding threads, which
+ * allocate paths, and the main thread, which frees them.
+ */
+
+#include "ainode.h"
+
+#include "sdlheader.h"
+#include <cstdlib>
+#include <cstring>
+
+// The smallest size class holds 1 << PATHPOOL_MIN_SHIFT squares
+#define PATHPOOL_MIN_SHIFT 4
+#define PATHPOOL_NUM_CLASSES 16
+// Freed paths beyond this many per class are given back to the system
+#define PATHPOOL_MAX_FREE 256
+
+namespace Game
+{
+	namespace AI
+	{
+		Path*      freePaths[PATHPOOL_NUM_CLASSES];
+		int        numFreePaths[PATHPOOL_NUM_CLASSES];
+		SDL_mutex* gpmxPathPool = NULL;
+
+		// Paths too big for the largest class are not pooled
+		int GetPathSizeClass(int num_nodes)
+		{
+			int size_class = 0;
+			while ((1 << (size_class + PATHPOOL_MIN_SHIFT)) < num_nodes)
+			{
+				size_class++;
+			}
+			return size_class < PATHPOOL_NUM_CLASSES ? size_class : -1;
+		}
+
+		Path* AllocPath(int num_nodes)
+		{
+			int size_class = GetPathSizeClass(num_nodes);
+			Path* path = NULL;
+
+			if (size_class != -1 && gpmxPathPool)
+			{
+				SDL_LockMutex(gpmxPathPool);
+				if (freePaths[size_class])
+				{
+					path = freePaths[size_class];
+					freePaths[size_class] = path->nextFree;
+					numFreePaths[size_class]--;
+				}
+				SDL_UnlockMutex(gpmxPathPool);
+			}
+
+			if (!path)
+			{
+				int capacity = size_class != -1 ? 1 << (size_class + PATHPOOL_MIN_SHIFT) : num_nodes;
+				path = (Path*) malloc(sizeof(Path) + capacity * sizeof(Node));
+				path->nodes = (Node*) (path + 1);
+				path->sizeClass = size_class;
+			}
+
+			path->numNodes = num_nodes;
+			path->cursor = -1;
+			path->nextFree = NULL;
+			return path;
+		}
+
+		void FreePath(Path* path)
+		{
+			if (!path)
+			{
+				return;
+			}
+
+			if (path->sizeClass != -1 && gpmxPathPool)
+			{
+				SDL_LockMutex(gpmxPathPool);
+				if (numFreePaths[path->sizeClass] < PATHPOOL_MAX_FREE)
+				{
+					path->nextFree = freePaths[path->sizeClass];
+					freePaths[path->sizeClass] = path;
+					numFreePaths[path->sizeClass]++;
+					path = NULL;
+				}
+				SDL_UnlockMutex(gpmxPathPool);
+			}
+
+			free(path);
+		}
+
+		Path* ClonePath(const Path* path)
+		{
+			Path* new_path = AllocPath(path->numNodes);
+			memcpy(new_path->nodes, path->nodes, path->numNodes * sizeof(Node));
+			new_path->cursor = path->cursor;
+			return new_path;
+		}
+
+		void InitPathPool()
+		{
+			if (gpmxPathPool != NULL)
+			{
+				return;
+			}
+
+			for (int i = 0; i < PATHPOOL_NUM_CLASSES; i++)
+			{
+				freePaths[i] = NULL;
+				numFreePaths[i] = 0;
+			}
+
+			gpmxPathPool = SDL_CreateMutex();
+		}
+
+		void QuitPathPool()
+		{
+			if (gpmxPathPool == NULL)
+			{
+				return;
+			}
+
+			SDL_LockMutex(gpmxPathPool);
+			for (int i = 0; i < PATHPOOL_NUM_CLASSES; i++)
+			{
+				while (freePaths[i])
+				{
+					Path* path = freePaths[i];
+					freePaths[i] = path->nextFree;
+					free(path);
+				}
+				numFreePaths[i] = 0;
+			}
+			SDL_UnlockMutex(gpmxPathPool);
+
+			SDL_DestroyMutex(gpmxPathPool);
+			gpmxPathPool = NULL;
+		}
+	}
+}
@@ -18,29 +18,112 @@
  * You should have received a copy of the GNU General Public License
  * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
  */
-#ifndef AINODE_H
-#define AINODE_H
-namespace Game
-{
-	namespace AI
-	{
-		struct Node
-		{
-			Node* pParent;
-			Node* pChild;
-
-			int x;
-			int y;
-
-			Node()
-			{
-				pParent = NULL;
-				pChild = NULL;
-				x = 0;
-				y = 0;
-			}
-		};
-	}
-}
-#endif
-
+#ifndef AINODE_H
+#define AINODE_H
+namespace Game
+{
+	namespace AI
+	{
+		struct Node
+		{
+			int x;
+			int y;
+		};
+
+		//
+		// A path, stored as one array of squares, the first being the square the unit
+		// started at and the last being the goal. The cursor is the index of the
+		// square the unit is currently moving towards, or -1 if it has not chosen
+		// one yet.
+		//
+		// Paths are recycled through a pool, so they must be allocated with
+		// AllocPath() and freed with FreePath(); never with new or delete.
+		//
+		struct Path
+		{
+			Node* nodes;
+			int   numNodes;
+			int   cursor;
+
+			int   sizeClass; // Internal to the pool
+			Path* nextFree;
+
+			Node& Start()
+			{
+				return nodes[0];
+			}
+
+			Node& Goal()
+			{
+				return nodes[numNodes-1];
+			}
+
+			Node& CurGoal()
+			{
+				return nodes[cursor];
+			}
+
+			// The square before the current goal; only valid if cursor > 0
+			Node& CurGoalParent()
+			{
+				return nodes[cursor-1];
+			}
+		};
+
+		//
+		// Set up the pool of paths. Until this is called, and after QuitPathPool(),
+		// paths are allocated and freed without being recycled.
+		//
+		void InitPathPool();
+
+		//
+		// Free all paths kept for reuse.
+		//
+		void QuitPathPool();
+
+		//
+		// Get a path with room for num_nodes squares, with the cursor unset.
+		// Safe to call from any thread.
+		//
+		Path* AllocPath(int num_nodes);
+
+		//
+		// Return a path to the pool. Safe to call from any thread.
+		//
+		void FreePath(Path* path);
+
+		//
+		// Make a copy of a path.
+		//
+		Path* ClonePath(const Path* path);
+
+		//
+		// The number of steps of the straight line between two squares dx and dy
+		// squares apart.
+		//
+		inline int LineLength(int dx, int dy)
+		{
+			dx = dx < 0 ? -dx : dx;
+			dy = dy < 0 ? -dy : dy;
+			return dx > dy ? dx : dy;
+		}
+
+		//
+		// The square after step steps along the straight line from the given square
+		// to the one dx and dy squares away. Each square of the line is next to the
+		// one before it. Path smoothing and the network code both use this, so that
+		// all computers agree on which squares a line covers.
+		//
+		inline Node LineSquare(const Node& from, int dx, int dy, int step)
+		{
+			int length = LineLength(dx, dy);
+			Node square;
+
+			// Rounded to the nearest square, halves away from the start
+			square.x = from.x + (dx < 0 ? -((-2 * dx * step + length) / (2 * length)) : (2 * dx * step + length) / (2 * length));
+			square.y = from.y + (dy < 0 ? -((-2 * dy * step + length) / (2 * length)) : (2 * dy * step + length) / (2 * length));
+			return square;
+		}
+	}
+}
+#endif
@@ -30,6 +30,18 @@ namespace Game
 	namespace AI
 	{
 		struct MovementData;
+
+		//
+		// Classes of path requests by where the command came from, most urgent first
+		//
+		enum PathPriority
+		{
+			PATHPRIORITY_LOCAL_COMMAND = 0, // Orders given by the player at this computer
+			PATHPRIORITY_REMOTE_COMMAND,    // Commands received over the network
+			PATHPRIORITY_AI_COMMAND,        // Commands given by lua AI scripts
+			PATHPRIORITY_REPATH,            // Paths recalculated by the engine itself
+			PATHPRIORITY_NUM
+		};
 	}
 }
 
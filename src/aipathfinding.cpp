@@ -52,6 +52,14 @@
  * steps, it will run a special floodfill algorithm starting from the
  * starting square, and setting the goal to the square nearest to the
  * old goal that was reached.
+ *
+ * For long distances, when the goal is known to be reachable, a
+ * coarse path is first found through the abstract graph in
+ * aipathhierarchy.cpp. A* is then run from waypoint to waypoint,
+ * so that each search only has to cover a short distance.
+ *
+ * When several units are sent to the same square, the paths are
+ * instead taken from a shared flow field, see aiflowfield.cpp.
  */
 
 #include "aipathfinding.h"
@@ -62,17 +70,31 @@
 #include "unit.h"
 #include "unitsquares.h"
 #include "networking.h"
-#define BINARY_HEAP_DATATYPE int
-#include "binaryheap.h"
+#include "aipathhierarchy.h"
+#include "aiflowfield.h"
+#include "aipathrepair.h"
+#include "aigrouppath.h"
+#define QUAD_HEAP_DATATYPE int
+#include "quadheap.h"
 #include <map>
 #include <set>
+#include <deque>
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cmath>
 #include <iostream>
 
 #define MAXIMUM_PATH_CALCULATIONS 10000
 #define RECALC_TRACE_LIMIT 1000
 #define RECALC_FLOODFILL_LIMIT 4000
+#define MAXIMUM_REPAIR_CALCULATIONS 2000
+// Number of locks guarding the allocation of pages in the heuristic table
+#define HCONST_SHARDS 8
+// How far past the blocked squares a repaired path rejoins the old one
+#define REPAIR_REJOIN_DISTANCE 3
+// The longest line, in squares, that path smoothing replaces a part of a path with
+#define PATHSMOOTH_MAX_SEGMENT 15
 
 using namespace std;
 
@@ -80,23 +102,34 @@ namespace Game
 {
 	namespace AI
 	{
-		std::queue<gc_ptr<Dimension::Unit> > gCalcQueue;
-		SDL_mutex* gpmxQueue;
 		SDL_mutex* gpmxCommand;
 		SDL_mutex* gpmxDone;
 		SDL_mutex* gpmxThreadState;
 		SDL_mutex* gpmxAreaMap;
-		SDL_mutex* gpmxHConst;
-		set<gc_ptr<Dimension::Unit> > doneUnits;
+		SDL_mutex* gpmxHConstShards[HCONST_SHARDS];
+		vector<gc_ptr<Dimension::Unit> > doneUnits;
 
-		int numPathfindingThreads = 1;
+		// 0 means one thread per core, minus one for the main thread
+		int numPathfindingThreads = 0;
+		int nextQueueThread = 0;
+
+		int pathPriorityBudgets[PATHPRIORITY_NUM] = {PATHPRIORITY_BUDGET_LOCAL_COMMAND,
+		                                             PATHPRIORITY_BUDGET_REMOTE_COMMAND,
+		                                             PATHPRIORITY_BUDGET_AI_COMMAND,
+		                                             PATHPRIORITY_BUDGET_REPATH};
+		int pathPriorityAgingFrames = PATHPRIORITY_AGING_FRAMES;
 
 		ThreadData**         pThreadDatas;
 		volatile Uint16****  areaMaps;
 		volatile bool**      regenerateAreaCodes;
 		volatile bool**      changedSinceLastRegen;
 		volatile int**       numNotReached;
-		volatile Uint16***** hConsts;
+		volatile Uint16***   areaParents;     // Union-find of area codes, per size and movement type
+		int**                nextAreaCodes;
+		Uint32*              areaUpdateStamps; // Visited marks of area map updates, done by the main thread
+		Uint32               areaUpdateStamp;
+		volatile Uint16* volatile * hConstPages; // [unitSize * hConstHeight * hConstWidth + target cell]; page of node cells, or NULL if never updated
+		volatile int         numHConstPages[HCONST_SHARDS]; // Pages allocated per shard; each is only changed under its shard mutex
 		int                hConstHeight, hConstWidth;
 		unsigned char      xShift, yShift;
 		volatile int       cCount = 0, fCount = 0, tCount = 0, pCount = 0, numPaths = 0, numFailed = 0, notReachedFlood = 0, notReachedPath = 0, numGreatSuccess1 = 0, numGreatSuccess2 = 0, numTotalFrames = 0;
@@ -115,6 +148,32 @@ namespace Game
 			int y;
 		};
 
+		//
+		// Per-square scratch data of a thread, 8 bytes per square. The types are
+		// stamps that only mean something if they match the current SQUARE_TYPE_*
+		// or NODE_TYPE_* of the thread; those are increased for each new search, so
+		// nothing has to be cleared between searches, except for once every few
+		// ten thousand searches when they wrap around. Everything a search needs to
+		// know about a square is kept together, so that it is found in a single
+		// cache line.
+		//
+		// The square and node types are kept apart, as a search that has been
+		// interrupted by a trace or floodfill continues where it left off.
+		//
+		struct scratchcell
+		{
+			Uint16 squareType;
+			Uint16 squareEnd;  // Last square of the scanline that begins here, if closed
+			Uint16 nodeType;
+			Uint16 nodeNum;
+		};
+
+#if MAXIMUM_PATH_CALCULATIONS > 65535
+#error "Node numbers must fit in scratchcell::nodeNum"
+#endif
+
+#define SCRATCH_ALIGNMENT 64
+
 		int width, height;
 
 		int  _ThreadMethod(void* arg);
@@ -131,7 +190,7 @@ namespace Game
 			Dimension::IntPosition oldGoal;
 
 			int                nearestNode;
-			binary_heap_t*     heap;
+			quad_heap_t*       heap;
 			bool               calculateNearestReachable;
 			bool               setAreaCodes;
 			PreprocessState    preprocessState;
@@ -153,10 +212,7 @@ namespace Game
 			
 			// Trace & Floodfill
 			
-			unsigned char SQUARE_TYPE_OPEN, SQUARE_TYPE_CLOSED, SQUARE_TYPE_BLOCKED;
-
-			unsigned char**    squareTypes;
-			int**              squareNums;
+			Uint16 SQUARE_TYPE_OPEN, SQUARE_TYPE_CLOSED, SQUARE_TYPE_BLOCKED;
 			
 			// Floodfill
 			
@@ -177,40 +233,91 @@ namespace Game
 
 			// Pathfinding
 
-			unsigned char NODE_TYPE_OPEN, NODE_TYPE_CLOSED;
-			
-			unsigned char**    nodeTypes;
-			int**              nodeNums;
+			Uint16 NODE_TYPE_OPEN, NODE_TYPE_CLOSED;
+
+			// Squares and nodes
+
+			scratchcell*       scratch; // width * height cells, aligned to SCRATCH_ALIGNMENT
+			void*              scratchMemory;
 
 			int lowestH;
 			int circumTracking;
 
 			struct node *nodes;
 
-			Uint32 *scores;
 			int *positions;
 
-			int *openList, openListSize, nextFreeNode;
+			int openListSize, nextFreeNode;
+
+			// Hierarchical pathfinding
+
+			std::vector<Dimension::IntPosition> waypoints;  // Targets of the segments; empty if not used
+			unsigned curWaypoint;
+			std::vector<Dimension::IntPosition> pathPrefix; // Squares of the segments already calculated
+			Dimension::IntPosition segmentStart;
+			int segmentCalcStart;
+
+			// Jump Point Search
+
+			int jpsStartX, jpsStartY, jpsEndX, jpsEndY;
+			int jpsTargetX, jpsTargetY;
+			int jpsCost;
+
+			// Path repair
+
+			std::vector<Dimension::IntPosition> pathSuffix; // Rest of the old path, beginning with the square to rejoin it at; empty if not repairing
+
+			// Path smoothing
+
+			std::vector<int> smoothTimes; // Time to walk from the start of the path to each of its squares
+
+			// Work queues, one per class of requests
+			std::deque<gc_ptr<Dimension::Unit> > queues[PATHPRIORITY_NUM];
+			SDL_mutex* pQueueMutex;
+			PathPriority priority; // Class of the request being calculated
+			PathPriorityStats priorityStats[PATHPRIORITY_NUM]; // numDequeued and the wait times of the requests taken by this thread, guarded by pQueueMutex
+
+			// Calculations charged to each class by this thread during budgetFrame. Only
+			// written by the thread itself, and read by the others without locking
+			volatile int budgetCalcs[PATHPRIORITY_NUM];
+			volatile Uint32 budgetFrame;
+
+			// Per-calculation statistics, added to the global counters when the calculation is done
+			int calcCount;
+			int fsteps, psteps, tsteps;
+			int notReachedFlood, notReachedPath;
+			int numGreatSuccess1, numGreatSuccess2;
 
 			ThreadData(int index)
 			{
 				this->threadIndex = index;
 				this->threadRuntime = true;
 				this->pMutex = SDL_CreateMutex();
+				this->pQueueMutex = SDL_CreateMutex();
 				this->pUnit = NULL;
-				this->pThread = SDL_CreateThread(Game::AI::_ThreadMethod, (void*)this);
-
-				this->squareTypes = (unsigned char**) malloc(height * sizeof(unsigned char*));
-				this->squareNums = (int**) malloc(height * sizeof(int*));
-				this->nodeTypes = (unsigned char**) malloc(height * sizeof(unsigned char*));
-				this->nodeNums = (int**) malloc(height * sizeof(int*));
-				for (int y = 0; y < height; y++)
+				this->pThread = NULL;
+				this->priority = PATHPRIORITY_REPATH;
+				memset(this->priorityStats, 0, sizeof(this->priorityStats));
+				for (int i = 0; i < PATHPRIORITY_NUM; i++)
 				{
-					this->squareTypes[y] = (unsigned char*) calloc(width, sizeof(unsigned char));
-					this->squareNums[y] = (int*) calloc(width, sizeof(int));
-					this->nodeTypes[y] = (unsigned char*) calloc(width, sizeof(unsigned char));
-					this->nodeNums[y] = (int*) calloc(width, sizeof(int));
+					this->budgetCalcs[i] = 0;
 				}
+				this->budgetFrame = 0;
+
+				this->calcCount = 0;
+				this->fsteps = 0;
+				this->psteps = 0;
+				this->tsteps = 0;
+				this->notReachedFlood = 0;
+				this->notReachedPath = 0;
+				this->numGreatSuccess1 = 0;
+				this->numGreatSuccess2 = 0;
+
+				this->curWaypoint = 0;
+				this->segmentCalcStart = 0;
+
+				this->scratchMemory = calloc(width * height * sizeof(scratchcell) + SCRATCH_ALIGNMENT, 1);
+				this->scratch = (scratchcell*) (((size_t) this->scratchMemory + SCRATCH_ALIGNMENT - 1) & ~(size_t) (SCRATCH_ALIGNMENT - 1));
 				if (MAXIMUM_PATH_CALCULATIONS < width*height)
 				{
 					this->openListSize = MAXIMUM_PATH_CALCULATIONS;
@@ -220,9 +327,7 @@ namespace Game
 					this->openListSize = width * height;
 				}
 				this->nodes = new node[this->openListSize];
-				this->scores = new Uint32[this->openListSize];
 				this->positions = new int[this->openListSize];
-				this->openList = new int[this->openListSize];
 
 				this->scanlines = (scanline*) malloc(sizeof(scanline) * 1024);
 				this->scanlineArraySize = 1024;
@@ -230,7 +335,7 @@ namespace Game
 				this->scanlineQueue = new int[width + height];
 				this->scanlineQueueSize = width + height;
 
-				this->heap = binary_heap_create(this->scores, this->openList, this->positions);
+				this->heap = quad_heap_create(this->openListSize, this->positions);
 
 				this->SQUARE_TYPE_OPEN = 1;
 				this->SQUARE_TYPE_CLOSED = 2;
@@ -240,32 +345,27 @@ namespace Game
 				this->NODE_TYPE_CLOSED = 2;
 			}
 
+			// Not done in the constructor, as the thread must not start before all scratch memory is allocated
+			void Start()
+			{
+				this->pThread = SDL_CreateThread(Game::AI::_ThreadMethod, (void*)this);
+			}
+
 			~ThreadData()
 			{
 				SDL_DestroyMutex(this->pMutex);
+				SDL_DestroyMutex(this->pQueueMutex);
 
-				for (int y = 0; y < height; y++)
-				{
-					free(this->squareTypes[y]);
-					free(this->squareNums[y]);
-					free(this->nodeTypes[y]);
-					free(this->nodeNums[y]);
-				}
-				free(this->squareTypes);
-				free(this->squareNums);
-				free(this->nodeTypes);
-				free(this->nodeNums);
+				free(this->scratchMemory);
 
 				delete[] this->nodes;
-				delete[] this->scores;
 				delete[] this->positions;
-				delete[] this->openList;
 
 				free(this->scanlines);
 				
 				delete[] this->scanlineQueue;
 
-				binary_heap_destroy(this->heap);
+				quad_heap_destroy(this->heap);
 
 			}
 		};
@@ -300,16 +400,8 @@ namespace Game
 
 		MovementData::~MovementData()
 		{
-			if (pGoal != NULL)
-			{
-				delete[] pGoal;
-			}
-			
-			if (_goal != NULL)
-			{
-				delete[] _goal;
-			}
-
+			FreePath(pPath);
+			FreePath(_path);
 		}
 
 #define FLOODFILL_FLAG_CALCULATE_NEAREST 1
@@ -323,6 +415,380 @@ namespace Game
 			return Game::Dimension::MovementTypeCanWalkOnSquare_Pathfinding((Game::Dimension::MovementType) areaMapIndex, unitSize, x, y);
 		}
 
+		//
+		// The floodfills that set area codes look at rows of walkability bits
+		// instead of single squares when the bits are available, so that runs of
+		// 64 walkable or blocked squares are skipped in one step.
+		//
+
+		// Index of the lowest set bit of a non-zero word
+		inline int LowestSetBit(Uint64 word)
+		{
+#ifdef __GNUC__
+			return __builtin_ctzll(word);
+#else
+			int bit = 0;
+			while (!(word & 1))
+			{
+				word >>= 1;
+				bit++;
+			}
+			return bit;
+#endif
+		}
+
+		// Index of the highest set bit of a non-zero word
+		inline int HighestSetBit(Uint64 word)
+		{
+#ifdef __GNUC__
+			return 63 - __builtin_clzll(word);
+#else
+			int bit = 63;
+			while (!(word & ((Uint64) 1 << 63)))
+			{
+				word <<= 1;
+				bit--;
+			}
+			return bit;
+#endif
+		}
+
+		//
+		// Find the first square from x up to end_x whose bit equals walkable.
+		// Returns end_x+1 if there is none.
+		//
+		inline int FindInRow(const Uint64* row, int x, int end_x, bool walkable)
+		{
+			while (x <= end_x)
+			{
+				Uint64 word = (walkable ? row[x >> 6] : ~row[x >> 6]) >> (x & 63);
+				if (word)
+				{
+					return min(x + LowestSetBit(word), end_x + 1);
+				}
+				x = (x | 63) + 1;
+			}
+			return end_x + 1;
+		}
+
+		//
+		// Find the last square from x down to start_x whose bit equals walkable.
+		// Returns start_x-1 if there is none.
+		//
+		inline int FindInRowBackwards(const Uint64* row, int x, int start_x, bool walkable)
+		{
+			while (x >= start_x)
+			{
+				int shift = 63 - (x & 63);
+				Uint64 word = (walkable ? row[x >> 6] : ~row[x >> 6]) << shift;
+				if (word)
+				{
+					return max((x & ~63) + HighestSetBit(word) - shift, start_x - 1);
+				}
+				x = (x & ~63) - 1;
+			}
+			return start_x - 1;
+		}
+
+		//
+		// The first square walkable for the area map from x up to end_x, or end_x+1
+		//
+		inline int NextWalkable_MType(int x, int end_x, int y, int areaMapIndex, int unitSize)
+		{
+			const Uint64* row = Dimension::GetWalkabilityRow((Dimension::MovementType) areaMapIndex, unitSize, y);
+			if (row)
+			{
+				return FindInRow(row, x, end_x, true);
+			}
+			while (x <= end_x && !IsWalkable_MType(x, y, areaMapIndex, unitSize))
+			{
+				x++;
+			}
+			return x;
+		}
+
+		//
+		// The first square of the run of squares walkable for the area map that
+		// contains the walkable square x
+		//
+		inline int RunStart_MType(int x, int y, int areaMapIndex, int unitSize)
+		{
+			const Uint64* row = Dimension::GetWalkabilityRow((Dimension::MovementType) areaMapIndex, unitSize, y);
+			if (row)
+			{
+				return FindInRowBackwards(row, x, 0, false) + 1;
+			}
+			while (IsWalkable_MType(x-1, y, areaMapIndex, unitSize))
+			{
+				x--;
+			}
+			return x;
+		}
+
+		//
+		// The last square of the run of squares walkable for the area map that
+		// contains the walkable square x
+		//
+		inline int RunEnd_MType(int x, int y, int areaMapIndex, int unitSize)
+		{
+			const Uint64* row = Dimension::GetWalkabilityRow((Dimension::MovementType) areaMapIndex, unitSize, y);
+			if (row)
+			{
+				return FindInRow(row, x, width - 1, false) - 1;
+			}
+			while (IsWalkable_MType(x+1, y, areaMapIndex, unitSize))
+			{
+				x++;
+			}
+			return x;
+		}
+
+		//
+		// Area codes are kept up to date incrementally when immobile units are placed
+		// or removed, instead of flooding the whole map again. Codes of areas that
+		// have been joined are merged with a union-find structure, so the area of a
+		// square is the root of the code stored for it. Areas that may have been
+		// split are checked with a floodfill limited to the big squares around the
+		// new unit; only if that is inconclusive is the whole map flooded again.
+		//
+
+#define AREACODE_MAX 65536
+// Maximum number of squares to relabel when an area has been split
+#define AREAMAP_SPLIT_BUDGET 4096
+
+		inline Uint16 FindAreaRoot(int size, int mt, Uint16 code)
+		{
+			while (areaParents[size][mt][code] != code)
+			{
+				code = areaParents[size][mt][code];
+			}
+			return code;
+		}
+
+		//
+		// The area of a square, or 0 if it is not walkable. Must be called with
+		// gpmxAreaMap held, as InitAreaMap() rebuilds the maps in place.
+		//
+		inline Uint16 GetAreaCode(int size, int mt, int x, int y)
+		{
+			return FindAreaRoot(size, mt, areaMaps[size][mt][y][x]);
+		}
+
+		// Must be called with gpmxAreaMap held
+		Uint16 CompressAreaRoot(int size, int mt, Uint16 code)
+		{
+			volatile Uint16* parents = areaParents[size][mt];
+			while (parents[code] != code)
+			{
+				parents[code] = parents[parents[code]];
+				code = parents[code];
+			}
+			return code;
+		}
+
+		// Must be called with gpmxAreaMap held
+		Uint16 UniteAreas(int size, int mt, Uint16 a, Uint16 b)
+		{
+			a = CompressAreaRoot(size, mt, a);
+			b = CompressAreaRoot(size, mt, b);
+			if (a != b)
+			{
+				// Keep the lowest code as root, so that the result does not depend on the order of merges
+				if (a < b)
+				{
+					areaParents[size][mt][b] = a;
+				}
+				else
+				{
+					areaParents[size][mt][a] = b;
+					a = b;
+				}
+			}
+			return a;
+		}
+
+		// Returns 0 if the codes have run out
+		Uint16 NewAreaCode(int size, int mt)
+		{
+			if (nextAreaCodes[size][mt] >= AREACODE_MAX)
+			{
+				return 0;
+			}
+			Uint16 code = (Uint16) nextAreaCodes[size][mt]++;
+			areaParents[size][mt][code] = code;
+			return code;
+		}
+
+		Uint32 NewAreaUpdateStamp()
+		{
+			areaUpdateStamp++;
+			if (areaUpdateStamp == 0)
+			{
+				memset(areaUpdateStamps, 0, width * height * sizeof(Uint32));
+				areaUpdateStamp = 1;
+			}
+			return areaUpdateStamp;
+		}
+
+		enum AreaFloodResult
+		{
+			AREAFLOOD_DONE,
+			AREAFLOOD_CONNECTED,
+			AREAFLOOD_TOO_BIG
+		};
+
+		//
+		// Flood from the given square over squares of the given area within the
+		// window, stamping them with stamp. Stops if a square stamped with stop_stamp
+		// is found, unless stop_stamp is 0, or if more than max_squares squares have
+		// been visited.
+		//
+		AreaFloodResult FloodAreaLocally(int size, int mt, int start_x, int start_y, Uint16 area, Uint32 stamp, Uint32 stop_stamp,
+		                      int window_start_x, int window_start_y, int window_end_x, int window_end_y,
+		                      unsigned max_squares, vector<int>& visited)
+		{
+			visited.clear();
+			visited.push_back(start_y * width + start_x);
+			areaUpdateStamps[start_y * width + start_x] = stamp;
+
+			for (unsigned i = 0; i < visited.size(); i++)
+			{
+				int x = visited[i] % width, y = visited[i] / width;
+
+				if (visited.size() > max_squares)
+				{
+					return AREAFLOOD_TOO_BIG;
+				}
+
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					int new_y = y + dy;
+					if (new_y < window_start_y || new_y > window_end_y)
+						continue;
+
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int new_x = x + dx;
+						if ((!dx && !dy) || new_x < window_start_x || new_x > window_end_x)
+							continue;
+
+						int index = new_y * width + new_x;
+						if (areaUpdateStamps[index] == stamp)
+							continue;
+
+						if (areaMaps[size][mt][new_y][new_x] == 0 || CompressAreaRoot(size, mt, areaMaps[size][mt][new_y][new_x]) != area)
+							continue;
+
+						if (stop_stamp && areaUpdateStamps[index] == stop_stamp)
+						{
+							return AREAFLOOD_CONNECTED;
+						}
+
+						areaUpdateStamps[index] = stamp;
+						visited.push_back(index);
+					}
+				}
+			}
+			return AREAFLOOD_DONE;
+		}
+
+		//
+		// Update the area map after an immobile unit covering the rectangle has been
+		// placed, and the clearance around it updated. Returns false if the area map
+		// has to be regenerated.
+		//
+		bool SplitAreaMap(int size, int mt, int start_x, int start_y, int end_x, int end_y)
+		{
+			int border_start_x = max(start_x - 3, 0), border_start_y = max(start_y - 3, 0);
+			int border_end_x = min(end_x + 3, width - 1), border_end_y = min(end_y + 3, height - 1);
+			set<Uint16> areas;
+			vector<int> border;
+			vector<int> visited;
+
+			// Block the squares the unit has made unwalkable, by the same test as the floodfill that sets the codes
+			for (int y = border_start_y + 1; y < border_end_y; y++)
+			{
+				for (int x = border_start_x + 1; x < border_end_x; x++)
+				{
+					if (areaMaps[size][mt][y][x] && !IsWalkable_MType(x, y, mt, size))
+					{
+						areas.insert(CompressAreaRoot(size, mt, areaMaps[size][mt][y][x]));
+						areaMaps[size][mt][y][x] = 0;
+					}
+				}
+			}
+
+			int window_start_x = max(((start_x >> Dimension::bigSquareRightShift) - 1) << Dimension::bigSquareRightShift, 0);
+			int window_start_y = max(((start_y >> Dimension::bigSquareRightShift) - 1) << Dimension::bigSquareRightShift, 0);
+			int window_end_x = min(((end_x >> Dimension::bigSquareRightShift) + 2) << Dimension::bigSquareRightShift, width) - 1;
+			int window_end_y = min(((end_y >> Dimension::bigSquareRightShift) + 2) << Dimension::bigSquareRightShift, height) - 1;
+
+			for (set<Uint16>::iterator it = areas.begin(); it != areas.end(); it++)
+			{
+				Uint16 area = *it;
+
+				// The squares around the unit that still belong to the area
+				border.clear();
+				for (int y = border_start_y; y <= border_end_y; y++)
+				{
+					for (int x = border_start_x; x <= border_end_x; x++)
+					{
+						if (areaMaps[size][mt][y][x] && CompressAreaRoot(size, mt, areaMaps[size][mt][y][x]) == area)
+						{
+							border.push_back(y * width + x);
+						}
+					}
+				}
+
+				if (border.size() < 2)
+				{
+					continue;
+				}
+
+				// If they are all still connected near the unit, the area can not have been split
+				Uint32 local_stamp = NewAreaUpdateStamp();
+				FloodAreaLocally(size, mt, border[0] % width, border[0] / width, area, local_stamp, 0,
+				                 window_start_x, window_start_y, window_end_x, window_end_y,
+				                 width * height, visited);
+
+				for (unsigned i = 1; i < border.size(); i++)
+				{
+					if (areaUpdateStamps[border[i]] >= local_stamp)
+					{
+						continue;
+					}
+
+					// Find out whether this part of the area is cut off from the rest
+					Uint32 split_stamp = NewAreaUpdateStamp();
+					AreaFloodResult result = FloodAreaLocally(size, mt, border[i] % width, border[i] / width, area, split_stamp, local_stamp,
+					                                          0, 0, width - 1, height - 1,
+					                                          AREAMAP_SPLIT_BUDGET, visited);
+					if (result == AREAFLOOD_CONNECTED)
+					{
+						// Connected by a detour outside the big squares around the unit
+						continue;
+					}
+					if (result == AREAFLOOD_TOO_BIG)
+					{
+						return false;
+					}
+
+					Uint16 new_area = NewAreaCode(size, mt);
+					if (!new_area)
+					{
+						return false;
+					}
+
+					for (unsigned j = 0; j < visited.size(); j++)
+					{
+						areaMaps[size][mt][visited[j] / width][visited[j] % width] = new_area;
+					}
+				}
+			}
+
+			return true;
+		}
+
 		void InitAreaMap(ThreadData *tdata, int size, int mt)
 		{
 			int x, y;
@@ -339,6 +805,12 @@ namespace Game
 				{
 					areaMaps[size][mt][y] = new Uint16[width];
 				}
+				areaParents[size][mt] = new volatile Uint16[AREACODE_MAX];
+			}
+
+			for (int i = 0; i < AREACODE_MAX; i++)
+			{
+				areaParents[size][mt][i] = (Uint16) i;
 			}
 
 			for (y = 0; y < height; y++)
@@ -348,9 +820,9 @@ namespace Game
 			tdata->areaCode = 1;
 			for (y = 0; y < height; y++)
 			{
-				for (x = 0; x < width; x++)
+				for (x = NextWalkable_MType(0, width-1, y, mt, size); x < width; x = NextWalkable_MType(x+1, width-1, y, mt, size))
 				{
-					if (areaMaps[size][mt][y][x] == 0 && IsWalkable_MType(x, y, mt, size))
+					if (areaMaps[size][mt][y][x] == 0)
 					{
 						if (InitFloodfill(tdata, x, y, FLOODFILL_FLAG_SET_AREA_CODE) == PATHSTATE_OK)
 						{
@@ -367,6 +839,8 @@ namespace Game
 					}
 				}
 			}
+			// If the codes wrapped, no more can be handed out without reusing one
+			nextAreaCodes[size][mt] = tdata->areaCode < 2 ? AREACODE_MAX : tdata->areaCode;
 			regenerateAreaCodes[size][mt] = false;
 			changedSinceLastRegen[size][mt] = false;
 
@@ -406,25 +880,18 @@ namespace Game
 						int end_x_path = end_x + (i << 1) + 1;
 						int end_y_path = end_y + (i << 1) + 1;
 						Uint16 last_found_area_code = 0;
+						Uint16 code;
 						int x, y;
 						for (int k = 0; k < 2; k++)
 						{
 							y = k ? end_y_path : start_y_path;
 							for (x = start_x_path; x <= end_x_path; x++)
 							{
-								if (x >= 0 && y >= 0 && x < width && y < height)
+								if (x >= 0 && y >= 0 && x < width && y < height && areaMaps[j][i][y][x])
 								{
-									if (areaMaps[j][i][y][x] && areaMaps[j][i][y][x] != last_found_area_code)
-									{
-										if (last_found_area_code == 0)
-										{
-											last_found_area_code = areaMaps[j][i][y][x];
-										}
-										else
-										{
-											goto fail;
-										}
-									}
+									// Areas meeting where the unit was have been joined
+									code = CompressAreaRoot(j, i, areaMaps[j][i][y][x]);
+									last_found_area_code = last_found_area_code ? UniteAreas(j, i, last_found_area_code, code) : code;
 								}
 							}
 						}
@@ -433,19 +900,11 @@ namespace Game
 							x = k ? end_x_path : start_x_path;
 							for (y = start_y_path+1; y < end_y_path; y++)
 							{
-								if (x >= 0 && y >= 0 && x < width && y < height)
+								if (x >= 0 && y >= 0 && x < width && y < height && areaMaps[j][i][y][x])
 								{
-									if (areaMaps[j][i][y][x] && areaMaps[j][i][y][x] != last_found_area_code)
-									{
-										if (last_found_area_code == 0)
-										{
-											last_found_area_code = areaMaps[j][i][y][x];
-										}
-										else
-										{
-											goto fail;
-										}
-									}
+									// Areas meeting where the unit was have been joined
+									code = CompressAreaRoot(j, i, areaMaps[j][i][y][x]);
+									last_found_area_code = last_found_area_code ? UniteAreas(j, i, last_found_area_code, code) : code;
 								}
 							}
 						}
@@ -471,61 +930,309 @@ namespace Game
 				}
 			}
 			SDL_UnlockMutex(gpmxAreaMap);
+
+			InvalidatePathHierarchy(start_x, start_y, end_x, end_y);
+			InvalidateFlowFields();
 		}
 
+		//
+		// Called when an immobile unit has been placed on the map, after the
+		// clearance around it has been updated.
+		//
 		void AddUnitToAreaMap(const gc_ptr<Dimension::Unit>& unit)
 		{
+			int start_x, start_y, end_x, end_y;
+			GetUnitUpperLeftCorner(unit, start_x, start_y);
+			end_x = start_x + unit->type->widthOnMap - 1;
+			end_y = start_y + unit->type->heightOnMap - 1;
+			InvalidatePathHierarchy(start_x, start_y, end_x, end_y);
+			InvalidateFlowFields();
+
+			SDL_LockMutex(gpmxAreaMap);
 			for (int j = 0; j < 4; j++)
 			{
 				for (int i = 0; i < Game::Dimension::MOVEMENT_TYPES_NUM; i++)
 				{
-					changedSinceLastRegen[j][i] = true;
+					if (!areaMaps[j][i] || regenerateAreaCodes[j][i])
+					{
+						changedSinceLastRegen[j][i] = true;
+					}
+					else if (!SplitAreaMap(j, i, start_x, start_y, end_x, end_y))
+					{
+						changedSinceLastRegen[j][i] = true;
+						regenerateAreaCodes[j][i] = true;
+					}
 				}
 			}
+			SDL_UnlockMutex(gpmxAreaMap);
+
+			// The area maps now know of the unit, and must be told when it is removed
+			unit->usedInAreaMaps = true;
 		}
 
-		void InitPathfindingThreading(void)
+		//
+		// Put a unit in the work queue of a pathfinding thread. If thread is -1, the
+		// threads are given work round-robin; idle threads will steal work from the
+		// others anyway, so the distribution need not be perfect.
+		// Must be called with gpmxCommand held.
+		//
+		void EnqueuePathfinding(const gc_ptr<Dimension::Unit>& unit, int thread = -1)
 		{
-			width = Game::Dimension::pWorld->width;
-			height = Game::Dimension::pWorld->width;
-			if (pThreadDatas != NULL)
+			if (thread == -1)
 			{
+				thread = nextQueueThread;
+				nextQueueThread = (nextQueueThread + 1) % numPathfindingThreads;
+			}
+
+			if (unit->pMovementData->_heldForGroup)
+			{
+				// Left waiting until ReleasePathfinding() is called
 				return;
 			}
-			
-			pThreadDatas = new ThreadData*[numPathfindingThreads];
-			
-			gpmxQueue = SDL_CreateMutex();
-			gpmxCommand = SDL_CreateMutex();
-			gpmxDone = SDL_CreateMutex();
-			gpmxThreadState = SDL_CreateMutex();
-			gpmxAreaMap = SDL_CreateMutex();
-			gpmxHConst = SDL_CreateMutex();
 
-			numNotReached = new volatile int*[4];
-			changedSinceLastRegen = new volatile bool*[4];
-			regenerateAreaCodes = new volatile bool*[4];
-			areaMaps = new volatile Uint16***[4];
-			for (int j = 0; j < 4; j++)
+			ThreadData *tdata = pThreadDatas[thread];
+			SDL_LockMutex(tdata->pQueueMutex);
+			unit->pMovementData->_queuedFrame = currentFrame;
+			tdata->queues[unit->pMovementData->_priority].push_back(unit);
+			SDL_UnlockMutex(tdata->pQueueMutex);
+		}
+
+		//
+		// Calculations used of the budget of the given class during the current frame,
+		// by all threads together. The counts are read without locking; one read while
+		// it is being updated only puts a request slightly out of order.
+		//
+		int GetPathPriorityCalcs(int priority)
+		{
+			int calcs = 0;
+			for (int i = 0; i < numPathfindingThreads; i++)
 			{
-				numNotReached[j] = new volatile int[Game::Dimension::MOVEMENT_TYPES_NUM];;
-				changedSinceLastRegen[j] = new volatile bool[Game::Dimension::MOVEMENT_TYPES_NUM];
-				regenerateAreaCodes[j] = new volatile bool[Game::Dimension::MOVEMENT_TYPES_NUM];
-				areaMaps[j] = new volatile Uint16**[Game::Dimension::MOVEMENT_TYPES_NUM];
-				for (int i = 0; i < Game::Dimension::MOVEMENT_TYPES_NUM; i++)
+				ThreadData *other = pThreadDatas[i];
+				if (other->budgetFrame == currentFrame)
+				{
+					calcs += other->budgetCalcs[priority];
+				}
+			}
+			return calcs;
+		}
+
+		//
+		// How urgent a waiting request is; lower is more urgent. A request rises one
+		// class for every pathPriorityAgingFrames frames it has waited, and requests of
+		// classes that have used up their budget come after all others.
+		//
+		int GetPathUrgency(const gc_ptr<Dimension::Unit>& unit, int priority)
+		{
+			int urgency = priority;
+
+			if (pathPriorityAgingFrames > 0)
+			{
+				urgency -= (currentFrame - unit->pMovementData->_queuedFrame) / pathPriorityAgingFrames;
+				if (urgency < 0)
+				{
+					urgency = 0;
+				}
+			}
+
+			if (GetPathPriorityCalcs(priority) >= pathPriorityBudgets[priority])
+			{
+				urgency += PATHPRIORITY_NUM;
+			}
+
+			return urgency;
+		}
+
+		//
+		// Take the most urgent request at the front of the queues of the given thread,
+		// and return its class, or -1 if the queues are empty.
+		// Must be called with the pQueueMutex of the thread held.
+		//
+		int PopMostUrgentRequest(ThreadData* victim, gc_ptr<Dimension::Unit>& unit)
+		{
+			int best_priority = -1, best_urgency = 0;
+
+			for (int i = 0; i < PATHPRIORITY_NUM; i++)
+			{
+				if (!victim->queues[i].empty())
+				{
+					int urgency = GetPathUrgency(victim->queues[i].front(), i);
+					if (best_priority == -1 || urgency < best_urgency)
+					{
+						best_priority = i;
+						best_urgency = urgency;
+					}
+				}
+			}
+
+			if (best_priority != -1)
+			{
+				unit = victim->queues[best_priority].front();
+				victim->queues[best_priority].pop_front();
+			}
+
+			return best_priority;
+		}
+
+		//
+		// Fetch the next unit to calculate a path for: the most urgent request in the
+		// thread's own queues, or, when those are empty, the most urgent one of the
+		// first other thread that has any. Each queue is taken in the order it was
+		// filled, but as requests are spread over the threads and stolen between them,
+		// requests of the same class are not necessarily calculated in the order they
+		// were made.
+		//
+		bool DequeuePathfinding(ThreadData* tdata)
+		{
+			gc_ptr<Dimension::Unit> unit;
+			int priority;
+
+			SDL_LockMutex(tdata->pQueueMutex);
+			priority = PopMostUrgentRequest(tdata, unit);
+			SDL_UnlockMutex(tdata->pQueueMutex);
+
+			for (int i = 1; priority == -1 && i < numPathfindingThreads; i++)
+			{
+				ThreadData *victim = pThreadDatas[(tdata->threadIndex + i) % numPathfindingThreads];
+				SDL_LockMutex(victim->pQueueMutex);
+				priority = PopMostUrgentRequest(victim, unit);
+				SDL_UnlockMutex(victim->pQueueMutex);
+			}
+
+			if (priority == -1)
+			{
+				return false;
+			}
+
+			SDL_LockMutex(tdata->pQueueMutex);
+			PathPriorityStats& stats = tdata->priorityStats[priority];
+			Uint32 wait = currentFrame - unit->pMovementData->_queuedFrame;
+			stats.numDequeued++;
+			stats.totalWaitFrames += wait;
+			if (wait > stats.maxWaitFrames)
+			{
+				stats.maxWaitFrames = wait;
+			}
+			SDL_UnlockMutex(tdata->pQueueMutex);
+
+			tdata->pUnit = unit;
+			tdata->priority = (PathPriority) priority;
+			tdata->pUnit->pMovementData->_associatedThread = tdata->threadIndex;
+			return true;
+		}
+
+		//
+		// Charge the calculations of a finished request to the budget of its class.
+		//
+		void ChargePathPriority(ThreadData* tdata)
+		{
+			if (tdata->budgetFrame != currentFrame)
+			{
+				// Cleared before the new frame is stamped, so that no other thread adds in last frame's counts
+				for (int i = 0; i < PATHPRIORITY_NUM; i++)
+				{
+					tdata->budgetCalcs[i] = 0;
+				}
+				tdata->budgetFrame = currentFrame;
+			}
+			tdata->budgetCalcs[tdata->priority] += tdata->calcCount;
+		}
+
+		void GetPathPriorityStats(PathPriority priority, PathPriorityStats& stats)
+		{
+			memset(&stats, 0, sizeof(stats));
+
+			if (pThreadDatas == NULL)
+			{
+				return;
+			}
+
+			for (int i = 0; i < numPathfindingThreads; i++)
+			{
+				ThreadData *tdata = pThreadDatas[i];
+				SDL_LockMutex(tdata->pQueueMutex);
+				stats.queueDepth += tdata->queues[priority].size();
+				stats.numDequeued += tdata->priorityStats[priority].numDequeued;
+				stats.totalWaitFrames += tdata->priorityStats[priority].totalWaitFrames;
+				if (tdata->priorityStats[priority].maxWaitFrames > stats.maxWaitFrames)
+				{
+					stats.maxWaitFrames = tdata->priorityStats[priority].maxWaitFrames;
+				}
+				SDL_UnlockMutex(tdata->pQueueMutex);
+			}
+
+			stats.calcsThisFrame = GetPathPriorityCalcs(priority);
+		}
+
+		void InitPathfindingThreading(void)
+		{
+			width = Game::Dimension::pWorld->width;
+			height = Game::Dimension::pWorld->height;
+			if (pThreadDatas != NULL)
+			{
+				return;
+			}
+
+			if (numPathfindingThreads <= 0)
+			{
+				numPathfindingThreads = Utilities::GetNumProcessors() - 1;
+				if (numPathfindingThreads < 1)
+				{
+					numPathfindingThreads = 1;
+				}
+			}
+
+			nextQueueThread = 0;
+			
+			pThreadDatas = new ThreadData*[numPathfindingThreads];
+			
+			gpmxCommand = SDL_CreateMutex();
+			gpmxDone = SDL_CreateMutex();
+			gpmxThreadState = SDL_CreateMutex();
+			gpmxAreaMap = SDL_CreateMutex();
+			for (int i = 0; i < HCONST_SHARDS; i++)
+			{
+				gpmxHConstShards[i] = SDL_CreateMutex();
+			}
+
+			numNotReached = new volatile int*[4];
+			changedSinceLastRegen = new volatile bool*[4];
+			regenerateAreaCodes = new volatile bool*[4];
+			areaMaps = new volatile Uint16***[4];
+			areaParents = new volatile Uint16**[4];
+			nextAreaCodes = new int*[4];
+			for (int j = 0; j < 4; j++)
+			{
+				numNotReached[j] = new volatile int[Game::Dimension::MOVEMENT_TYPES_NUM];;
+				changedSinceLastRegen[j] = new volatile bool[Game::Dimension::MOVEMENT_TYPES_NUM];
+				regenerateAreaCodes[j] = new volatile bool[Game::Dimension::MOVEMENT_TYPES_NUM];
+				areaMaps[j] = new volatile Uint16**[Game::Dimension::MOVEMENT_TYPES_NUM];
+				areaParents[j] = new volatile Uint16*[Game::Dimension::MOVEMENT_TYPES_NUM];
+				nextAreaCodes[j] = new int[Game::Dimension::MOVEMENT_TYPES_NUM];
+				for (int i = 0; i < Game::Dimension::MOVEMENT_TYPES_NUM; i++)
 				{
 					numNotReached[j][i] = 0;
 					changedSinceLastRegen[j][i] = true;
 					regenerateAreaCodes[j][i] = true;
 					areaMaps[j][i] = NULL;
+					areaParents[j][i] = NULL;
+					nextAreaCodes[j][i] = AREACODE_MAX;
 				}
 			}
 
+			areaUpdateStamps = new Uint32[width * height];
+			memset(areaUpdateStamps, 0, width * height * sizeof(Uint32));
+			areaUpdateStamp = 0;
+
 			for (int i = 0; i < numPathfindingThreads; i++)
 			{
 				pThreadDatas[i] = new ThreadData(i);
 			}
 
+			for (int i = 0; i < numPathfindingThreads; i++)
+			{
+				pThreadDatas[i]->Start();
+			}
+
 			hConstWidth = width;
 			hConstHeight = height;
 
@@ -544,12 +1251,22 @@ namespace Game
 				hConstHeight = (height >> yShift) + 1;
 			}
 
-			hConsts = new volatile Uint16****[4];
-			for (int i = 0; i < 4; i++)
+			hConstPages = new volatile Uint16*[4 * hConstHeight * hConstWidth];
+			for (int i = 0; i < 4 * hConstHeight * hConstWidth; i++)
+			{
+				hConstPages[i] = NULL;
+			}
+			for (int i = 0; i < HCONST_SHARDS; i++)
 			{
-				hConsts[i] = NULL;
+				numHConstPages[i] = 0;
 			}
 
+			InitPathHierarchy();
+			InitFlowFields();
+			InitPathRepair();
+			InitPathPool();
+			InitGroupPathfinding();
+
 		}
 		
 		void QuitPathfindingThreading(void)
@@ -568,12 +1285,6 @@ namespace Game
 				
 			}
 			
-			if (gpmxQueue != NULL)
-			{
-				SDL_DestroyMutex(gpmxQueue);
-				gpmxQueue = NULL;
-			}
-			
 			for (int j = 0; j < 4; j++)
 			{
 				for (int i = 0; i < Game::Dimension::MOVEMENT_TYPES_NUM; i++)
@@ -585,6 +1296,7 @@ namespace Game
 							delete[] areaMaps[j][i][y];
 						}
 						delete[] areaMaps[j][i];
+						delete[] areaParents[j][i];
 					}
 				}
 
@@ -592,14 +1304,47 @@ namespace Game
 				delete[] changedSinceLastRegen[j];
 				delete[] regenerateAreaCodes[j];
 				delete[] areaMaps[j];
+				delete[] areaParents[j];
+				delete[] nextAreaCodes[j];
 			}
 			delete[] numNotReached;
 			delete[] changedSinceLastRegen;
 			delete[] regenerateAreaCodes;
 			delete[] areaMaps;
+			delete[] areaParents;
+			delete[] nextAreaCodes;
+			delete[] areaUpdateStamps;
+
+			for (int i = 0; i < PATHPRIORITY_NUM; i++)
+			{
+				PathPriorityStats stats;
+				GetPathPriorityStats((PathPriority) i, stats);
+				cout << "Path requests of class " << i << ": " << stats.numDequeued << ", waited " << (stats.numDequeued ? (double) stats.totalWaitFrames / stats.numDequeued : 0.0) << " frames on average, at most " << stats.maxWaitFrames << endl;
+			}
 
 			delete[] pThreadDatas;
 			pThreadDatas = NULL;
+
+			cout << "Heuristic table: " << GetNumHConstPages() << " of " << 4 * hConstHeight * hConstWidth << " pages used, " << GetHConstMemoryUsage() << " bytes" << endl;
+
+			for (int i = 0; i < 4 * hConstHeight * hConstWidth; i++)
+			{
+				delete[] hConstPages[i];
+			}
+			delete[] hConstPages;
+			hConstPages = NULL;
+
+			for (int i = 0; i < HCONST_SHARDS; i++)
+			{
+				SDL_DestroyMutex(gpmxHConstShards[i]);
+			}
+
+
+			QuitPathHierarchy();
+			QuitFlowFields();
+			QuitPathRepair();
+			QuitPathPool();
+			QuitGroupPathfinding();
 		}
 		
 		void PausePathfinding()
@@ -621,10 +1366,8 @@ namespace Game
 		int PausePathfinding(const gc_ptr<Dimension::Unit>& unit)
 		{
 			SDL_LockMutex(gpmxCommand);
-			SDL_LockMutex(gpmxQueue);
 			int thread = unit->pMovementData->_associatedThread;
 			SDL_UnlockMutex(gpmxCommand);
-			SDL_UnlockMutex(gpmxQueue);
 			if (thread != -1)
 				SDL_LockMutex(pThreadDatas[thread]->pMutex);
 			return thread;
@@ -669,9 +1412,7 @@ namespace Game
 
 			const gc_ptr<MovementData>& md = unit->pMovementData;
 
-			md->pStart = NULL;
-			md->pGoal = NULL;
-			md->pCurGoalNode = NULL;
+			md->pPath = NULL;
 			md->calcState = CALCSTATE_REACHED_GOAL;
 
 			md->_currentState = INTTHRSTATE_NONE;
@@ -679,8 +1420,10 @@ namespace Game
 			md->_associatedThread = -1;
 			md->_newCommandWhileUnApplied = false;
 
-			md->_start = NULL;
-			md->_goal = NULL;
+			md->_path = NULL;
+			md->_priority = PATHPRIORITY_REPATH;
+			md->_queuedFrame = 0;
+			md->_heldForGroup = false;
 			
 #ifdef DEBUG_AI_PATHFINDING
 			std::cout << "Movement data init: " << pUnit << std::endl;
@@ -688,7 +1431,7 @@ namespace Game
 #endif
 		}
 
-		IPResult CommandPathfinding(const gc_ptr<Dimension::Unit>& pUnit, int start_x, int start_y, int goal_x, int goal_y, AI::UnitAction action, const gc_ptr<Dimension::Unit>& target, const Dimension::ActionArguments& args, float rotation)
+		IPResult CommandPathfinding(const gc_ptr<Dimension::Unit>& pUnit, int start_x, int start_y, int goal_x, int goal_y, AI::UnitAction action, const gc_ptr<Dimension::Unit>& target, const Dimension::ActionArguments& args, float rotation, PathPriority priority)
 		{
 			assert(pUnit);
 
@@ -747,9 +1490,7 @@ namespace Game
 			}
 
 #ifdef DEBUG_AI_PATHFINDING
-			SDL_LockMutex(gpmxQueue);
-			std::cout << "State: " << curState << " | Length: " << gCalcQueue.size() << std::endl;
-			SDL_UnlockMutex(gpmxQueue);
+			std::cout << "State: " << pUnit->pMovementData->_currentState << " | Length: " << GetQueueSize() << std::endl;
 #endif
 
 			IPResult res;
@@ -758,12 +1499,17 @@ namespace Game
 //			cout << "Command " << pUnit << " " << start_x << ", " << start_y << " " << goal_x << ", " << goal_y << " " << action <<  " " << target << " " << args << " " << currentFrame << endl;
 		
 			md->_newAction.Set(start_x, start_y, goal_x, goal_y, target, action, args, rotation);
+			md->_priority = priority;
+
+#ifdef USE_PATH_REPAIR
+			StoreRepairPath(pUnit, start_x, start_y, goal_x, goal_y, action);
+#endif
 
 			IntThrState curState = pUnit->pMovementData->_currentState;
 
 			if (curState == INTTHRSTATE_NONE)
 			{
-				if (md->_start != NULL)
+				if (md->_path != NULL)
 					DeallocPathfindingNodes(pUnit, DPN_BACK);
 
 				md->_action = md->_newAction;
@@ -780,9 +1526,7 @@ namespace Game
 
 				pUnit->pMovementData->_currentState = INTTHRSTATE_WAITING;
 				
-				SDL_LockMutex(gpmxQueue);
-				gCalcQueue.push(pUnit);
-				SDL_UnlockMutex(gpmxQueue);
+				EnqueuePathfinding(pUnit);
 				
 				res = IPR_SUCCESS;
 			}
@@ -809,7 +1553,7 @@ namespace Game
 				}
 				else
 				{
-					if (md->_start != NULL)
+					if (md->_path != NULL)
 						DeallocPathfindingNodes(pUnit, DPN_BACK);
 
 					md->_action = md->_newAction;
@@ -826,9 +1570,7 @@ namespace Game
 
 						pUnit->pMovementData->_currentState = INTTHRSTATE_WAITING;
 						
-						SDL_LockMutex(gpmxQueue);
-						gCalcQueue.push(pUnit);
-						SDL_UnlockMutex(gpmxQueue);
+						EnqueuePathfinding(pUnit);
 
 //						cout << "Lock " << pUnit->id << endl;
 					}
@@ -855,7 +1597,7 @@ namespace Game
 			if (!unit->pMovementData)
 				return PATHSTATE_DOES_NOT_EXIST;
 				
-			if (unit->pMovementData->_start == NULL)
+			if (unit->pMovementData->_path == NULL)
 				return PATHSTATE_DOES_NOT_EXIST;
 				
 			if (unit->pMovementData->calcState == CALCSTATE_REACHED_GOAL)
@@ -882,7 +1624,7 @@ namespace Game
 				
 			const gc_ptr<MovementData>& md = unit->pMovementData;
 			
-			if (md->pStart != NULL)
+			if (md->pPath != NULL)
 				DeallocPathfindingNodes(unit, DPN_FRONT);
 				
 //			cout << "Apply " << unit->id << endl;
@@ -935,13 +1677,11 @@ namespace Game
 				*(int*) 0 = 0;
 			}
 
-			md->pStart = md->_start;
-			md->pGoal  = md->_goal;
+			md->pPath = md->_path;
 
 //			md->action = md->_action;
 
-			md->_start = NULL;
-			md->_goal = NULL;
+			md->_path = NULL;
 			
 			md->_action.Reset();
 
@@ -971,9 +1711,7 @@ namespace Game
 
 				unit->pMovementData->_currentState = INTTHRSTATE_WAITING;
 				
-				SDL_LockMutex(gpmxQueue);
-				gCalcQueue.push(unit);
-				SDL_UnlockMutex(gpmxQueue);
+				EnqueuePathfinding(unit);
 
 			}
 			else
@@ -987,11 +1725,60 @@ namespace Game
 			SDL_UnlockMutex(gpmxCommand);
 		}
 
+		void HoldPathfinding(const gc_ptr<Dimension::Unit>& unit)
+		{
+			SDL_LockMutex(gpmxCommand);
+			unit->pMovementData->_heldForGroup = true;
+			SDL_UnlockMutex(gpmxCommand);
+		}
+
+		bool ReleasePathfinding(const gc_ptr<Dimension::Unit>& unit)
+		{
+			const gc_ptr<MovementData>& md = unit->pMovementData;
+			bool held;
+
+			SDL_LockMutex(gpmxCommand);
+
+			held = md->_heldForGroup;
+			md->_heldForGroup = false;
+
+			if (held)
+			{
+				SDL_LockMutex(gpmxThreadState);
+				if (md->_currentState == INTTHRSTATE_WAITING)
+				{
+					EnqueuePathfinding(unit);
+				}
+				SDL_UnlockMutex(gpmxThreadState);
+			}
+
+			SDL_UnlockMutex(gpmxCommand);
+
+			return held;
+		}
+
+		bool IsPathfindingHeld(const gc_ptr<Dimension::Unit>& unit)
+		{
+			return unit->pMovementData->_heldForGroup;
+		}
+
+		bool CompareUnitHandles(const gc_ptr<Dimension::Unit>& a, const gc_ptr<Dimension::Unit>& b)
+		{
+			return a->GetHandle() < b->GetHandle();
+		}
+
 		void ApplyAllNewPaths()
 		{
 			SDL_LockMutex(gpmxDone);
 
-			for (set<gc_ptr<Dimension::Unit> >::iterator it = doneUnits.begin(); it != doneUnits.end(); it++)
+			// Paths finish in whatever order the threads happen to complete them; apply them
+			// in handle order so that all clients in a networked game issue them the same way.
+			sort(doneUnits.begin(), doneUnits.end(), CompareUnitHandles);
+
+			// A unit may have finished more than once since the last call, but must only be applied once
+			doneUnits.erase(unique(doneUnits.begin(), doneUnits.end()), doneUnits.end());
+
+			for (vector<gc_ptr<Dimension::Unit> >::iterator it = doneUnits.begin(); it != doneUnits.end(); it++)
 			{
 				const gc_ptr<Dimension::Unit>& pUnit = *it;
 				if (!pUnit || pUnit->pMovementData->action.action == ACTION_DIE)
@@ -1004,25 +1791,43 @@ namespace Game
 				{
 					if (state == PATHSTATE_GOAL)
 					{
+#ifdef USE_GROUP_PATHFINDING
+						ReleaseGroupFollowers(pUnit, pUnit->pMovementData->_path);
+#endif
 						ApplyNewPath(pUnit);
 						ApplyUnappliedCommandIfAny(pUnit);
-						pUnit->pMovementData->pCurGoalNode = NULL;
+						if (pUnit->pMovementData->pPath)
+							pUnit->pMovementData->pPath->cursor = -1;
 					}
-					else if (state == PATHSTATE_ERROR)
+					else if (state == PATHSTATE_ERROR || pUnit->pMovementData->calcState == CALCSTATE_FAILURE)
 					{
+						// A failed calculation leaves no path behind, but the unit must still be
+						// released, or it would ignore all later commands. Only done here, as in
+						// a networked game the other clients would not know of it.
+#ifdef USE_GROUP_PATHFINDING
+						ReleaseGroupFollowers(pUnit, NULL);
+#endif
 						CancelAction(pUnit);
-						pUnit->pMovementData->pCurGoalNode = NULL;
+						ApplyUnappliedCommandIfAny(pUnit);
+						if (pUnit->pMovementData->pPath)
+							pUnit->pMovementData->pPath->cursor = -1;
 					}
 				}
 				else
 				{
 					if (state == PATHSTATE_GOAL)
 					{
-						Networking::PreparePath(pUnit, pUnit->pMovementData->_start, pUnit->pMovementData->_goal);
+#ifdef USE_GROUP_PATHFINDING
+						ReleaseGroupFollowers(pUnit, pUnit->pMovementData->_path);
+#endif
+						Networking::PreparePath(pUnit, pUnit->pMovementData->_path);
 						ApplyUnappliedCommandIfAny(pUnit);
 					}
 					else if (state == PATHSTATE_ERROR)
 					{
+#ifdef USE_GROUP_PATHFINDING
+						ReleaseGroupFollowers(pUnit, NULL);
+#endif
 						IssueNextAction(pUnit);
 					}
 				}
@@ -1032,6 +1837,10 @@ namespace Game
 
 			SDL_UnlockMutex(gpmxDone);
 
+#ifdef USE_GROUP_PATHFINDING
+			ReleaseStaleGroupFollowers();
+#endif
+
 		}
 		
 		bool QuitCurrentPath(const gc_ptr<Dimension::Unit>& unit)
@@ -1042,7 +1851,7 @@ namespace Game
 			if (!unit->pMovementData)
 				return false;
 				
-			if (unit->pMovementData->pStart == NULL)
+			if (unit->pMovementData->pPath == NULL)
 				return true;
 				
 			DeallocPathfindingNodes(unit, DPN_FRONT);
@@ -1120,13 +1929,12 @@ namespace Game
 			
 			const gc_ptr<MovementData>& data = tdata->pUnit->pMovementData;
 			
-			if (data->_start != NULL)
+			if (data->_path != NULL)
 			{
 				DeallocPathfindingNodes(tdata->pUnit, DPN_BACK);
 			}
 
-			data->_start = NULL;
-			data->_goal  = NULL;
+			data->_path = NULL;
 			
 			data->changedGoal = false;
 		}
@@ -1138,32 +1946,23 @@ namespace Game
 
 			const gc_ptr<MovementData>& md = unit->pMovementData;
 			
-			Node** goal = NULL;
-			Node** start = NULL;
+			Path** path = NULL;
 			
 			switch (target)
 			{
 				case DPN_FRONT:
-					goal = &md->pGoal;
-					start = &md->pStart;
-					md->pCurGoalNode = NULL;
+					path = &md->pPath;
 					break;
 				case DPN_BACK:
-					goal = &md->_goal;
-					start = &md->_start;
+					path = &md->_path;
 					break;
 				default:
 					assert(false && "Wrong DPN arguments!");
 					return;
 			}
 
-			if (*goal)
-			{
-				delete[] *goal; // The nodes in a path are allocated as an array
-			}
-
-			*start = NULL;
-			*goal  = NULL;	
+			FreePath(*path);
+			*path = NULL;
 		}
 		
 		inline bool IsWalkable(const gc_ptr<Dimension::Unit>& unit, int x, int y)
@@ -1171,27 +1970,47 @@ namespace Game
 			return Dimension::SquaresAreWalkable(unit, x, y, Dimension::SIW_IGNORE_MOVING);
 		}
 
+		//
+		// Invalidate all square types from earlier traces and floodfills
+		//
+		void ResetSquareTypes(ThreadData* tdata)
+		{
+			tdata->SQUARE_TYPE_OPEN += 3;
+			tdata->SQUARE_TYPE_CLOSED += 3;
+			tdata->SQUARE_TYPE_BLOCKED += 3;
+			if (tdata->SQUARE_TYPE_OPEN == 0 || tdata->SQUARE_TYPE_CLOSED == 0 || tdata->SQUARE_TYPE_BLOCKED == 0)
+			{
+				for (int i = 0; i < width * height; i++)
+				{
+					tdata->scratch[i].squareType = 0;
+				}
+				tdata->SQUARE_TYPE_OPEN = 1;
+				tdata->SQUARE_TYPE_CLOSED = 2;
+				tdata->SQUARE_TYPE_BLOCKED = 3;
+			}
+		}
+
 		inline int SameAreaAndWalkable(ThreadData* tdata, int start_x, int start_y, int cur_x, int cur_y)
 		{
 			if (cur_x > 0 && cur_y > 0 && cur_x < width && cur_y < height)
 			{
-				if (tdata->squareTypes[cur_y][cur_x] == tdata->SQUARE_TYPE_OPEN)
+				if (tdata->scratch[cur_y * width + cur_x].squareType == tdata->SQUARE_TYPE_OPEN)
 				{
 					return 1;
 				}
-				if (tdata->squareTypes[cur_y][cur_x] == tdata->SQUARE_TYPE_CLOSED)
+				if (tdata->scratch[cur_y * width + cur_x].squareType == tdata->SQUARE_TYPE_CLOSED)
 				{
 					return 0;
 				}
-				if (areaMaps[tdata->unitSize][tdata->areaMapIndex][cur_y][cur_x] == areaMaps[tdata->unitSize][tdata->areaMapIndex][start_y][start_x])
+				if (GetAreaCode(tdata->unitSize, tdata->areaMapIndex, cur_x, cur_y) == GetAreaCode(tdata->unitSize, tdata->areaMapIndex, start_x, start_y))
 				{
 					if (IsWalkable(tdata->pUnit, cur_x, cur_y))
 					{
-						tdata->squareTypes[cur_y][cur_x] = tdata->SQUARE_TYPE_OPEN;
+						tdata->scratch[cur_y * width + cur_x].squareType = tdata->SQUARE_TYPE_OPEN;
 						return 1;
 					}
 				}
-				tdata->squareTypes[cur_y][cur_x] = tdata->SQUARE_TYPE_CLOSED;
+				tdata->scratch[cur_y * width + cur_x].squareType = tdata->SQUARE_TYPE_CLOSED;
 			}
 			return 0;
 		}
@@ -1207,24 +2026,10 @@ namespace Game
 
 		bool InitTrace(ThreadData* tdata, int start_x, int start_y, int target_x, int target_y)
 		{
-			int y;
 			tdata->traceCurX = target_x;
 			tdata->traceCurY = target_y;
 
-			tdata->SQUARE_TYPE_OPEN += 3;
-			tdata->SQUARE_TYPE_CLOSED += 3;
-			tdata->SQUARE_TYPE_BLOCKED += 3;
-			if (tdata->SQUARE_TYPE_OPEN == 0 || tdata->SQUARE_TYPE_CLOSED == 0 || tdata->SQUARE_TYPE_BLOCKED == 0)
-			{
-				for (y = 0; y < height; y++)
-				{
-					memset(tdata->squareTypes[y], 0, width * sizeof(unsigned char));
-					memset(tdata->squareNums[y], 0, width * sizeof(int));
-				}
-				tdata->SQUARE_TYPE_OPEN = 1;
-				tdata->SQUARE_TYPE_CLOSED = 2;
-				tdata->SQUARE_TYPE_BLOCKED = 3;
-			}
+			ResetSquareTypes(tdata);
 
 			if (SameAreaAndWalkable(tdata, start_x, start_y, tdata->traceCurX, tdata->traceCurY))
 			{
@@ -1361,7 +2166,7 @@ namespace Game
 
 		PathState InitFloodfill(ThreadData* tdata, int start_x, int start_y, int flags)
 		{
-			int x, y;
+			int x;
 			int unitSize = tdata->unitSize, areaMapIndex = tdata->areaMapIndex;
 
 			tdata->calculateNearestReachable = flags & FLOODFILL_FLAG_CALCULATE_NEAREST;
@@ -1389,20 +2194,7 @@ namespace Game
 			tdata->highestDistance = 0;
 			tdata->circumTracking_Flood = 0;
 
-			tdata->SQUARE_TYPE_OPEN += 3;
-			tdata->SQUARE_TYPE_CLOSED += 3;
-			tdata->SQUARE_TYPE_BLOCKED += 3;
-			if (tdata->SQUARE_TYPE_OPEN == 0 || tdata->SQUARE_TYPE_CLOSED == 0 || tdata->SQUARE_TYPE_BLOCKED == 0)
-			{
-				for (y = 0; y < height; y++)
-				{
-					memset(tdata->squareTypes[y], 0, width * sizeof(unsigned char));
-					memset(tdata->squareNums[y], 0, width * sizeof(int));
-				}
-				tdata->SQUARE_TYPE_OPEN = 1;
-				tdata->SQUARE_TYPE_CLOSED = 2;
-				tdata->SQUARE_TYPE_BLOCKED = 3;
-			}
+			ResetSquareTypes(tdata);
 
 			if (tdata->calculateNearestReachable)
 			{
@@ -1419,11 +2211,10 @@ namespace Game
 
 				if (x >= 0)
 				{
-					tdata->squareTypes[start_y][x] = tdata->SQUARE_TYPE_BLOCKED;
+					tdata->scratch[start_y * width + x].squareType = tdata->SQUARE_TYPE_BLOCKED;
 				}
 
-				tdata->squareTypes[start_y][x+1] = tdata->SQUARE_TYPE_CLOSED;
-				tdata->squareNums[start_y][x+1] = 0;
+				tdata->scratch[start_y * width + x+1].squareType = tdata->SQUARE_TYPE_CLOSED;
 
 				for (x = start_x+1; ; x++)
 				{
@@ -1437,36 +2228,24 @@ namespace Game
 			{
 				tdata->scanlines[0].y = start_y;
 
-				for (x = start_x-1; ; x--)
-				{
-					if (!IsWalkable_MType(x, start_y, areaMapIndex, unitSize))
-					{
-						break;
-					}
-				}
+				x = RunStart_MType(start_x, start_y, areaMapIndex, unitSize) - 1;
 				tdata->scanlines[0].start_x = x+1;
 
 				if (x >= 0)
 				{
-					tdata->squareTypes[start_y][x] = tdata->SQUARE_TYPE_BLOCKED;
+					tdata->scratch[start_y * width + x].squareType = tdata->SQUARE_TYPE_BLOCKED;
 				}
 
-				tdata->squareTypes[start_y][x+1] = tdata->SQUARE_TYPE_CLOSED;
-				tdata->squareNums[start_y][x+1] = 0;
+				tdata->scratch[start_y * width + x+1].squareType = tdata->SQUARE_TYPE_CLOSED;
 
-				for (x = start_x+1; ; x++)
-				{
-					if (!IsWalkable_MType(x, start_y, areaMapIndex, unitSize))
-					{
-						break;
-					}
-				}
+				x = RunEnd_MType(start_x, start_y, areaMapIndex, unitSize) + 1;
 			}
 			tdata->scanlines[0].end_x = x-1;
+			tdata->scratch[start_y * width + tdata->scanlines[0].start_x].squareEnd = x-1;
 				
 			if (x < width)
 			{
-				tdata->squareTypes[start_y][x] = tdata->SQUARE_TYPE_BLOCKED;
+				tdata->scratch[start_y * width + x].squareType = tdata->SQUARE_TYPE_BLOCKED;
 			}
 
 			tdata->numScanlines = 1;
@@ -1485,8 +2264,7 @@ namespace Game
 			int new_y;
 			int new_start_x, new_end_x;
 			int new_x;
-			unsigned char *scanline_types;
-			int *scanline_nums;
+			scratchcell *scanline;
 			int loop_start_y, loop_end_y;
 			int loop_start_x, loop_end_x;
 			int x, y;
@@ -1495,8 +2273,8 @@ namespace Game
 			int *scanlineQueue = tdata->scanlineQueue;
 			bool setAreaCodes = tdata->setAreaCodes;
 			bool calculateNearestReachable = tdata->calculateNearestReachable;
-			unsigned char SQUARE_TYPE_CLOSED = tdata->SQUARE_TYPE_CLOSED,
-			              SQUARE_TYPE_BLOCKED = tdata->SQUARE_TYPE_BLOCKED;
+			Uint16 SQUARE_TYPE_CLOSED = tdata->SQUARE_TYPE_CLOSED,
+			       SQUARE_TYPE_BLOCKED = tdata->SQUARE_TYPE_BLOCKED;
 			const gc_ptr<Dimension::Unit>& unit = tdata->pUnit;
 			const gc_ptr<MovementData>& md = unit->pMovementData;
 			Uint16 areaCode = tdata->areaCode; 
@@ -1509,10 +2287,12 @@ namespace Game
 					// Target not found...
 					if (calculateNearestReachable)
 					{
-						notReachedFlood++;
+						tdata->notReachedFlood++;
 						if (changedSinceLastRegen[unitSize][areaMapIndex])
 						{
+							SDL_LockMutex(gpmxAreaMap);
 							numNotReached[unitSize][areaMapIndex]++;
+							SDL_UnlockMutex(gpmxAreaMap);
 						}
 					}
 					return PATHSTATE_GOAL;
@@ -1591,7 +2371,7 @@ namespace Game
 						if (new_distance > tdata->lowestDistance)
 						{
 //							cout << "Great success 2!" << endl;
-							numGreatSuccess2++;
+							tdata->numGreatSuccess2++;
 							continue;
 						}
 					}
@@ -1612,34 +2392,37 @@ namespace Game
 
 				for (new_y = loop_start_y; new_y <= loop_end_y; new_y+=2)
 				{
-					scanline_types = tdata->squareTypes[new_y];
-					scanline_nums = tdata->squareNums[new_y];
+					scanline = tdata->scratch + new_y * width;
 					for (x = loop_start_x; x <= loop_end_x; x++)
 					{
-						if (scanline_types[x] == SQUARE_TYPE_CLOSED)
+						if (setAreaCodes)
+						{
+							// Skip the blocked squares
+							x = NextWalkable_MType(x, loop_end_x, new_y, areaMapIndex, unitSize);
+							if (x > loop_end_x)
+							{
+								break;
+							}
+						}
+
+						if (scanline[x].squareType == SQUARE_TYPE_CLOSED)
 						{
-							x = scanlines[scanline_nums[x]].end_x+1;
+							x = scanline[x].squareEnd+1;
 						}
-						else if (scanline_types[x] != SQUARE_TYPE_BLOCKED)
+						else if (scanline[x].squareType != SQUARE_TYPE_BLOCKED)
 						{
-							if ((calculateNearestReachable && IsWalkable(unit, x, new_y)) || (setAreaCodes && IsWalkable_MType(x, new_y, areaMapIndex, unitSize)))
+							if (setAreaCodes || (calculateNearestReachable && IsWalkable(unit, x, new_y)))
 							{
 								int new_scanline;
 								if (setAreaCodes)
 								{
-									for (new_x = x-1; ; new_x--)
-									{
-										if (scanline_types[x] == SQUARE_TYPE_BLOCKED || !IsWalkable_MType(new_x, new_y, areaMapIndex, unitSize))
-										{
-											break;
-										}
-									}
+									new_x = RunStart_MType(x, new_y, areaMapIndex, unitSize) - 1;
 								}
 								else
 								{
 									for (new_x = x-1; ; new_x--)
 									{
-										if (scanline_types[x] == SQUARE_TYPE_BLOCKED || !IsWalkable(unit, new_x, new_y))
+										if (scanline[x].squareType == SQUARE_TYPE_BLOCKED || !IsWalkable(unit, new_x, new_y))
 										{
 											break;
 										}
@@ -1649,26 +2432,20 @@ namespace Game
 							
 								if (new_x >= 0)
 								{
-									scanline_types[new_x] = SQUARE_TYPE_BLOCKED;
+									scanline[new_x].squareType = SQUARE_TYPE_BLOCKED;
 								}
 
-								if (scanline_types[new_start_x] != SQUARE_TYPE_CLOSED)
+								if (scanline[new_start_x].squareType != SQUARE_TYPE_CLOSED)
 								{
 									if (setAreaCodes)
 									{
-										for (new_x = x+1; ; new_x++)
-										{
-											if (scanline_types[x] == SQUARE_TYPE_BLOCKED || !IsWalkable_MType(new_x, new_y, areaMapIndex, unitSize))
-											{
-												break;
-											}
-										}
+										new_x = RunEnd_MType(x, new_y, areaMapIndex, unitSize) + 1;
 									}
 									else
 									{
 										for (new_x = x+1; ; new_x++)
 										{
-											if (scanline_types[x] == SQUARE_TYPE_BLOCKED || !IsWalkable(unit, new_x, new_y))
+											if (scanline[x].squareType == SQUARE_TYPE_BLOCKED || !IsWalkable(unit, new_x, new_y))
 											{
 												break;
 											}
@@ -1678,7 +2455,7 @@ namespace Game
 								
 									if (new_x < width)
 									{
-										scanline_types[new_x] = SQUARE_TYPE_BLOCKED;
+										scanline[new_x].squareType = SQUARE_TYPE_BLOCKED;
 									}
 
 									new_scanline = tdata->nextFreeScanline++;
@@ -1712,7 +2489,7 @@ namespace Game
 
 									scanlineQueue[tdata->lastScanlineIndex] = new_scanline;
 					
-									if (scanline_types[new_start_x] == SQUARE_TYPE_CLOSED)
+									if (scanline[new_start_x].squareType == SQUARE_TYPE_CLOSED)
 									{
 										printf("FATAL - traversed same scanline twice!\n");
 										md->_action.changedGoalPos.x = target_x;
@@ -1720,18 +2497,18 @@ namespace Game
 										return PATHSTATE_GOAL;
 									}
 					
-									scanline_types[new_start_x] = SQUARE_TYPE_CLOSED;
-									scanline_nums[new_start_x] = new_scanline;
+									scanline[new_start_x].squareType = SQUARE_TYPE_CLOSED;
+									scanline[new_start_x].squareEnd = new_end_x;
 									
 									if (new_start_x > start_x)
 									{
-										tdata->squareTypes[y][new_start_x-1] = SQUARE_TYPE_CLOSED;
-										tdata->squareNums[y][new_start_x-1] = first_square;
+										tdata->scratch[y * width + new_start_x-1].squareType = SQUARE_TYPE_CLOSED;
+										tdata->scratch[y * width + new_start_x-1].squareEnd = end_x;
 									}
 								}
 								else
 								{
-									new_x = scanlines[scanline_nums[new_start_x]].end_x+1;
+									new_x = scanline[new_start_x].squareEnd+1;
 									if (new_x <= x)
 									{
 										// what would have become an infinite loop has been detected,
@@ -1748,7 +2525,7 @@ namespace Game
 							}
 							else
 							{
-								scanline_types[x] = SQUARE_TYPE_BLOCKED;
+								scanline[x].squareType = SQUARE_TYPE_BLOCKED;
 							}
 						}
 					}
@@ -1758,38 +2535,149 @@ namespace Game
 			return PATHSTATE_OK;
 		}
 
-		int CalcH(int new_x, int new_y, int target_x, int target_y, int unitSize)
+		//
+		// The heuristic table holds, for each pair of target and node cells, how much
+		// longer paths tend to be than the heuristic guesses, in units of 1/256.
+		// Only the pages of targets that paths have actually been calculated to are
+		// allocated; other targets get the default of 0x100.
+		//
+		// Pages are written without locking, as a lost update of a running average
+		// does no harm. Only their allocation is locked.
+		//
+		inline int GetHConstPageIndex(int unitSize, int target_x, int target_y)
 		{
-			int h_diagonal = min(abs(new_x-target_x), abs(new_y-target_y));
-			int h_straight = (abs(new_x-target_x) + abs(new_y-target_y));
-			Uint16 hConst = hConsts[unitSize][target_y>>yShift][target_x>>xShift][new_y>>yShift][new_x>>xShift];
-			return ((30 * h_diagonal + 20 * (h_straight - 2*h_diagonal)) * hConst) >> 8;
-/*			int diff_x = fabs(new_x - target_x);
-			int diff_y = fabs(new_y - target_y);
-			return (diff_x + diff_y) * 20;*/
+			return (unitSize * hConstHeight + (target_y>>yShift)) * hConstWidth + (target_x>>xShift);
 		}
 
-		int num_steps = 0;
+		inline Uint16 GetHConst(int unitSize, int target_x, int target_y, int node_x, int node_y)
+		{
+			volatile Uint16* page = hConstPages[GetHConstPageIndex(unitSize, target_x, target_y)];
+			if (!page)
+			{
+				return 0x100;
+			}
+			return page[(node_y>>yShift) * hConstWidth + (node_x>>xShift)];
+		}
 
-		PathState InitPathfinding(ThreadData*& tdata)
+		volatile Uint16* AllocHConstPage(int unitSize, int target_x, int target_y)
 		{
-			const gc_ptr<Dimension::Unit>& unit  = tdata->pUnit;
-			const gc_ptr<MovementData>& md       = unit->pMovementData;
+			int index = GetHConstPageIndex(unitSize, target_x, target_y);
+			SDL_mutex* mutex = gpmxHConstShards[index % HCONST_SHARDS];
 
-			int start_x = md->_action.startPos.x, start_y = md->_action.startPos.y;
-			int target_x = md->_action.changedGoalPos.x, target_y = md->_action.changedGoalPos.y;
+			SDL_LockMutex(mutex);
+			if (!hConstPages[index])
+			{
+				volatile Uint16* page = new volatile Uint16[hConstHeight * hConstWidth];
+				for (int i = 0; i < hConstHeight * hConstWidth; i++)
+				{
+					page[i] = 0x100;
+				}
+				hConstPages[index] = page;
+				numHConstPages[index % HCONST_SHARDS]++;
+			}
+			SDL_UnlockMutex(mutex);
 
-			int y;
+			return hConstPages[index];
+		}
+
+		int GetNumHConstPages()
+		{
+			int num = 0;
+			for (int i = 0; i < HCONST_SHARDS; i++)
+			{
+				num += numHConstPages[i];
+			}
+			return num;
+		}
+
+		size_t GetHConstMemoryUsage()
+		{
+			return 4 * hConstHeight * hConstWidth * sizeof(Uint16*) + GetNumHConstPages() * hConstHeight * hConstWidth * sizeof(Uint16);
+		}
+
+		int CalcH(int new_x, int new_y, int target_x, int target_y, int unitSize)
+		{
+			int h_diagonal = min(abs(new_x-target_x), abs(new_y-target_y));
+			int h_straight = (abs(new_x-target_x) + abs(new_y-target_y));
+			Uint16 hConst = GetHConst(unitSize, target_x, target_y, new_x, new_y);
+			return ((30 * h_diagonal + 20 * (h_straight - 2*h_diagonal)) * hConst) >> 8;
+/*			int diff_x = fabs(new_x - target_x);
+			int diff_y = fabs(new_y - target_y);
+			return (diff_x + diff_y) * 20;*/
+		}
+
+		int num_steps = 0;
+
+		inline bool IsIntermediateSegment(ThreadData* tdata)
+		{
+			return tdata->curWaypoint + 1 < tdata->waypoints.size();
+		}
+
+		//
+		// The square A* is currently heading for; either the next waypoint, the square
+		// to rejoin a path being repaired at, or the goal
+		//
+		inline Dimension::IntPosition GetSegmentTarget(ThreadData* tdata)
+		{
+			if (IsIntermediateSegment(tdata))
+			{
+				return tdata->waypoints[tdata->curWaypoint];
+			}
+			if (tdata->pathSuffix.size())
+			{
+				return tdata->pathSuffix[0];
+			}
+			return tdata->pUnit->pMovementData->_action.changedGoalPos;
+		}
+
+		//
+		// Waypoints occupied by a unit standing still can never be reached exactly;
+		// head straight for the one after instead.
+		//
+		void SkipBlockedWaypoints(ThreadData* tdata)
+		{
+			while (IsIntermediateSegment(tdata) && !IsWalkable(tdata->pUnit, tdata->waypoints[tdata->curWaypoint].x, tdata->waypoints[tdata->curWaypoint].y))
+			{
+				tdata->curWaypoint++;
+			}
+		}
+
+		//
+		// Invalidate all node types from earlier searches
+		//
+		void ResetNodeTypes(ThreadData* tdata)
+		{
+			tdata->NODE_TYPE_OPEN += 2;
+			tdata->NODE_TYPE_CLOSED += 2;
+			if (tdata->NODE_TYPE_OPEN == 0 || tdata->NODE_TYPE_CLOSED == 0)
+			{
+				for (int i = 0; i < width * height; i++)
+				{
+					tdata->scratch[i].nodeType = 0;
+					tdata->scratch[i].nodeNum = 0;
+				}
+				tdata->NODE_TYPE_OPEN = 1;
+				tdata->NODE_TYPE_CLOSED = 2;
+			}
+		}
+
+		PathState InitPathfinding(ThreadData*& tdata)
+		{
+			const gc_ptr<Dimension::Unit>& unit  = tdata->pUnit;
+
+			Dimension::IntPosition target = GetSegmentTarget(tdata);
+			int start_x = tdata->segmentStart.x, start_y = tdata->segmentStart.y;
+			int target_x = target.x, target_y = target.y;
 
 			if (tdata->hasBegunPathfinding)
 			{
-				if (tdata->oldGoal.x == md->_action.changedGoalPos.x && tdata->oldGoal.y == md->_action.changedGoalPos.y)
+				if (tdata->oldGoal.x == target.x && tdata->oldGoal.y == target.y)
 				{
 					return PATHSTATE_OK;
 				}
 			}
 
-			tdata->oldGoal = md->_action.changedGoalPos;
+			tdata->oldGoal = target;
 
 			tdata->hasBegunPathfinding = true;
 
@@ -1804,18 +2692,7 @@ namespace Game
 				return PATHSTATE_ERROR;
 			}
 
-			tdata->NODE_TYPE_OPEN += 2;
-			tdata->NODE_TYPE_CLOSED += 2;
-			if (tdata->NODE_TYPE_OPEN == 0 || tdata->NODE_TYPE_CLOSED == 0)
-			{
-				for (y = 0; y < height; y++)
-				{
-					memset(tdata->nodeTypes[y], 0, width * sizeof(unsigned char));
-					memset(tdata->nodeNums[y], 0, width * sizeof(int));
-				}
-				tdata->NODE_TYPE_OPEN = 1;
-				tdata->NODE_TYPE_CLOSED = 2;
-			}
+			ResetNodeTypes(tdata);
 
 			tdata->nodes[0].x = start_x;
 			tdata->nodes[0].y = start_y;
@@ -1823,45 +2700,48 @@ namespace Game
 			tdata->nodes[0].h = CalcH(start_x, start_y, target_x, target_y, tdata->unitSize);
 			tdata->nodes[0].f = 0;
 			tdata->nodes[0].parent = -1;
-			tdata->nodeNums[start_y][start_x] = 0;
-			tdata->nodeTypes[start_y][start_x] = tdata->NODE_TYPE_OPEN;
+			tdata->scratch[start_y * width + start_x].nodeNum = 0;
+			tdata->scratch[start_y * width + start_x].nodeType = tdata->NODE_TYPE_OPEN;
 			tdata->nextFreeNode = 1;
-			binary_heap_pop_all(tdata->heap); // To be sure the heap is empty...
-			binary_heap_push_item(tdata->heap, 0, 0);
+			quad_heap_pop_all(tdata->heap); // To be sure the heap is empty...
+			quad_heap_push_item(tdata->heap, 0, 0);
 			return PATHSTATE_OK;
 		}
 
-		int calcCount = 0;
-		int fsteps = 0, psteps = 0;
-		int tsteps = 0;
-
 		PathState PathfindingStep(ThreadData*& tdata)
 		{
 			const gc_ptr<Dimension::Unit>& unit  = tdata->pUnit;
 			const gc_ptr<MovementData>& md       = unit->pMovementData;
-			int target_x = md->_action.changedGoalPos.x, target_y = md->_action.changedGoalPos.y;
+			Dimension::IntPosition target = GetSegmentTarget(tdata);
+			int target_x = target.x, target_y = target.y;
 			int unitSize = tdata->unitSize, areaMapIndex = tdata->areaMapIndex;
 			struct node *nodes = tdata->nodes;
-			unsigned char NODE_TYPE_OPEN = tdata->NODE_TYPE_OPEN,
-			              NODE_TYPE_CLOSED = tdata->NODE_TYPE_CLOSED;
+			Uint16 NODE_TYPE_OPEN = tdata->NODE_TYPE_OPEN,
+			       NODE_TYPE_CLOSED = tdata->NODE_TYPE_CLOSED;
 			
 			int x, y;
 			
 			int first_node;
 			int node_x, node_y;
-			unsigned char *scanline_types;
-			int *scanline_nums;
-			first_node = binary_heap_pop_item(tdata->heap, -1);
+			scratchcell *scanline;
+			first_node = quad_heap_pop_item(tdata->heap, -1);
 
 			num_steps++;
 
 			if (first_node == -1 /* || (circumTracking == 15 && nodes[first_node].h > highestH) */)
 			{
 	/*			printf("Did not reach target\n"); */
-				notReachedPath += psteps;
+				tdata->notReachedPath += tdata->psteps;
 				if (changedSinceLastRegen[unitSize][areaMapIndex])
 				{
+					SDL_LockMutex(gpmxAreaMap);
 					numNotReached[unitSize][areaMapIndex]++;
+					SDL_UnlockMutex(gpmxAreaMap);
+				}
+				if (IsIntermediateSegment(tdata) || tdata->pathSuffix.size())
+				{
+					// Let AdvanceSegment() or AdvanceRepair() fall back to an ordinary search
+					return PATHSTATE_ERROR;
 				}
 				if (tdata->nearestNode != -1)
 				{
@@ -1888,7 +2768,7 @@ namespace Game
 
 			node_x = nodes[first_node].x;
 			node_y = nodes[first_node].y;
-			tdata->nodeTypes[node_y][node_x] = NODE_TYPE_CLOSED;
+			tdata->scratch[node_y * width + node_x].nodeType = NODE_TYPE_CLOSED;
 
 			if (node_x == target_x)
 			{
@@ -1917,7 +2797,7 @@ namespace Game
 			if ((node_x == target_x && node_y == target_y) || SquareIsGoal(unit, node_x, node_y, true))
 			{
 	/*			printf("Reached target\n"); */
-				binary_heap_pop_all(tdata->heap);
+				quad_heap_pop_all(tdata->heap);
 				return PATHSTATE_GOAL;
 			}
 
@@ -1926,14 +2806,13 @@ namespace Game
 				int new_y = node_y+y;
 				if (new_y >= 0 && new_y < height)
 				{
-					scanline_types = tdata->nodeTypes[new_y];
-					scanline_nums = tdata->nodeNums[new_y];
+					scanline = tdata->scratch + new_y * width;
 					for (x = -1; x <= 1; x++)
 					{
 						int new_x = node_x+x;
 						if ((y || x) && new_x >= 0 && new_x < width)
 						{
-							int node_type = scanline_types[new_x];
+							Uint16 node_type = scanline[new_x].nodeType;
 							if (node_type != NODE_TYPE_CLOSED)
 							{
 								int node_num;
@@ -1941,7 +2820,7 @@ namespace Game
 								{
 									int new_g = nodes[first_node].g;
 
-									node_num = scanline_nums[new_x];
+									node_num = scanline[new_x].nodeNum;
 									if (new_g < nodes[node_num].g)
 									{
 										continue;
@@ -1954,7 +2833,7 @@ namespace Game
 										nodes[node_num].g = new_g;
 										nodes[node_num].f = nodes[node_num].h + new_g;
 										nodes[node_num].parent = first_node;
-										binary_heap_lower_item_score(tdata->heap, node_num, nodes[node_num].f);
+										quad_heap_lower_item_score(tdata->heap, node_num, nodes[node_num].f);
 									}
 									else
 									{
@@ -1968,7 +2847,7 @@ namespace Game
 										int new_g = nodes[first_node].g;
 										new_g += Dimension::GetTraversalTimeAdjusted(unit, node_x, node_y, x, y);
 
-										node_num = scanline_nums[new_x] = tdata->nextFreeNode++;
+										node_num = scanline[new_x].nodeNum = tdata->nextFreeNode++;
 										nodes[node_num].h = CalcH(new_x, new_y, target_x, target_y, tdata->unitSize);
 										if (tdata->circumTracking != 15 || nodes[node_num].h <= tdata->lowestH)
 										{
@@ -1977,19 +2856,19 @@ namespace Game
 											nodes[node_num].g = new_g;
 											nodes[node_num].f = nodes[node_num].h + new_g;
 											nodes[node_num].parent = first_node;
-											scanline_types[new_x] = NODE_TYPE_OPEN;
-											binary_heap_push_item(tdata->heap, node_num, (nodes[node_num].f<<16)+nodes[node_num].h);
+											scanline[new_x].nodeType = NODE_TYPE_OPEN;
+											quad_heap_push_item(tdata->heap, node_num, (nodes[node_num].f<<16)+nodes[node_num].h);
 										}
 										else
 										{
-											numGreatSuccess1++;
+											tdata->numGreatSuccess1++;
 //											cout << "Great success!" << endl;
 											tdata->nextFreeNode--;
 										}
 									}
 									else
 									{
-										scanline_types[new_x] = NODE_TYPE_CLOSED;
+										scanline[new_x].nodeType = NODE_TYPE_CLOSED;
 									}
 								}
 							}
@@ -2000,14 +2879,102 @@ namespace Game
 			return PATHSTATE_OK;
 		}
 
+#ifdef USE_PATH_SMOOTHING
+		//
+		// Check whether the unit can walk along the straight line from the given
+		// square to the one dx and dy squares away, and how long it would take.
+		//
+		bool LineIsWalkable(const gc_ptr<Dimension::Unit>& unit, const Node& from, int dx, int dy, int& time)
+		{
+			int length = LineLength(dx, dy);
+			Node prev = from;
+
+			time = 0;
+			for (int step = 1; step <= length; step++)
+			{
+				Node cur = LineSquare(from, dx, dy, step);
+				if (!IsWalkable(unit, cur.x, cur.y))
+				{
+					return false;
+				}
+				time += Dimension::GetTraversalTimeAdjusted(unit, prev.x, prev.y, cur.x - prev.x, cur.y - prev.y);
+				prev = cur;
+			}
+			return true;
+		}
+
+		//
+		// Replace the parts of the path that zigzag over open ground with straight
+		// lines, where that is no slower. From each square, lines to squares 2, 4, 8
+		// and up to PATHSMOOTH_MAX_SEGMENT squares further along the path are tried,
+		// keeping the longest one that can be walked before the first that cannot.
+		// A line never has more squares than the part of the path it replaces, so
+		// the path is rewritten in place.
+		//
+		void SmoothPath(ThreadData* tdata, Path* path)
+		{
+			const gc_ptr<Dimension::Unit>& unit = tdata->pUnit;
+			std::vector<int>& times = tdata->smoothTimes;
+			Node* nodes = path->nodes;
+			int num_nodes = path->numNodes;
+			int new_num_nodes = 1;
+			int i = 0;
+
+			if (num_nodes < 3)
+			{
+				return;
+			}
+
+			times.resize(num_nodes);
+			times[0] = 0;
+			for (int k = 1; k < num_nodes; k++)
+			{
+				times[k] = times[k-1] + Dimension::GetTraversalTimeAdjusted(unit, nodes[k-1].x, nodes[k-1].y, nodes[k].x - nodes[k-1].x, nodes[k].y - nodes[k-1].y);
+			}
+
+			while (i < num_nodes - 1)
+			{
+				// Only squares up to i have been overwritten, and square i with itself
+				Node from = nodes[i];
+				int best = i + 1;
+
+				for (int step = 2; best < num_nodes - 1; step = min(step * 2, PATHSMOOTH_MAX_SEGMENT))
+				{
+					int j = min(i + step, num_nodes - 1);
+					int time;
+					if (j <= best)
+					{
+						break;
+					}
+					if (!LineIsWalkable(unit, from, nodes[j].x - from.x, nodes[j].y - from.y, time) || time > times[j] - times[i])
+					{
+						break;
+					}
+					best = j;
+				}
+
+				int dx = nodes[best].x - from.x, dy = nodes[best].y - from.y;
+				int length = LineLength(dx, dy);
+				for (int step = 1; step <= length; step++)
+				{
+					nodes[new_num_nodes++] = LineSquare(from, dx, dy, step);
+				}
+				i = best;
+			}
+
+			path->numNodes = new_num_nodes;
+		}
+#endif
+
 		void BuildNodeLinkedList(ThreadData*& tdata)
 		{
 			const gc_ptr<Dimension::Unit>& unit  = tdata->pUnit;
 			const gc_ptr<MovementData>& md       = unit->pMovementData;
-			int hConstXTarget = tdata->nodes[tdata->nearestNode].x>>xShift;
-			int hConstYTarget = tdata->nodes[tdata->nearestNode].y>>yShift;
-			Node *prev_node = NULL, *first_node = NULL, *new_node = NULL;
-			int num_nodes = 0, i;
+			int target_x = tdata->nodes[tdata->nearestNode].x;
+			int target_y = tdata->nodes[tdata->nearestNode].y;
+			volatile Uint16* hConstPage = hConstPages[GetHConstPageIndex(tdata->unitSize, target_x, target_y)];
+			Path* path;
+			int num_nodes = tdata->pathPrefix.size(), i;
 			int cur_node = tdata->nearestNode;
 
 			while (cur_node != -1)
@@ -2016,64 +2983,639 @@ namespace Game
 				cur_node = tdata->nodes[cur_node].parent;
 			}
 
-			Node *new_nodes = new Node[num_nodes];
+			if (tdata->pathSuffix.size())
+			{
+				// The first square of the suffix is where the search ended
+				num_nodes += tdata->pathSuffix.size() - 1;
+			}
+
+			path = AllocPath(num_nodes);
 
-			i = 0;
+			// The path is filled in backwards, from the goal to the start
+			i = num_nodes;
+
+			// The part of an old path kept when repairing it
+			for (int j = (int) tdata->pathSuffix.size() - 1; j > 0; j--)
+			{
+				i--;
+				path->nodes[i].x = tdata->pathSuffix[j].x;
+				path->nodes[i].y = tdata->pathSuffix[j].y;
+			}
+			tdata->pathSuffix.clear();
 
 			cur_node = tdata->nearestNode;
 			
-			SDL_LockMutex(gpmxHConst);
 			while (cur_node != -1)
 			{
-				int hConstXNode = tdata->nodes[cur_node].x>>xShift;
-				int hConstYNode = tdata->nodes[cur_node].y>>yShift;
-				Uint16 old_hconst = hConsts[tdata->unitSize][hConstYTarget][hConstXTarget][hConstYNode][hConstXNode];
+				int hConstIndex = (tdata->nodes[cur_node].y>>yShift) * hConstWidth + (tdata->nodes[cur_node].x>>xShift);
+				Uint16 old_hconst = hConstPage ? hConstPage[hConstIndex] : 0x100;
 				Uint16 new_hconst = 0;
 				Uint16 mixed_hconst;
 				if (tdata->nodes[cur_node].h && tdata->nodes[tdata->nearestNode].g - tdata->nodes[cur_node].g)
 				{
+					if (!hConstPage)
+					{
+						hConstPage = AllocHConstPage(tdata->unitSize, target_x, target_y);
+					}
 					new_hconst = Uint16(((tdata->nodes[tdata->nearestNode].g - tdata->nodes[cur_node].g) << 8) / tdata->nodes[cur_node].h);
 					mixed_hconst = Uint16(((int)old_hconst * 15 + (int) new_hconst)>>4);
 					if (old_hconst == mixed_hconst && new_hconst != mixed_hconst)
 					{
 						mixed_hconst += new_hconst < old_hconst ? (Uint16) -1 : (Uint16) 1;
 					}
-					hConsts[tdata->unitSize][hConstYTarget][hConstXTarget][hConstYNode][hConstXNode] = mixed_hconst;
+					hConstPage[hConstIndex] = mixed_hconst;
+				}
+
+				i--;
+				path->nodes[i].x = tdata->nodes[cur_node].x;
+				path->nodes[i].y = tdata->nodes[cur_node].y;
+				cur_node = tdata->nodes[cur_node].parent;
+			}
+
+			// Segments calculated before the last waypoint
+			for (int j = (int) tdata->pathPrefix.size() - 1; j >= 0; j--)
+			{
+				i--;
+				path->nodes[i].x = tdata->pathPrefix[j].x;
+				path->nodes[i].y = tdata->pathPrefix[j].y;
+			}
+			tdata->pathPrefix.clear();
+			tdata->waypoints.clear();
+
+#ifdef USE_PATH_SMOOTHING
+			SmoothPath(tdata, path);
+#endif
+
+			md->_path = path;
+			tdata->nearestNode = -1;
+		}
+		
+		//
+		// Search the full map for the goal, without the help of the hierarchy.
+		//
+		void FallBackToFullSearch(ThreadData* tdata)
+		{
+			tdata->waypoints.clear();
+			tdata->pathPrefix.clear();
+			tdata->pathSuffix.clear();
+			tdata->curWaypoint = 0;
+			tdata->segmentStart = tdata->pUnit->pMovementData->_action.startPos;
+			tdata->segmentCalcStart = tdata->calcCount;
+			tdata->preprocessState = PREPROCESSSTATE_SKIPPED_TRACE;
+			tdata->hasBegunPathfinding = false;
+			InitPathfinding(tdata);
+		}
+
+		//
+		// Called after each A* step while following waypoints. Moves on to the next
+		// segment when a waypoint is reached, and falls back to an ordinary search if
+		// a segment turned out to be impossible.
+		//
+		PathState AdvanceSegment(ThreadData* tdata, PathState state)
+		{
+			if (!IsIntermediateSegment(tdata))
+			{
+				return state;
+			}
+
+			if (state == PATHSTATE_ERROR)
+			{
+				FallBackToFullSearch(tdata);
+				return PATHSTATE_OK;
+			}
+
+			if (state != PATHSTATE_GOAL)
+			{
+				return state;
+			}
+
+			const node& reached = tdata->nodes[tdata->nearestNode];
+			Dimension::IntPosition waypoint = tdata->waypoints[tdata->curWaypoint];
+
+			if (reached.x != waypoint.x || reached.y != waypoint.y)
+			{
+				// The goal was considered reached before the waypoint, so the path is complete
+				tdata->waypoints.clear();
+				return PATHSTATE_GOAL;
+			}
+
+			// Store everything but the waypoint itself, as that is where the next segment starts
+			vector<Dimension::IntPosition> segment;
+			for (int cur_node = reached.parent; cur_node != -1; cur_node = tdata->nodes[cur_node].parent)
+			{
+				segment.push_back(Dimension::IntPosition(tdata->nodes[cur_node].x, tdata->nodes[cur_node].y));
+			}
+			tdata->pathPrefix.insert(tdata->pathPrefix.end(), segment.rbegin(), segment.rend());
+
+			tdata->segmentStart = waypoint;
+			tdata->segmentCalcStart = tdata->calcCount;
+			tdata->curWaypoint++;
+			SkipBlockedWaypoints(tdata);
+
+			tdata->hasBegunPathfinding = false;
+			InitPathfinding(tdata);
+
+			return PATHSTATE_OK;
+		}
+
+#ifdef USE_PATH_REPAIR
+		//
+		// Replan only the blocked part of a path the unit already had to the same
+		// goal, by searching from the start to a square on the old path beyond the
+		// blocked squares. The rest of the old path is then kept as it is.
+		//
+		bool UsePathRepair(ThreadData* tdata)
+		{
+			const gc_ptr<MovementData>& md = tdata->pUnit->pMovementData;
+			vector<Dimension::IntPosition> path;
+			unsigned rejoin = 1;
+			bool shared = false;
+
+			if (!TakeRepairPath(tdata->pUnit, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y, path, shared))
+			{
+				return false;
+			}
+
+			if (shared)
+			{
+				// Join the path of the group where it passes closest to the unit
+				const Dimension::IntPosition& start = md->_action.startPos;
+				int best_dist = INT_MAX;
+				rejoin = 0;
+				for (unsigned i = 0; i < path.size(); i++)
+				{
+					int dist = max(abs(path[i].x - start.x), abs(path[i].y - start.y));
+					if (dist <= best_dist)
+					{
+						best_dist = dist;
+						rejoin = i;
+					}
+				}
+			}
+			else
+			{
+				// Skip past the squares that have become blocked, if any
+				while (rejoin < path.size() && IsWalkable(tdata->pUnit, path[rejoin].x, path[rejoin].y))
+				{
+					rejoin++;
+				}
+				while (rejoin < path.size() && !IsWalkable(tdata->pUnit, path[rejoin].x, path[rejoin].y))
+				{
+					rejoin++;
+				}
+				if (rejoin == path.size())
+				{
+					// Blocked all the way to the goal, or not blocked at all
+					return false;
+				}
+			}
+
+			// Leave some room for going around the obstacle
+			rejoin += REPAIR_REJOIN_DISTANCE;
+			if (rejoin >= path.size())
+			{
+				rejoin = path.size() - 1;
+			}
+
+			while (rejoin < path.size() && !IsWalkable(tdata->pUnit, path[rejoin].x, path[rejoin].y))
+			{
+				rejoin++;
+			}
+			if (rejoin == path.size())
+			{
+				return false;
+			}
+
+			tdata->pathSuffix.assign(path.begin() + rejoin, path.end());
+			tdata->segmentCalcStart = tdata->calcCount;
+			tdata->hasBegunPathfinding = false;
+			if (InitPathfinding(tdata) == PATHSTATE_ERROR)
+			{
+				tdata->pathSuffix.clear();
+				return false;
+			}
+
+			return true;
+		}
+
+		//
+		// Called after each A* step while repairing a path. Gives up on the repair
+		// and searches all the way to the goal if no way around the blocked squares
+		// is found quickly.
+		//
+		PathState AdvanceRepair(ThreadData* tdata, PathState state)
+		{
+			if (state == PATHSTATE_ERROR ||
+			    (state == PATHSTATE_OK && tdata->calcCount - tdata->segmentCalcStart > MAXIMUM_REPAIR_CALCULATIONS))
+			{
+				FallBackToFullSearch(tdata);
+				return PATHSTATE_OK;
+			}
+
+			if (state == PATHSTATE_GOAL)
+			{
+				const node& reached = tdata->nodes[tdata->nearestNode];
+				if (reached.x != tdata->pathSuffix[0].x || reached.y != tdata->pathSuffix[0].y)
+				{
+					// The goal was considered reached before the old path was rejoined
+					tdata->pathSuffix.clear();
+				}
+			}
+
+			return state;
+		}
+#endif
+
+		//
+		// Store a path found by other means than A* in the node array, the same way
+		// A* would have left it, so that BuildNodeLinkedList() can be used.
+		//
+		bool StoreNodePath(ThreadData* tdata, int start_x, int start_y, const vector<Dimension::IntPosition>& path)
+		{
+			if ((int) path.size() >= tdata->openListSize)
+			{
+				return false;
+			}
+
+			struct node *nodes = tdata->nodes;
+			nodes[0].x = start_x;
+			nodes[0].y = start_y;
+			nodes[0].parent = -1;
+			for (unsigned i = 0; i < path.size(); i++)
+			{
+				nodes[i+1].x = path[i].x;
+				nodes[i+1].y = path[i].y;
+				nodes[i+1].parent = i;
+			}
+			for (unsigned i = 0; i <= path.size(); i++)
+			{
+				// Keeps BuildNodeLinkedList() from updating the heuristic table from these
+				nodes[i].g = 0;
+				nodes[i].h = 0;
+				nodes[i].f = 0;
+			}
+			tdata->nearestNode = path.size();
+			return true;
+		}
+
+#ifdef USE_JUMP_POINT_SEARCH
+		//
+		// Jump Point Search, as described in "Online Graph Pruning for Pathfinding
+		// on Grid Maps" by Harabor and Grastien. Used instead of A* when every square
+		// between the start and the goal takes equally long to traverse, in which
+		// case most squares can be skipped instead of being put in the open list.
+		// Just like A*, diagonal moves are allowed past blocked corners.
+		//
+		// The search is confined to a rectangle around start and goal; if no path is
+		// found within it, the ordinary A* takes over.
+		//
+
+#define JPS_MARGIN 16
+
+		inline bool JPS_IsWalkable(ThreadData* tdata, int x, int y)
+		{
+			return x >= tdata->jpsStartX && y >= tdata->jpsStartY && x <= tdata->jpsEndX && y <= tdata->jpsEndY && IsWalkable(tdata->pUnit, x, y);
+		}
+
+		inline int JPS_Cost(ThreadData* tdata, int dx, int dy)
+		{
+			int straight, diagonal;
+			dx = abs(dx);
+			dy = abs(dy);
+			diagonal = dx < dy ? dx : dy;
+			straight = (dx > dy ? dx : dy) - diagonal;
+			return straight * tdata->jpsCost + diagonal * (tdata->jpsCost + (tdata->jpsCost >> 1));
+		}
+
+		//
+		// Move from (x, y) in the direction (dx, dy) until something interesting
+		// happens: the goal is reached, or a square is found where the path may have
+		// to turn because of an obstacle. Returns false if the way is blocked.
+		//
+		bool JPS_Jump(ThreadData* tdata, int x, int y, int dx, int dy, int& jump_x, int& jump_y)
+		{
+			while (1)
+			{
+				x += dx;
+				y += dy;
+
+				tdata->calcCount++;
+				tdata->psteps++;
+
+				if (!JPS_IsWalkable(tdata, x, y))
+				{
+					return false;
 				}
 
-				new_node = &new_nodes[i++];
-				new_node->x = tdata->nodes[cur_node].x;
-				new_node->y = tdata->nodes[cur_node].y;
-				new_node->pChild = prev_node;
-				if (prev_node)
+				if (x == tdata->jpsTargetX && y == tdata->jpsTargetY)
 				{
-					prev_node->pParent = new_node;
+					break;
+				}
+
+				if (dx && dy)
+				{
+					if ((JPS_IsWalkable(tdata, x - dx, y + dy) && !JPS_IsWalkable(tdata, x - dx, y)) ||
+					    (JPS_IsWalkable(tdata, x + dx, y - dy) && !JPS_IsWalkable(tdata, x, y - dy)))
+					{
+						break;
+					}
+
+					int tmp_x, tmp_y;
+					if (JPS_Jump(tdata, x, y, dx, 0, tmp_x, tmp_y) || JPS_Jump(tdata, x, y, 0, dy, tmp_x, tmp_y))
+					{
+						break;
+					}
+				}
+				else if (dx)
+				{
+					if ((JPS_IsWalkable(tdata, x + dx, y + 1) && !JPS_IsWalkable(tdata, x, y + 1)) ||
+					    (JPS_IsWalkable(tdata, x + dx, y - 1) && !JPS_IsWalkable(tdata, x, y - 1)))
+					{
+						break;
+					}
 				}
 				else
 				{
-					new_node->pParent = NULL;
+					if ((JPS_IsWalkable(tdata, x + 1, y + dy) && !JPS_IsWalkable(tdata, x + 1, y)) ||
+					    (JPS_IsWalkable(tdata, x - 1, y + dy) && !JPS_IsWalkable(tdata, x - 1, y)))
+					{
+						break;
+					}
 				}
-				if (!first_node)
+			}
+			jump_x = x;
+			jump_y = y;
+			return true;
+		}
+
+		//
+		// The directions worth searching from a square, given the direction it was
+		// reached from. Returns the number of directions.
+		//
+		int JPS_GetDirections(ThreadData* tdata, int x, int y, int dx, int dy, int dirs[8][2])
+		{
+			int num = 0;
+
+			if (!dx && !dy)
+			{
+				for (dy = -1; dy <= 1; dy++)
 				{
-					first_node = new_node;
+					for (dx = -1; dx <= 1; dx++)
+					{
+						if (dx || dy)
+						{
+							dirs[num][0] = dx;
+							dirs[num][1] = dy;
+							num++;
+						}
+					}
 				}
-				cur_node = tdata->nodes[cur_node].parent;
-				prev_node = new_node;
+				return num;
 			}
-			SDL_UnlockMutex(gpmxHConst);
 
-			md->_goal = first_node;
-			md->_start = new_node;
-			tdata->nearestNode = -1;
+			if (dx && dy)
+			{
+				dirs[num][0] = 0;  dirs[num][1] = dy; num++;
+				dirs[num][0] = dx; dirs[num][1] = 0;  num++;
+				dirs[num][0] = dx; dirs[num][1] = dy; num++;
+				if (!JPS_IsWalkable(tdata, x - dx, y))
+				{
+					dirs[num][0] = -dx; dirs[num][1] = dy; num++;
+				}
+				if (!JPS_IsWalkable(tdata, x, y - dy))
+				{
+					dirs[num][0] = dx; dirs[num][1] = -dy; num++;
+				}
+			}
+			else if (dx)
+			{
+				dirs[num][0] = dx; dirs[num][1] = 0; num++;
+				if (!JPS_IsWalkable(tdata, x, y + 1))
+				{
+					dirs[num][0] = dx; dirs[num][1] = 1; num++;
+				}
+				if (!JPS_IsWalkable(tdata, x, y - 1))
+				{
+					dirs[num][0] = dx; dirs[num][1] = -1; num++;
+				}
+			}
+			else
+			{
+				dirs[num][0] = 0; dirs[num][1] = dy; num++;
+				if (!JPS_IsWalkable(tdata, x + 1, y))
+				{
+					dirs[num][0] = 1; dirs[num][1] = dy; num++;
+				}
+				if (!JPS_IsWalkable(tdata, x - 1, y))
+				{
+					dirs[num][0] = -1; dirs[num][1] = dy; num++;
+				}
+			}
+			return num;
 		}
-		
-		inline void ParsePopQueueReason(ThreadData*& tdata, gc_ptr<MovementData>& md)
+
+		//
+		// Returns the index of the goal node, or -1 if it could not be reached.
+		//
+		int JPS_Search(ThreadData* tdata, int start_x, int start_y)
+		{
+			struct node *nodes = tdata->nodes;
+			int target_x = tdata->jpsTargetX, target_y = tdata->jpsTargetY;
+			int first_node;
+
+			ResetNodeTypes(tdata);
+
+			nodes[0].x = start_x;
+			nodes[0].y = start_y;
+			nodes[0].g = 0;
+			nodes[0].h = JPS_Cost(tdata, target_x - start_x, target_y - start_y);
+			nodes[0].f = nodes[0].h;
+			nodes[0].parent = -1;
+			tdata->scratch[start_y * width + start_x].nodeNum = 0;
+			tdata->scratch[start_y * width + start_x].nodeType = tdata->NODE_TYPE_OPEN;
+			tdata->nextFreeNode = 1;
+			quad_heap_pop_all(tdata->heap);
+			quad_heap_push_item(tdata->heap, 0, 0);
+
+			while ((first_node = quad_heap_pop_item(tdata->heap, -1)) != -1)
+			{
+				int node_x = nodes[first_node].x, node_y = nodes[first_node].y;
+				int dirs[8][2], num_dirs, dx = 0, dy = 0;
+
+				tdata->scratch[node_y * width + node_x].nodeType = tdata->NODE_TYPE_CLOSED;
+
+				if (node_x == target_x && node_y == target_y)
+				{
+					quad_heap_pop_all(tdata->heap);
+					return first_node;
+				}
+
+				if (nodes[first_node].parent != -1)
+				{
+					int parent_x = nodes[nodes[first_node].parent].x, parent_y = nodes[nodes[first_node].parent].y;
+					dx = node_x > parent_x ? 1 : (node_x < parent_x ? -1 : 0);
+					dy = node_y > parent_y ? 1 : (node_y < parent_y ? -1 : 0);
+				}
+
+				num_dirs = JPS_GetDirections(tdata, node_x, node_y, dx, dy, dirs);
+
+				for (int i = 0; i < num_dirs; i++)
+				{
+					int new_x, new_y, node_num;
+
+					if (!JPS_Jump(tdata, node_x, node_y, dirs[i][0], dirs[i][1], new_x, new_y))
+					{
+						continue;
+					}
+
+					Uint16 node_type = tdata->scratch[new_y * width + new_x].nodeType;
+					int new_g = nodes[first_node].g + JPS_Cost(tdata, new_x - node_x, new_y - node_y);
+
+					if (node_type == tdata->NODE_TYPE_CLOSED)
+					{
+						continue;
+					}
+
+					if (node_type == tdata->NODE_TYPE_OPEN)
+					{
+						node_num = tdata->scratch[new_y * width + new_x].nodeNum;
+						if (new_g < nodes[node_num].g)
+						{
+							nodes[node_num].g = new_g;
+							nodes[node_num].f = nodes[node_num].h + new_g;
+							nodes[node_num].parent = first_node;
+							quad_heap_lower_item_score(tdata->heap, node_num, (nodes[node_num].f<<16)+nodes[node_num].h);
+						}
+						continue;
+					}
+
+					if (tdata->nextFreeNode >= tdata->openListSize)
+					{
+						quad_heap_pop_all(tdata->heap);
+						return -1;
+					}
+
+					node_num = tdata->scratch[new_y * width + new_x].nodeNum = tdata->nextFreeNode++;
+					nodes[node_num].x = new_x;
+					nodes[node_num].y = new_y;
+					nodes[node_num].g = new_g;
+					nodes[node_num].h = JPS_Cost(tdata, target_x - new_x, target_y - new_y);
+					nodes[node_num].f = nodes[node_num].h + new_g;
+					nodes[node_num].parent = first_node;
+					tdata->scratch[new_y * width + new_x].nodeType = tdata->NODE_TYPE_OPEN;
+					quad_heap_push_item(tdata->heap, node_num, (nodes[node_num].f<<16)+nodes[node_num].h);
+				}
+			}
+			return -1;
+		}
+
+		//
+		// Use Jump Point Search if the area between start and goal is of uniform cost.
+		//
+		bool UseJumpPointSearch(ThreadData* tdata)
 		{
-			cCount += calcCount;
-			tCount += tsteps;
-			fCount += fsteps;
-			pCount += psteps;
+			const gc_ptr<MovementData>& md = tdata->pUnit->pMovementData;
+			int start_x = md->_action.startPos.x, start_y = md->_action.startPos.y;
+			int goal_x = md->_action.goal.pos.x, goal_y = md->_action.goal.pos.y;
+
+			// Other actions may be completed before the goal square is reached, which jumps do not notice
+			if (md->_action.goal.unit || (md->_action.action != ACTION_GOTO && md->_action.action != ACTION_MOVE_ATTACK))
+			{
+				return false;
+			}
+
+			tdata->jpsStartX = max((start_x < goal_x ? start_x : goal_x) - JPS_MARGIN, 0);
+			tdata->jpsStartY = max((start_y < goal_y ? start_y : goal_y) - JPS_MARGIN, 0);
+			tdata->jpsEndX = min((start_x > goal_x ? start_x : goal_x) + JPS_MARGIN, width - 1);
+			tdata->jpsEndY = min((start_y > goal_y ? start_y : goal_y) + JPS_MARGIN, height - 1);
+
+			tdata->jpsCost = Dimension::GetUniformTraversalTime(tdata->unitSize, tdata->jpsStartX, tdata->jpsStartY, tdata->jpsEndX, tdata->jpsEndY);
+			if (tdata->jpsCost == -1)
+			{
+				return false;
+			}
+
+			if (!IsWalkable(tdata->pUnit, start_x, start_y) || !IsWalkable(tdata->pUnit, goal_x, goal_y))
+			{
+				return false;
+			}
+
+			tdata->jpsTargetX = goal_x;
+			tdata->jpsTargetY = goal_y;
+
+			int goal_node = JPS_Search(tdata, start_x, start_y);
+			if (goal_node == -1)
+			{
+				return false;
+			}
+
+			// Fill in the squares between the jump points
+			vector<Dimension::IntPosition> jump_points, path;
+			for (int cur_node = goal_node; cur_node != -1; cur_node = tdata->nodes[cur_node].parent)
+			{
+				jump_points.push_back(Dimension::IntPosition(tdata->nodes[cur_node].x, tdata->nodes[cur_node].y));
+			}
+
+			for (int i = (int) jump_points.size() - 1; i > 0; i--)
+			{
+				int x = jump_points[i].x, y = jump_points[i].y;
+				int dx = jump_points[i-1].x > x ? 1 : (jump_points[i-1].x < x ? -1 : 0);
+				int dy = jump_points[i-1].y > y ? 1 : (jump_points[i-1].y < y ? -1 : 0);
+				while (x != jump_points[i-1].x || y != jump_points[i-1].y)
+				{
+					x += dx;
+					y += dy;
+					path.push_back(Dimension::IntPosition(x, y));
+				}
+			}
+
+			return StoreNodePath(tdata, start_x, start_y, path);
+		}
+#endif
+
+		//
+		// Take the path from a flow field shared with other units going to the same
+		// goal, if there is one. The path is stored in the node array the same way
+		// A* would have left it.
+		//
+		bool UseFlowField(ThreadData* tdata)
+		{
+			const gc_ptr<MovementData>& md = tdata->pUnit->pMovementData;
+			vector<Dimension::IntPosition> path;
+
+			if (md->_action.goal.unit || (md->_action.action != ACTION_GOTO && md->_action.action != ACTION_MOVE_ATTACK))
+			{
+				return false;
+			}
+
+			if (!GetFlowFieldPath(tdata->unitSize, tdata->areaMapIndex, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y, path))
+			{
+				return false;
+			}
+
+			return StoreNodePath(tdata, md->_action.startPos.x, md->_action.startPos.y, path);
+		}
+
+		//
+		// Add the statistics of a calculation to the global counters. Several threads
+		// finish calculations at once, so this must be called with gpmxDone held.
+		//
+		void AddCalculationStats(ThreadData* tdata)
+		{
+			cCount += tdata->calcCount;
+			tCount += tdata->tsteps;
+			fCount += tdata->fsteps;
+			pCount += tdata->psteps;
+			notReachedFlood += tdata->notReachedFlood;
+			notReachedPath += tdata->notReachedPath;
+			numGreatSuccess1 += tdata->numGreatSuccess1;
+			numGreatSuccess2 += tdata->numGreatSuccess2;
 			numPaths++;
+		}
+
+		inline void ParsePopQueueReason(ThreadData*& tdata, gc_ptr<MovementData>& md)
+		{
+			ChargePathPriority(tdata);
 
 			switch (md->_reason)
 			{
@@ -2089,9 +3631,7 @@ namespace Game
 
 					md->_action = md->_newAction;
 
-					SDL_LockMutex(gpmxQueue);
-					gCalcQueue.push(tdata->pUnit);
-					SDL_UnlockMutex(gpmxQueue);
+					EnqueuePathfinding(tdata->pUnit, tdata->threadIndex);
 
 					break;
 
@@ -2139,6 +3679,11 @@ namespace Game
 				tdata->pUnit = NULL;
 				
 				SDL_UnlockMutex(gpmxCommand);
+
+				// Not under gpmxCommand, as ApplyAllNewPaths() takes that while holding gpmxDone
+				SDL_LockMutex(gpmxDone);
+				AddCalculationStats(tdata);
+				SDL_UnlockMutex(gpmxDone);
 				return true;
 			}
 			return false;
@@ -2153,6 +3698,10 @@ namespace Game
 				tdata->pUnit = NULL;
 				
 				SDL_UnlockMutex(gpmxCommand);
+
+				SDL_LockMutex(gpmxDone);
+				AddCalculationStats(tdata);
+				SDL_UnlockMutex(gpmxDone);
 				return true;
 			}
 			SDL_UnlockMutex(gpmxCommand);
@@ -2166,19 +3715,12 @@ namespace Game
 
 			if (!tdata->pUnit)
 			{
-				SDL_LockMutex(gpmxQueue);
-				if (gCalcQueue.empty())
+				if (!DequeuePathfinding(tdata))
 				{
-					SDL_UnlockMutex(gpmxQueue);
 					return PATHSTATE_EMPTY_QUEUE;
 				}
 				else
 				{
-					tdata->pUnit = gCalcQueue.front();
-					gCalcQueue.pop();
-					tdata->pUnit->pMovementData->_associatedThread = tdata->threadIndex;
-					SDL_UnlockMutex(gpmxQueue);
-
 					SDL_LockMutex(gpmxThreadState);
 					tdata->pUnit->pMovementData->_currentState = INTTHRSTATE_PROCESSING;
 					SDL_UnlockMutex(gpmxThreadState);
@@ -2187,45 +3729,35 @@ namespace Game
 					tdata->unitSize = tdata->pUnit->type->heightOnMap-1;
 					tdata->areaMapIndex = tdata->pUnit->type->movementType;
 
+					SDL_LockMutex(gpmxAreaMap);
 					if (numNotReached[tdata->unitSize][tdata->areaMapIndex] > 10)
 					{
 						regenerateAreaCodes[tdata->unitSize][tdata->areaMapIndex] = true;
 						numNotReached[tdata->unitSize][tdata->areaMapIndex] = 0;
 					}
+					SDL_UnlockMutex(gpmxAreaMap);
 					
 					InitAreaMaps(tdata);
 
 					tdata->unitSize = tdata->pUnit->type->heightOnMap-1;
 					tdata->areaMapIndex = tdata->pUnit->type->movementType;
-					calcCount = 0;
-					fsteps = 0;
-					psteps = 0;
-					tsteps = 0;
+					tdata->calcCount = 0;
+					tdata->fsteps = 0;
+					tdata->psteps = 0;
+					tdata->tsteps = 0;
+					tdata->notReachedFlood = 0;
+					tdata->notReachedPath = 0;
+					tdata->numGreatSuccess1 = 0;
+					tdata->numGreatSuccess2 = 0;
 
 					tdata->hasBegunPathfinding = false;
-					
-					SDL_LockMutex(gpmxHConst);
-					if (!hConsts[tdata->unitSize])
-					{
-						hConsts[tdata->unitSize] = new volatile Uint16***[hConstHeight];
-						for (int y1 = 0; y1 < hConstHeight; y1++)
-						{
-							hConsts[tdata->unitSize][y1] = new volatile Uint16**[hConstWidth];
-							for (int x1 = 0; x1 < hConstWidth; x1++)
-							{
-								hConsts[tdata->unitSize][y1][x1] = new volatile Uint16*[hConstHeight];
-								for (int y2 = 0; y2 < hConstHeight; y2++)
-								{
-									hConsts[tdata->unitSize][y1][x1][y2] = new volatile Uint16[hConstHeight];
-									for (int x2 = 0; x2 < hConstWidth; x2++)
-									{
-										hConsts[tdata->unitSize][y1][x1][y2][x2] = 0x100;
-									}
-								}
-							}
-						}
-					}
-					SDL_UnlockMutex(gpmxHConst);
+
+					tdata->waypoints.clear();
+					tdata->pathPrefix.clear();
+					tdata->pathSuffix.clear();
+					tdata->curWaypoint = 0;
+					tdata->segmentStart = tdata->pUnit->pMovementData->_action.startPos;
+					tdata->segmentCalcStart = 0;
 
 				}
 			}
@@ -2243,6 +3775,30 @@ namespace Game
 			bool done = false;
 			PathState state = PATHSTATE_OK;
 
+#ifdef USE_PATH_REPAIR
+			if (tdata->preprocessState == PREPROCESSSTATE_NONE && UsePathRepair(tdata))
+			{
+				// The goal was reachable a moment ago, so there is no need for a trace or floodfill
+				tdata->preprocessState = PREPROCESSSTATE_DONE;
+			}
+#endif
+#ifdef USE_FLOW_FIELDS
+			if (tdata->preprocessState == PREPROCESSSTATE_NONE && UseFlowField(tdata))
+			{
+				tdata->preprocessState = PREPROCESSSTATE_DONE;
+				state = PATHSTATE_GOAL;
+				done = true;
+			}
+#endif
+#ifdef USE_JUMP_POINT_SEARCH
+			if (tdata->preprocessState == PREPROCESSSTATE_NONE && UseJumpPointSearch(tdata))
+			{
+				tdata->preprocessState = PREPROCESSSTATE_DONE;
+				state = PATHSTATE_GOAL;
+				done = true;
+			}
+#endif
+
 			while (!done)
 			{
 
@@ -2252,18 +3808,27 @@ namespace Game
 					{
 						SDL_LockMutex(gpmxAreaMap);
 						if (IsWalkable(unit, md->_action.goal.pos.x, md->_action.goal.pos.y) &&
-						    areaMaps[tdata->unitSize][tdata->areaMapIndex][md->_action.startPos.y][md->_action.startPos.x] ==
-						    areaMaps[tdata->unitSize][tdata->areaMapIndex][md->_action.goal.pos.y][md->_action.goal.pos.x])
+						    GetAreaCode(tdata->unitSize, tdata->areaMapIndex, md->_action.startPos.x, md->_action.startPos.y) ==
+						    GetAreaCode(tdata->unitSize, tdata->areaMapIndex, md->_action.goal.pos.x, md->_action.goal.pos.y))
 						{
 							SDL_UnlockMutex(gpmxAreaMap);
 							tdata->preprocessState = PREPROCESSSTATE_SKIPPED_TRACE; // Skip it for now
+#ifdef USE_HIERARCHICAL_PATHFINDING
+							if (FindAbstractPath(tdata->unitSize, tdata->areaMapIndex, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y, tdata->waypoints))
+							{
+								// The goal is known to be reachable, so no trace or floodfill will be needed
+								tdata->preprocessState = PREPROCESSSTATE_DONE;
+								SkipBlockedWaypoints(tdata);
+							}
+#endif
 							InitPathfinding(tdata);
 						}
 						else
 						{
-							SDL_UnlockMutex(gpmxAreaMap);
 							tdata->preprocessState = PREPROCESSSTATE_PROCESSING_TRACE;
-							if (InitTrace(tdata, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y) == PATHSTATE_ERROR)
+							bool trace_state = InitTrace(tdata, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y);
+							SDL_UnlockMutex(gpmxAreaMap);
+							if (trace_state == PATHSTATE_ERROR)
 							{
 								tdata->preprocessState = PREPROCESSSTATE_PROCESSING_FLOOD;
 								if (InitFloodfill(tdata, md->_action.startPos.x, md->_action.startPos.y, FLOODFILL_FLAG_CALCULATE_NEAREST) == PATHSTATE_ERROR)
@@ -2278,11 +3843,16 @@ namespace Game
 					{
 						do
 						{
-							calcCount++;
+							tdata->calcCount++;
 							steps++;
-							tsteps++;
+							tdata->tsteps++;
 						
-							if (TraceStep(tdata, md->_action.startPos.x, md->_action.startPos.x, md->_action.goal.pos.x, md->_action.goal.pos.y) == PATHSTATE_GOAL)
+							// The trace compares area codes, so it must not run while an area map is rebuilt
+							SDL_LockMutex(gpmxAreaMap);
+							int trace_state = TraceStep(tdata, md->_action.startPos.x, md->_action.startPos.x, md->_action.goal.pos.x, md->_action.goal.pos.y);
+							SDL_UnlockMutex(gpmxAreaMap);
+
+							if (trace_state == PATHSTATE_GOAL)
 							{
 								tdata->preprocessState = PREPROCESSSTATE_SKIPPED_FLOOD;
 								InitPathfinding(tdata);
@@ -2301,9 +3871,9 @@ namespace Game
 					{
 						do
 						{
-							calcCount++;
+							tdata->calcCount++;
 							steps++;
-							fsteps++;
+							tdata->fsteps++;
 						
 							if (FloodfillStep(tdata, md->_action.goal.pos.x, md->_action.goal.pos.y) == PATHSTATE_GOAL)
 							{
@@ -2326,22 +3896,26 @@ namespace Game
 
 					do
 					{
-						calcCount ++;
+						tdata->calcCount ++;
 						steps ++;
-						psteps++;
+						tdata->psteps++;
 						
-						if (calcCount > MAXIMUM_PATH_CALCULATIONS || 
+						if (tdata->calcCount - tdata->segmentCalcStart > MAXIMUM_PATH_CALCULATIONS || 
 							state == PATHSTATE_IMPOSSIBLE)
 						{
-							notReachedPath += psteps;
+							tdata->notReachedPath += tdata->psteps;
 							done = true;
 							quit = true; // << is used here, in order to prevent... (below)
 							break;
 						}
 
-						if (calcCount >= RECALC_TRACE_LIMIT && tdata->preprocessState == PREPROCESSSTATE_SKIPPED_TRACE)
+						if (tdata->calcCount - tdata->segmentCalcStart >= RECALC_TRACE_LIMIT && tdata->preprocessState == PREPROCESSSTATE_SKIPPED_TRACE)
 						{
-							if (InitTrace(tdata, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y) != PATHSTATE_ERROR)
+							SDL_LockMutex(gpmxAreaMap);
+							bool trace_state = InitTrace(tdata, md->_action.startPos.x, md->_action.startPos.y, md->_action.goal.pos.x, md->_action.goal.pos.y);
+							SDL_UnlockMutex(gpmxAreaMap);
+
+							if (trace_state != PATHSTATE_ERROR)
 							{
 								tdata->preprocessState = PREPROCESSSTATE_PROCESSING_TRACE;
 								break;
@@ -2352,7 +3926,7 @@ namespace Game
 							}
 						}
 
-						if (calcCount >= RECALC_FLOODFILL_LIMIT && tdata->preprocessState == PREPROCESSSTATE_SKIPPED_FLOOD)
+						if (tdata->calcCount - tdata->segmentCalcStart >= RECALC_FLOODFILL_LIMIT && tdata->preprocessState == PREPROCESSSTATE_SKIPPED_FLOOD)
 						{
 							if (InitFloodfill(tdata, md->_action.startPos.x, md->_action.startPos.y, FLOODFILL_FLAG_CALCULATE_NEAREST) != PATHSTATE_ERROR)
 							{
@@ -2366,6 +3940,17 @@ namespace Game
 						}
 
 						state = PathfindingStep(tdata);
+
+						if (tdata->waypoints.size())
+						{
+							state = AdvanceSegment(tdata, state);
+						}
+#ifdef USE_PATH_REPAIR
+						else if (tdata->pathSuffix.size())
+						{
+							state = AdvanceRepair(tdata, state);
+						}
+#endif
 						
 						if (steps > MAXIMUM_CALCULATIONS_PER_FRAME && state != PATHSTATE_GOAL)
 						{
@@ -2399,28 +3984,31 @@ namespace Game
 			}
 			else
 			{
-				cCount += calcCount;
-				tCount += tsteps;
-				fCount += fsteps;
-				pCount += psteps;
-				numPaths++;
+				ChargePathPriority(tdata);
 
 				if (state == PATHSTATE_GOAL || tdata->nearestNode != -1)
 				{
 					BuildNodeLinkedList(tdata);
 					md->calcState = CALCSTATE_REACHED_GOAL;
 					ret = SUCCESS;
-					numTotalFrames += currentFrame - md->_pathfindingStartingFrame;
 				}
 				else
 				{
-					numFailed++;
 					DeallocPathfinding(tdata);
 
 					md->calcState = CALCSTATE_FAILURE;
 				}
 				SDL_LockMutex(gpmxDone);
-				doneUnits.insert(unit);
+				AddCalculationStats(tdata);
+				if (ret == SUCCESS)
+				{
+					numTotalFrames += currentFrame - md->_pathfindingStartingFrame;
+				}
+				else
+				{
+					numFailed++;
+				}
+				doneUnits.push_back(unit);
 				SDL_UnlockMutex(gpmxDone);
 //				cout << "Done " << unit->id << endl;
 			}
@@ -2433,10 +4021,20 @@ namespace Game
 
 		int GetQueueSize()
 		{
-			int ret;
-			SDL_LockMutex(gpmxQueue);
-			ret = gCalcQueue.size();
-			SDL_UnlockMutex(gpmxQueue);
+			int ret = 0;
+			if (pThreadDatas == NULL)
+			{
+				return 0;
+			}
+			for (int i = 0; i < numPathfindingThreads; i++)
+			{
+				SDL_LockMutex(pThreadDatas[i]->pQueueMutex);
+				for (int j = 0; j < PATHPRIORITY_NUM; j++)
+				{
+					ret += pThreadDatas[i]->queues[j].size();
+				}
+				SDL_UnlockMutex(pThreadDatas[i]->pQueueMutex);
+			}
 			return ret;
 		}
 	}
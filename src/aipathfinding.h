@@ -28,12 +28,28 @@
 #include "aipathfinding-pre.h"
 
 #define USE_MULTIFRAMED_CALCULATIONS
+#define USE_HIERARCHICAL_PATHFINDING
+#define USE_FLOW_FIELDS
+#define USE_JUMP_POINT_SEARCH
+#define USE_PATH_REPAIR
+#define USE_GROUP_PATHFINDING // Needs USE_PATH_REPAIR
+#define USE_PATH_SMOOTHING
 //#define DEBUG_AI_PATHFINDING
 
 #ifdef USE_MULTIFRAMED_CALCULATIONS
 	#define MAXIMUM_CALCULATIONS_PER_FRAME 1000
 #endif
 
+// Calculations each class of path requests may use per frame; a class that has used
+// up its budget is only served when no class within its budget has requests waiting
+#define PATHPRIORITY_BUDGET_LOCAL_COMMAND  40000
+#define PATHPRIORITY_BUDGET_REMOTE_COMMAND 40000
+#define PATHPRIORITY_BUDGET_AI_COMMAND     15000
+#define PATHPRIORITY_BUDGET_REPATH         15000
+
+// A waiting request is treated as one class more urgent for every this many frames it has waited
+#define PATHPRIORITY_AGING_FRAMES 4
+
 #include "sdlheader.h"
 #include "ainode.h"
 
@@ -80,6 +96,15 @@ namespace Game
 			PATHSTATE_DOES_NOT_EXIST
 		};
 
+		struct PathPriorityStats
+		{
+			int    queueDepth;      // Requests waiting to be calculated
+			int    numDequeued;     // Requests taken for calculation so far
+			Uint32 totalWaitFrames; // Frames those requests spent waiting, summed
+			Uint32 maxWaitFrames;   // Longest wait of any of them
+			int    calcsThisFrame;  // Calculations used of the budget of the current frame
+		};
+
 		enum PopReason 
 		{
 			POP_DELETED = 0,
@@ -129,8 +154,7 @@ namespace Game
 			float distanceLeft;
 			float distancePerFrame;
 
-			Node*        pStart;
-			Node*        pGoal;
+			Path*        pPath;
 			
 			ActionData   action;
 			ActionData   secondaryAction;
@@ -138,7 +162,6 @@ namespace Game
 			bool         changedGoal;
 			int          calcState;
 
-			Node*        pCurGoalNode;
 			bool         switchedSquare;
 
 			// Internal variables
@@ -146,9 +169,11 @@ namespace Game
 			bool         _popFromQueue;
 			PopReason    _reason;
 			bool         _newCommandWhileUnApplied;
+			PathPriority _priority;
+			Uint32       _queuedFrame;
+			bool         _heldForGroup;
 			
-			Node*        _start;
-			Node*        _goal;
+			Path*        _path;
 
 			ActionData   _action;
 			
@@ -181,15 +206,15 @@ namespace Game
 
 		//
 		// Push the given unit into the pathfinding waiting queue.
-		// The pathfinding results are placed in an internal node tree,
-		// namely _start -> _goal. DO NOT ATTEMPT TO ADDRESS THESE NODES
+		// The pathfinding results are placed in an internal path,
+		// namely _path. DO NOT ATTEMPT TO ADDRESS THESE NODES
 		// MANUALLY! Once the calcState has reached CALCSTATE_REACHED_GOAL, call
 		// ApplyNewPath.
 		//
 		// Returns IPResult, IPR_*
 		//
 		// Note: IPR_SUCCESS and IPR_SUCCESS_POPCMD_ISSUED does both specify success.
-		//       If IPR_SUCCESS_POPCMD_ISSUED is given, _goal/_start haven't been
+		//       If IPR_SUCCESS_POPCMD_ISSUED is given, _path hasn't been
 		//       modified yet, because the unit is undergoing calculation. The changes
 		//       will be applied during next calculation step.
 		//
@@ -199,8 +224,28 @@ namespace Game
 		// ADDITIONS: action - assigned unit action, ACTION_*. default ACTION_GOTO
 		//            target - target unit. default NULL
 		//            args   - unit action arguments. default NULL
+		//            priority - class of the request, PATHPRIORITY_*. default PATHPRIORITY_REPATH
+		//
+		IPResult CommandPathfinding(const gc_ptr<Dimension::Unit>& pUnit, int start_x, int start_y, int goal_x, int goal_y, AI::UnitAction action = AI::ACTION_GOTO, const gc_ptr<Dimension::Unit>& target = NULL, const Dimension::ActionArguments& args = Dimension::ActionArguments(), float rotation = 0.0f, PathPriority priority = PATHPRIORITY_REPATH);
+
+		//
+		// Keep the requests of the unit out of the pathfinding queues until
+		// ReleasePathfinding() is called, so that a path it can build on may be
+		// calculated for another unit first. The unit must not be undergoing
+		// path calculation.
+		//
+		void HoldPathfinding(const gc_ptr<Dimension::Unit>& unit);
+
+		//
+		// Queue the request held back for the unit, if any.
+		// Returns true if the unit was held.
+		//
+		bool ReleasePathfinding(const gc_ptr<Dimension::Unit>& unit);
+
+		//
+		// Returns whether the requests of the unit are being held back.
 		//
-		IPResult CommandPathfinding(const gc_ptr<Dimension::Unit>& pUnit, int start_x, int start_y, int goal_x, int goal_y, AI::UnitAction action = AI::ACTION_GOTO, const gc_ptr<Dimension::Unit>& target = NULL, const Dimension::ActionArguments& args = Dimension::ActionArguments(), float rotation = 0.0f);
+		bool IsPathfindingHeld(const gc_ptr<Dimension::Unit>& unit);
 		
 		//
 		// Get the internal path state, PATHSTATE_*
@@ -239,8 +284,8 @@ namespace Game
 		//
 		// Public pathfinding deallocation function.
 		// May be provided with DPNArg: DPN_FRONT or DPN_BACK where
-		// DPN_FRONT represents the pStart -> pGoal node tree
-		// DPN_BACK represents the internal _start -> _goal node tree
+		// DPN_FRONT represents the pPath path
+		// DPN_BACK represents the internal _path path
 		//
 		void DeallocPathfindingNodes(const gc_ptr<Dimension::Unit>&, DPNArg = DPN_FRONT);
 
@@ -283,9 +328,33 @@ namespace Game
 
 		const int STACK_ELEMENTS = 2048;
 		
+		extern int numPathfindingThreads;
+
 		extern volatile int cCount, fCount, tCount, pCount, numPaths, numFailed, notReachedPath, notReachedFlood, numGreatSuccess1, numGreatSuccess2, numTotalFrames;
 		
 		int GetQueueSize();
+
+		//
+		// Budgets and aging of the classes of path requests; may be changed at any time.
+		//
+		extern int pathPriorityBudgets[PATHPRIORITY_NUM];
+		extern int pathPriorityAgingFrames;
+
+		//
+		// Get queue depth, wait times and budget use of a class of path requests.
+		//
+		void GetPathPriorityStats(PathPriority priority, PathPriorityStats& stats);
+
+		//
+		// Bytes used by the heuristic table of the current map, which grows as
+		// paths to new parts of the map are calculated.
+		//
+		size_t GetHConstMemoryUsage();
+
+		//
+		// Number of pages of the heuristic table allocated so far.
+		//
+		int GetNumHConstPages();
 	}
 }
 
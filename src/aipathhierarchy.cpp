@@ -0,0 +1,760 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Hierarchical pathfinding, as described in "Near Optimal Hierarchical
+ * Path-Finding" by Botea, Muller and Schaeffer.
+ *
+ * The map is divided into clusters, equal to the big squares used
+ * for unit lookup. Along each border between two clusters, every
+ * run of squares that is passable on both sides gets one entrance
+ * (or two, at its ends, if the run is long). The entrances are the
+ * nodes of the abstract graph; the costs of moving between the
+ * entrances of a cluster are calculated with a search limited to
+ * that cluster, and cached as edges.
+ *
+ * A search on the abstract graph only visits a few nodes per
+ * cluster, so it is cheap even over the full map. The resulting
+ * waypoints are then refined with the ordinary A* in
+ * aipathfinding.cpp, one short segment at a time.
+ *
+ * When a building is placed or removed, the clusters around it are
+ * marked as dirty, and the borders and cached costs of those are
+ * recalculated the next time the graph is used.
+ *
+ * Each graph has its own lock, which any number of searches may hold
+ * at once; building or repairing a graph waits until the searches on
+ * it are done, and holds off new ones until it is finished itself.
+ * Searches on different graphs never wait for each other.
+ */
+
+#include "aipathhierarchy.h"
+
+#include "dimension.h"
+#include "unitsquares.h"
+#include "sdlheader.h"
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <climits>
+
+// Runs of passable border squares shorter than this get a single entrance in the middle
+#define HIERARCHY_SINGLE_ENTRANCE_LIMIT 6
+// Start and goal must be at least this many clusters apart for the hierarchy to be used
+#define HIERARCHY_MIN_CLUSTER_DISTANCE 2
+
+using namespace std;
+
+namespace Game
+{
+	namespace AI
+	{
+		struct AbstractEdge
+		{
+			int to;
+			int cost;
+		};
+
+		struct AbstractNode
+		{
+			int x, y;
+			int cluster;
+			int pair;           // Entrance on the other side of the border
+			int pairCost;       // Cost of stepping over to pair
+			bool used;
+			vector<AbstractEdge> edges; // Edges to the other entrances of the same cluster
+		};
+
+		struct HierarchyGraph
+		{
+			vector<AbstractNode> nodes;
+			vector<int> freeNodes;
+			vector<int>* clusterNodes;  // Entrances per cluster
+			vector<int>* rightBorders;  // Entrances on the border towards the cluster to the right, on this side
+			vector<int>* bottomBorders; // Entrances on the border towards the cluster below, on this side
+			bool* dirty;
+			bool anyDirty;
+			bool built;
+		};
+
+		struct GraphLock
+		{
+			SDL_mutex* mutex;    // Protects the fields below and the dirty flags of the graph
+			SDL_cond*  cond;
+			int        readers;  // Number of searches using the graph
+			bool       writing;  // The graph is being built or repaired
+		};
+
+		typedef pair<int, int> QueueItem;
+		typedef priority_queue<QueueItem, vector<QueueItem>, greater<QueueItem> > MinQueue;
+
+		HierarchyGraph* hierarchyGraphs[4][Dimension::MOVEMENT_TYPES_NUM];
+		GraphLock       graphLocks[4][Dimension::MOVEMENT_TYPES_NUM];
+		bool            hierarchyInitialized = false;
+		int             clustersWide, clustersHigh, numClusters;
+		int             clusterSize;
+		int             mapWidth, mapHeight;
+
+		void GetClusterRect(int cluster, int& start_x, int& start_y, int& end_x, int& end_y)
+		{
+			start_x = (cluster % clustersWide) * clusterSize;
+			start_y = (cluster / clustersWide) * clusterSize;
+			end_x = min(start_x + clusterSize - 1, mapWidth - 1);
+			end_y = min(start_y + clusterSize - 1, mapHeight - 1);
+		}
+
+		inline int GetCluster(int x, int y)
+		{
+			return (y >> Dimension::bigSquareRightShift) * clustersWide + (x >> Dimension::bigSquareRightShift);
+		}
+
+		inline bool IsWalkable_Hierarchy(int size, int mt, int x, int y)
+		{
+			return Dimension::MovementTypeCanWalkOnSquare_Pathfinding((Dimension::MovementType) mt, size, x, y);
+		}
+
+		//
+		// Dijkstra from (from_x, from_y), limited to the given cluster. Leaves the
+		// cost of reaching each square of the cluster in clusterDist, or -1.
+		// clusterDist is scratch owned by the caller, so that several threads can
+		// search at once.
+		//
+		void SearchCluster(int size, int mt, int cluster, int from_x, int from_y, vector<int>& clusterDist)
+		{
+			int start_x, start_y, end_x, end_y;
+			GetClusterRect(cluster, start_x, start_y, end_x, end_y);
+			int w = end_x - start_x + 1;
+
+			clusterDist.assign(clusterSize * clusterSize, -1);
+
+			if (!IsWalkable_Hierarchy(size, mt, from_x, from_y))
+			{
+				return;
+			}
+
+			MinQueue queue;
+			int from = (from_y - start_y) * w + (from_x - start_x);
+			clusterDist[from] = 0;
+			queue.push(QueueItem(0, from));
+
+			while (!queue.empty())
+			{
+				QueueItem item = queue.top();
+				queue.pop();
+				if (item.first != clusterDist[item.second])
+				{
+					continue;
+				}
+				int x = start_x + item.second % w;
+				int y = start_y + item.second / w;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					int new_y = y + dy;
+					if (new_y < start_y || new_y > end_y)
+						continue;
+
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int new_x = x + dx;
+						if ((!dx && !dy) || new_x < start_x || new_x > end_x)
+							continue;
+
+						int index = (new_y - start_y) * w + (new_x - start_x);
+						int cost = item.first + Dimension::GetTraversalTimeBySize(size, x, y, dx, dy);
+						if (clusterDist[index] != -1 && clusterDist[index] <= cost)
+							continue;
+
+						if (!IsWalkable_Hierarchy(size, mt, new_x, new_y))
+							continue;
+
+						clusterDist[index] = cost;
+						queue.push(QueueItem(cost, index));
+					}
+				}
+			}
+		}
+
+		inline int GetClusterDist(const vector<int>& clusterDist, int cluster, int x, int y)
+		{
+			int start_x, start_y, end_x, end_y;
+			GetClusterRect(cluster, start_x, start_y, end_x, end_y);
+			return clusterDist[(y - start_y) * (end_x - start_x + 1) + (x - start_x)];
+		}
+
+		int AllocNode(HierarchyGraph* graph)
+		{
+			int index;
+			if (graph->freeNodes.size())
+			{
+				index = graph->freeNodes.back();
+				graph->freeNodes.pop_back();
+			}
+			else
+			{
+				index = graph->nodes.size();
+				graph->nodes.push_back(AbstractNode());
+			}
+			graph->nodes[index].used = true;
+			graph->nodes[index].edges.clear();
+			return index;
+		}
+
+		void FreeNode(HierarchyGraph* graph, int index)
+		{
+			AbstractNode& node = graph->nodes[index];
+			vector<int>& nodes = graph->clusterNodes[node.cluster];
+			nodes.erase(find(nodes.begin(), nodes.end(), index));
+			node.used = false;
+			node.edges.clear();
+			graph->freeNodes.push_back(index);
+		}
+
+		void AddEntrance(HierarchyGraph* graph, int size, vector<int>& border, int x1, int y1, int x2, int y2)
+		{
+			int a = AllocNode(graph);
+			int b = AllocNode(graph);
+			AbstractNode& node_a = graph->nodes[a];
+			AbstractNode& node_b = graph->nodes[b];
+
+			node_a.x = x1;
+			node_a.y = y1;
+			node_a.cluster = GetCluster(x1, y1);
+			node_a.pair = b;
+			node_a.pairCost = Dimension::GetTraversalTimeBySize(size, x1, y1, x2 - x1, y2 - y1);
+
+			node_b.x = x2;
+			node_b.y = y2;
+			node_b.cluster = GetCluster(x2, y2);
+			node_b.pair = a;
+			node_b.pairCost = Dimension::GetTraversalTimeBySize(size, x2, y2, x1 - x2, y1 - y2);
+
+			graph->clusterNodes[node_a.cluster].push_back(a);
+			graph->clusterNodes[node_b.cluster].push_back(b);
+			border.push_back(a);
+		}
+
+		void ClearBorder(HierarchyGraph* graph, vector<int>& border)
+		{
+			for (unsigned i = 0; i < border.size(); i++)
+			{
+				int pair = graph->nodes[border[i]].pair;
+				FreeNode(graph, border[i]);
+				FreeNode(graph, pair);
+			}
+			border.clear();
+		}
+
+		//
+		// Place entrances along the border between cluster and the cluster to its right
+		// (if right is set), or the cluster below it.
+		//
+		void ScanBorder(HierarchyGraph* graph, int size, int mt, int cluster, bool right)
+		{
+			int start_x, start_y, end_x, end_y;
+			vector<int>& border = right ? graph->rightBorders[cluster] : graph->bottomBorders[cluster];
+
+			ClearBorder(graph, border);
+
+			GetClusterRect(cluster, start_x, start_y, end_x, end_y);
+
+			if (right ? end_x + 1 >= mapWidth : end_y + 1 >= mapHeight)
+			{
+				return;
+			}
+
+			int length = right ? end_y - start_y + 1 : end_x - start_x + 1;
+			int run_start = -1;
+
+			for (int i = 0; i <= length; i++)
+			{
+				int x = right ? end_x : start_x + i;
+				int y = right ? start_y + i : end_y;
+				int dx = right ? 1 : 0;
+				int dy = right ? 0 : 1;
+
+				bool open = i < length && IsWalkable_Hierarchy(size, mt, x, y) && IsWalkable_Hierarchy(size, mt, x + dx, y + dy);
+
+				if (open && run_start == -1)
+				{
+					run_start = i;
+				}
+				else if (!open && run_start != -1)
+				{
+					int run_end = i - 1;
+					if (run_end - run_start + 1 < HIERARCHY_SINGLE_ENTRANCE_LIMIT)
+					{
+						int mid = (run_start + run_end) >> 1;
+						int mx = right ? end_x : start_x + mid;
+						int my = right ? start_y + mid : end_y;
+						AddEntrance(graph, size, border, mx, my, mx + dx, my + dy);
+					}
+					else
+					{
+						int sx = right ? end_x : start_x + run_start;
+						int sy = right ? start_y + run_start : end_y;
+						int ex = right ? end_x : start_x + run_end;
+						int ey = right ? start_y + run_end : end_y;
+						AddEntrance(graph, size, border, sx, sy, sx + dx, sy + dy);
+						AddEntrance(graph, size, border, ex, ey, ex + dx, ey + dy);
+					}
+					run_start = -1;
+				}
+			}
+		}
+
+		//
+		// Recalculate the cached costs between all entrances of a cluster.
+		//
+		void CalculateClusterEdges(HierarchyGraph* graph, int size, int mt, int cluster)
+		{
+			vector<int>& nodes = graph->clusterNodes[cluster];
+			vector<int> clusterDist;
+			for (unsigned i = 0; i < nodes.size(); i++)
+			{
+				AbstractNode& node = graph->nodes[nodes[i]];
+				node.edges.clear();
+				SearchCluster(size, mt, cluster, node.x, node.y, clusterDist);
+				for (unsigned j = 0; j < nodes.size(); j++)
+				{
+					if (i == j)
+						continue;
+
+					const AbstractNode& other = graph->nodes[nodes[j]];
+					int dist = GetClusterDist(clusterDist, cluster, other.x, other.y);
+					if (dist != -1)
+					{
+						AbstractEdge edge;
+						edge.to = nodes[j];
+						edge.cost = dist;
+						node.edges.push_back(edge);
+					}
+				}
+			}
+		}
+
+		HierarchyGraph* AllocGraph()
+		{
+			HierarchyGraph* graph = new HierarchyGraph;
+			graph->clusterNodes = new vector<int>[numClusters];
+			graph->rightBorders = new vector<int>[numClusters];
+			graph->bottomBorders = new vector<int>[numClusters];
+			graph->dirty = new bool[numClusters];
+			graph->anyDirty = false;
+			graph->built = false;
+
+			for (int i = 0; i < numClusters; i++)
+			{
+				graph->dirty[i] = false;
+			}
+			return graph;
+		}
+
+		//
+		// Place all entrances and calculate all costs of a graph from AllocGraph().
+		// Doesn't touch the dirty flags, which may be set while this runs.
+		//
+		void BuildGraph(HierarchyGraph* graph, int size, int mt)
+		{
+			for (int i = 0; i < numClusters; i++)
+			{
+				ScanBorder(graph, size, mt, i, true);
+				ScanBorder(graph, size, mt, i, false);
+			}
+
+			for (int i = 0; i < numClusters; i++)
+			{
+				CalculateClusterEdges(graph, size, mt, i);
+			}
+		}
+
+		void DeleteGraph(HierarchyGraph* graph)
+		{
+			delete[] graph->clusterNodes;
+			delete[] graph->rightBorders;
+			delete[] graph->bottomBorders;
+			delete[] graph->dirty;
+			delete graph;
+		}
+
+		//
+		// Rescan the borders of the clusters marked in dirty, and recalculate the
+		// costs of every cluster that got new entrances in the process.
+		//
+		void RepairGraph(HierarchyGraph* graph, int size, int mt, const vector<char>& dirty)
+		{
+			vector<char> affected(numClusters, 0);
+			vector<char> rescannedRight(numClusters, 0);
+			vector<char> rescannedBottom(numClusters, 0);
+
+			for (int i = 0; i < numClusters; i++)
+			{
+				if (!dirty[i])
+					continue;
+
+				int cx = i % clustersWide, cy = i / clustersWide;
+
+				affected[i] = 1;
+
+				// Right and bottom borders belong to this cluster, left and top ones to the neighbours
+				int borders[4][2] = {
+					{ i, 1 },
+					{ i, 0 },
+					{ cx > 0 ? i - 1 : -1, 1 },
+					{ cy > 0 ? i - clustersWide : -1, 0 }
+				};
+
+				for (int j = 0; j < 4; j++)
+				{
+					int cluster = borders[j][0];
+					bool right = borders[j][1] != 0;
+					if (cluster == -1)
+						continue;
+
+					vector<char>& rescanned = right ? rescannedRight : rescannedBottom;
+					if (rescanned[cluster])
+						continue;
+
+					rescanned[cluster] = 1;
+					affected[cluster] = 1;
+					if (right && cluster % clustersWide + 1 < clustersWide)
+						affected[cluster + 1] = 1;
+					if (!right && cluster + clustersWide < numClusters)
+						affected[cluster + clustersWide] = 1;
+
+					ScanBorder(graph, size, mt, cluster, right);
+				}
+			}
+
+			for (int i = 0; i < numClusters; i++)
+			{
+				if (affected[i])
+				{
+					CalculateClusterEdges(graph, size, mt, i);
+				}
+			}
+		}
+
+		//
+		// Wait until the graph for size and mt is built and up to date, building or
+		// repairing it if needed, and register the caller as one of its readers.
+		//
+		HierarchyGraph* AcquireGraph(int size, int mt)
+		{
+			GraphLock& lock = graphLocks[size][mt];
+
+			SDL_LockMutex(lock.mutex);
+			while (1)
+			{
+				if (lock.writing)
+				{
+					SDL_CondWait(lock.cond, lock.mutex);
+					continue;
+				}
+
+				HierarchyGraph* graph = hierarchyGraphs[size][mt];
+				if (graph && graph->built && !graph->anyDirty)
+				{
+					lock.readers++;
+					SDL_UnlockMutex(lock.mutex);
+					return graph;
+				}
+
+				lock.writing = true;
+				while (lock.readers)
+				{
+					SDL_CondWait(lock.cond, lock.mutex);
+				}
+
+				if (!graph)
+				{
+					graph = hierarchyGraphs[size][mt] = AllocGraph();
+				}
+
+				bool build = !graph->built;
+				vector<char> dirty(graph->dirty, graph->dirty + numClusters);
+				for (int i = 0; i < numClusters; i++)
+				{
+					graph->dirty[i] = false;
+				}
+				graph->anyDirty = false;
+
+				SDL_UnlockMutex(lock.mutex);
+
+				if (build)
+				{
+					BuildGraph(graph, size, mt);
+				}
+				else
+				{
+					RepairGraph(graph, size, mt, dirty);
+				}
+
+				SDL_LockMutex(lock.mutex);
+				graph->built = true;
+				lock.writing = false;
+				SDL_CondBroadcast(lock.cond);
+			}
+		}
+
+		void ReleaseGraph(int size, int mt)
+		{
+			GraphLock& lock = graphLocks[size][mt];
+
+			SDL_LockMutex(lock.mutex);
+			if (--lock.readers == 0)
+			{
+				SDL_CondBroadcast(lock.cond);
+			}
+			SDL_UnlockMutex(lock.mutex);
+		}
+
+		inline int EstimateCost(int x1, int y1, int x2, int y2)
+		{
+			// Octile distance; no square is cheaper to traverse than 10
+			int dx = abs(x1 - x2), dy = abs(y1 - y2);
+			return dx > dy ? dx * 10 + dy * 5 : dy * 10 + dx * 5;
+		}
+
+		bool FindAbstractPath(int size, int mt, int start_x, int start_y, int goal_x, int goal_y, vector<Dimension::IntPosition>& waypoints)
+		{
+			if (!hierarchyInitialized)
+			{
+				return false;
+			}
+
+			int start_cluster = GetCluster(start_x, start_y);
+			int goal_cluster = GetCluster(goal_x, goal_y);
+
+			if (abs(start_cluster % clustersWide - goal_cluster % clustersWide) < HIERARCHY_MIN_CLUSTER_DISTANCE &&
+			    abs(start_cluster / clustersWide - goal_cluster / clustersWide) < HIERARCHY_MIN_CLUSTER_DISTANCE)
+			{
+				return false;
+			}
+
+			HierarchyGraph* graph = AcquireGraph(size, mt);
+
+			// The start and goal are inserted as two extra nodes, connected to the entrances
+			// of their clusters. The costs towards the goal are approximated by searching
+			// from the goal, as traversal times only differ slightly depending on direction.
+			int num_nodes = graph->nodes.size();
+			int start_node = num_nodes, goal_node = num_nodes + 1;
+
+			vector<AbstractEdge> start_edges;
+			vector<int> goal_costs(num_nodes, -1);
+			vector<int> clusterDist;
+
+			SearchCluster(size, mt, start_cluster, start_x, start_y, clusterDist);
+			for (unsigned i = 0; i < graph->clusterNodes[start_cluster].size(); i++)
+			{
+				int index = graph->clusterNodes[start_cluster][i];
+				int dist = GetClusterDist(clusterDist, start_cluster, graph->nodes[index].x, graph->nodes[index].y);
+				if (dist != -1)
+				{
+					AbstractEdge edge;
+					edge.to = index;
+					edge.cost = dist;
+					start_edges.push_back(edge);
+				}
+			}
+
+			SearchCluster(size, mt, goal_cluster, goal_x, goal_y, clusterDist);
+			for (unsigned i = 0; i < graph->clusterNodes[goal_cluster].size(); i++)
+			{
+				int index = graph->clusterNodes[goal_cluster][i];
+				goal_costs[index] = GetClusterDist(clusterDist, goal_cluster, graph->nodes[index].x, graph->nodes[index].y);
+			}
+
+			vector<int> g(num_nodes + 2, INT_MAX);
+			vector<int> parent(num_nodes + 2, -1);
+			vector<char> closed(num_nodes + 2, 0);
+			MinQueue open;
+
+			g[start_node] = 0;
+			open.push(QueueItem(EstimateCost(start_x, start_y, goal_x, goal_y), start_node));
+
+			while (!open.empty())
+			{
+				int cur = open.top().second;
+				open.pop();
+
+				if (closed[cur])
+					continue;
+
+				closed[cur] = 1;
+
+				if (cur == goal_node)
+					break;
+
+				const vector<AbstractEdge>& edges = cur == start_node ? start_edges : graph->nodes[cur].edges;
+				int num_edges = edges.size();
+
+				// Intra-cluster edges, then the step over the border, then the goal
+				for (int i = 0; i <= num_edges + 1; i++)
+				{
+					int to, cost;
+					if (i < num_edges)
+					{
+						to = edges[i].to;
+						cost = edges[i].cost;
+					}
+					else if (cur == start_node)
+					{
+						break;
+					}
+					else if (i == num_edges)
+					{
+						to = graph->nodes[cur].pair;
+						cost = graph->nodes[cur].pairCost;
+					}
+					else if (goal_costs[cur] != -1)
+					{
+						to = goal_node;
+						cost = goal_costs[cur];
+					}
+					else
+					{
+						break;
+					}
+
+					int new_g = g[cur] + cost;
+					if (closed[to] || new_g >= g[to])
+						continue;
+
+					g[to] = new_g;
+					parent[to] = cur;
+
+					int estimate = to == goal_node ? 0 : EstimateCost(graph->nodes[to].x, graph->nodes[to].y, goal_x, goal_y);
+					open.push(QueueItem(new_g + estimate, to));
+				}
+			}
+
+			if (!closed[goal_node])
+			{
+				ReleaseGraph(size, mt);
+				return false;
+			}
+
+			waypoints.clear();
+			waypoints.push_back(Dimension::IntPosition(goal_x, goal_y));
+			for (int cur = parent[goal_node]; cur != start_node; cur = parent[cur])
+			{
+				waypoints.push_back(Dimension::IntPosition(graph->nodes[cur].x, graph->nodes[cur].y));
+			}
+			reverse(waypoints.begin(), waypoints.end());
+
+			ReleaseGraph(size, mt);
+
+			return true;
+		}
+
+		void InvalidatePathHierarchy(int start_x, int start_y, int end_x, int end_y)
+		{
+			if (!hierarchyInitialized)
+			{
+				return;
+			}
+
+			// Units of up to size 4 are affected by squares this far away
+			start_x = max(start_x - 4, 0) >> Dimension::bigSquareRightShift;
+			start_y = max(start_y - 4, 0) >> Dimension::bigSquareRightShift;
+			end_x = min(end_x + 4, mapWidth - 1) >> Dimension::bigSquareRightShift;
+			end_y = min(end_y + 4, mapHeight - 1) >> Dimension::bigSquareRightShift;
+
+			for (int j = 0; j < 4; j++)
+			{
+				for (int i = 0; i < Dimension::MOVEMENT_TYPES_NUM; i++)
+				{
+					GraphLock& lock = graphLocks[j][i];
+					SDL_LockMutex(lock.mutex);
+
+					HierarchyGraph* graph = hierarchyGraphs[j][i];
+					if (!graph)
+					{
+						SDL_UnlockMutex(lock.mutex);
+						continue;
+					}
+
+					for (int y = start_y; y <= end_y; y++)
+					{
+						for (int x = start_x; x <= end_x; x++)
+						{
+							graph->dirty[y * clustersWide + x] = true;
+						}
+					}
+					graph->anyDirty = true;
+					SDL_UnlockMutex(lock.mutex);
+				}
+			}
+		}
+
+		void InitPathHierarchy()
+		{
+			if (hierarchyInitialized)
+			{
+				return;
+			}
+
+			mapWidth = Dimension::pWorld->width;
+			mapHeight = Dimension::pWorld->height;
+			clusterSize = 1 << Dimension::bigSquareRightShift;
+			clustersWide = (mapWidth + clusterSize - 1) >> Dimension::bigSquareRightShift;
+			clustersHigh = (mapHeight + clusterSize - 1) >> Dimension::bigSquareRightShift;
+			numClusters = clustersWide * clustersHigh;
+
+			for (int j = 0; j < 4; j++)
+			{
+				for (int i = 0; i < Dimension::MOVEMENT_TYPES_NUM; i++)
+				{
+					hierarchyGraphs[j][i] = NULL;
+					graphLocks[j][i].mutex = SDL_CreateMutex();
+					graphLocks[j][i].cond = SDL_CreateCond();
+					graphLocks[j][i].readers = 0;
+					graphLocks[j][i].writing = false;
+				}
+			}
+
+			hierarchyInitialized = true;
+		}
+
+		void QuitPathHierarchy()
+		{
+			if (!hierarchyInitialized)
+			{
+				return;
+			}
+
+			for (int j = 0; j < 4; j++)
+			{
+				for (int i = 0; i < Dimension::MOVEMENT_TYPES_NUM; i++)
+				{
+					if (hierarchyGraphs[j][i])
+					{
+						DeleteGraph(hierarchyGraphs[j][i]);
+						hierarchyGraphs[j][i] = NULL;
+					}
+					SDL_DestroyCond(graphLocks[j][i].cond);
+					SDL_DestroyMutex(graphLocks[j][i].mutex);
+				}
+			}
+
+			hierarchyInitialized = false;
+		}
+	}
+}
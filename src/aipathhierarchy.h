@@ -0,0 +1,79 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AIPATHHIERARCHY_H
+#define AIPATHHIERARCHY_H
+
+#ifdef DEBUG_DEP
+#warning "aipathhierarchy.h"
+#endif
+
+#include "dimension-pre.h"
+
+#include <vector>
+
+namespace Game
+{
+	namespace AI
+	{
+		//
+		// Abstract graph used for hierarchical pathfinding (HPA*). The map is divided
+		// into clusters, which are the same as the big squares in unitsquares.cpp.
+		// Where two neighbouring clusters have a passable border, entrance nodes are
+		// placed on both sides, and the costs between the entrances of a cluster are
+		// precalculated. There is one graph per unit size and movement type, built the
+		// first time it is needed.
+		//
+
+		//
+		// Allocate the hierarchy structures for the current map.
+		//
+		void InitPathHierarchy();
+
+		//
+		// Free all hierarchy graphs.
+		//
+		void QuitPathHierarchy();
+
+		//
+		// Find a path through the abstract graph from the start to the goal. On success,
+		// the positions to pass through are placed in waypoints, ending with the goal
+		// itself, and the starting position excluded. Returns false if start and goal
+		// are too close to benefit from the hierarchy, or if no abstract path was found;
+		// the caller should then fall back to searching the full map.
+		//
+		// Safe to call from any pathfinding thread.
+		//
+		bool FindAbstractPath(int size, int mt, int start_x, int start_y, int goal_x, int goal_y, std::vector<Dimension::IntPosition>& waypoints);
+
+		//
+		// Mark the clusters touching the given rectangle as changed, so that their
+		// entrances and costs are recalculated before they are used next time.
+		// Call when an immobile unit has been placed or removed.
+		//
+		void InvalidatePathHierarchy(int start_x, int start_y, int end_x, int end_y);
+	}
+}
+
+#ifdef DEBUG_DEP
+#warning "aipathhierarchy.h-end"
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Incremental repair of paths that got blocked.
+ *
+ * When a building is placed on the path of a unit, the unit notices
+ * once it tries to step onto it, and asks for a new path to the same
+ * goal. Most of the old path is usually still fine, so instead of
+ * searching all the way to the goal again, what is left of the old
+ * path is kept here until a pathfinding thread picks up the request.
+ * The thread then only searches for a way around the blocked part,
+ * rejoining the old path after it.
+ *
+ * Paths are only stored for a short while; if a request is not
+ * picked up within PATHREPAIR_MAX_AGE frames, it is thrown away.
+ *
+ * The same mechanism lets units moving as a group follow the path
+ * calculated for their leader; see aigrouppath.cpp.
+ */
+
+#include "aipathrepair.h"
+
+#include "aipathfinding.h"
+#include "unit.h"
+#include "sdlheader.h"
+#include <map>
+
+// Shorter paths are cheap enough to calculate from scratch
+#define PATHREPAIR_MIN_LENGTH 24
+#define PATHREPAIR_MAX_AGE 100
+
+using namespace std;
+
+namespace Game
+{
+	namespace AI
+	{
+		struct RepairPath
+		{
+			int goalX, goalY;
+			Uint32 frame;
+			bool shared; // Calculated for another unit
+			vector<Dimension::IntPosition> path;
+		};
+
+		map<int, RepairPath> repairPaths; // Indexed by unit handle
+		SDL_mutex*           gpmxRepairPath = NULL;
+
+		void ForgetOldRepairPaths()
+		{
+			map<int, RepairPath>::iterator it = repairPaths.begin();
+			while (it != repairPaths.end())
+			{
+				if (currentFrame - it->second.frame > PATHREPAIR_MAX_AGE)
+				{
+					repairPaths.erase(it++);
+				}
+				else
+				{
+					it++;
+				}
+			}
+		}
+
+		void StoreRepairPath(const gc_ptr<Dimension::Unit>& unit, int start_x, int start_y, int goal_x, int goal_y, UnitAction action)
+		{
+			const gc_ptr<MovementData>& md = unit->pMovementData;
+			vector<Dimension::IntPosition> path;
+
+			if (gpmxRepairPath == NULL)
+			{
+				return;
+			}
+
+			// Goals that are units move, and other actions may be completed before the goal is reached
+			if (md->pPath && !md->action.goal.unit && md->action.action == action &&
+			    (action == ACTION_GOTO || action == ACTION_MOVE_ATTACK) &&
+			    md->pPath->Goal().x == goal_x && md->pPath->Goal().y == goal_y)
+			{
+				Path* old_path = md->pPath;
+				int i = 0;
+				while (i < old_path->numNodes && (old_path->nodes[i].x != start_x || old_path->nodes[i].y != start_y))
+				{
+					i++;
+				}
+
+				for (; i < old_path->numNodes; i++)
+				{
+					path.push_back(Dimension::IntPosition(old_path->nodes[i].x, old_path->nodes[i].y));
+				}
+			}
+
+			SDL_LockMutex(gpmxRepairPath);
+
+			ForgetOldRepairPaths();
+
+			if (path.size() >= PATHREPAIR_MIN_LENGTH)
+			{
+				RepairPath& repair = repairPaths[unit->GetHandle()];
+				repair.goalX = goal_x;
+				repair.goalY = goal_y;
+				repair.frame = currentFrame;
+				repair.shared = false;
+				repair.path.swap(path);
+			}
+			else
+			{
+				repairPaths.erase(unit->GetHandle());
+			}
+
+			SDL_UnlockMutex(gpmxRepairPath);
+		}
+
+		void StoreSharedPath(const gc_ptr<Dimension::Unit>& unit, int goal_x, int goal_y, vector<Dimension::IntPosition>& path)
+		{
+			if (gpmxRepairPath == NULL || path.empty())
+			{
+				return;
+			}
+
+			SDL_LockMutex(gpmxRepairPath);
+
+			ForgetOldRepairPaths();
+
+			RepairPath& repair = repairPaths[unit->GetHandle()];
+			repair.goalX = goal_x;
+			repair.goalY = goal_y;
+			repair.frame = currentFrame;
+			repair.shared = true;
+			repair.path.swap(path);
+
+			SDL_UnlockMutex(gpmxRepairPath);
+		}
+
+		bool TakeRepairPath(const gc_ptr<Dimension::Unit>& unit, int start_x, int start_y, int goal_x, int goal_y, vector<Dimension::IntPosition>& path, bool& shared)
+		{
+			bool found = false;
+
+			if (gpmxRepairPath == NULL)
+			{
+				return false;
+			}
+
+			SDL_LockMutex(gpmxRepairPath);
+
+			map<int, RepairPath>::iterator it = repairPaths.find(unit->GetHandle());
+			if (it != repairPaths.end())
+			{
+				RepairPath& repair = it->second;
+				if (repair.goalX == goal_x && repair.goalY == goal_y &&
+				    (repair.shared || (repair.path[0].x == start_x && repair.path[0].y == start_y)))
+				{
+					path.swap(repair.path);
+					shared = repair.shared;
+					found = true;
+				}
+				repairPaths.erase(it);
+			}
+
+			SDL_UnlockMutex(gpmxRepairPath);
+
+			return found;
+		}
+
+		void InitPathRepair()
+		{
+			if (gpmxRepairPath != NULL)
+			{
+				return;
+			}
+
+			gpmxRepairPath = SDL_CreateMutex();
+		}
+
+		void QuitPathRepair()
+		{
+			if (gpmxRepairPath == NULL)
+			{
+				return;
+			}
+
+			repairPaths.clear();
+
+			SDL_DestroyMutex(gpmxRepairPath);
+			gpmxRepairPath = NULL;
+		}
+	}
+}
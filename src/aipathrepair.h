@@ -0,0 +1,82 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AIPATHREPAIR_H
+#define AIPATHREPAIR_H
+
+#ifdef DEBUG_DEP
+#warning "aipathrepair.h"
+#endif
+
+#include "dimension-pre.h"
+#include "unit-pre.h"
+#include "aibase-pre.h"
+
+#include <vector>
+
+namespace Game
+{
+	namespace AI
+	{
+		//
+		// Prepare the store of paths awaiting repair.
+		//
+		void InitPathRepair();
+
+		//
+		// Free all stored paths.
+		//
+		void QuitPathRepair();
+
+		//
+		// Remember what is left of the unit's current path, if the new command
+		// given to it is to continue to the same goal from a square on that path,
+		// so that the pathfinding thread can replan only the part that got
+		// blocked. Otherwise, any path stored earlier for the unit is forgotten.
+		//
+		// Must be called from the main thread, as it reads the unit's path.
+		//
+		void StoreRepairPath(const gc_ptr<Dimension::Unit>& unit, int start_x, int start_y, int goal_x, int goal_y, UnitAction action);
+
+		//
+		// Remember a path to the goal that was calculated for another unit, so
+		// that the pathfinding thread only has to find a way onto it. Unlike
+		// paths stored by StoreRepairPath(), it need not start where the unit is.
+		// The contents of path are taken over.
+		//
+		void StoreSharedPath(const gc_ptr<Dimension::Unit>& unit, int goal_x, int goal_y, std::vector<Dimension::IntPosition>& path);
+
+		//
+		// Take the path stored for the unit by StoreRepairPath() or
+		// StoreSharedPath(), if it still ends at the goal and, unless shared is
+		// set, starts at the start. The path, ending with the goal, is placed in
+		// path.
+		//
+		// Safe to call from any pathfinding thread.
+		//
+		bool TakeRepairPath(const gc_ptr<Dimension::Unit>& unit, int start_x, int start_y, int goal_x, int goal_y, std::vector<Dimension::IntPosition>& path, bool& shared);
+	}
+}
+
+#ifdef DEBUG_DEP
+#warning "aipathrepair.h-end"
+#endif
+
+#endif
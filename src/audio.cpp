@@ -876,7 +876,7 @@ namespace Audio
 			{
 				if (!it->pSpeaker)
 				{
-					it->position = Game::Dimension::GetTerrainCoord(it->pSpeaker->pos.x, it->pSpeaker->pos.y);
+					it->position = Game::Dimension::GetTerrainCoord(it->pSpeaker->GetPosition().x, it->pSpeaker->GetPosition().y);
 
 					if (it->pSpeaker->owner != Game::Dimension::currentPlayerView)
 					{
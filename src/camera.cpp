@@ -108,7 +108,7 @@ namespace Game
 		void Camera::SetCamera(const gc_ptr<Unit>& unit, GLfloat zoom, GLfloat rotation)
 		{
 			SDL_LockMutex(cameraMutex);
-			mFocus = GetTerrainCoord(unit->pos.x, unit->pos.y);
+			mFocus = GetTerrainCoord(unit->GetPosition().x, unit->GetPosition().y);
 			mZoom = zoom;
 			mRotation = rotation;
 			CheckPosition();
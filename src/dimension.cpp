@@ -396,7 +396,7 @@ namespace Game
 					for (unsigned i = 0; i < pWorld->vUnits.size(); )
 					{
 						const gc_ptr<Unit>& unit = pWorld->vUnits[i];
-						if (unit->type == *it && unit->isDisplayed)
+						if (unit->type == *it && unit->IsDisplayed())
 						{
 #ifdef CHECKSUM_DEBUG_HIGH
 							Networking::checksum_output << "EMER " << AI::currentFrame << ": " << unit->GetHandle() << " " << (*it)->name << "\n";
@@ -408,7 +408,7 @@ namespace Game
 								break;
 							}
 						}
-						if (!pGame->input.GetKeyState(SDLK_LSHIFT) && unit->health < unit->type->maxHealth && canRepair)
+						if (!pGame->input.GetKeyState(SDLK_LSHIFT) && unit->GetHealth() < unit->type->maxHealth && canRepair)
 						{
 							action = AI::ACTION_BUILD;
 						}
@@ -1477,7 +1477,7 @@ namespace Game
 				}
 
 				Health->SetMax((float)pUnit->type->maxHealth);
-				Health->SetValue(pUnit->health);
+				Health->SetValue(pUnit->GetHealth());
 				SetVisible(idHealth, true);
 
 				if(pUnit->owner->type == Dimension::PLAYER_TYPE_HUMAN)
@@ -1517,7 +1517,7 @@ namespace Game
 		{
 			if(pUnit)
 			{
-				Health->SetValue(pUnit->health);
+				Health->SetValue(pUnit->GetHealth());
 			}
 		}
 
@@ -1819,7 +1819,7 @@ namespace Game
 					const gc_ptr<Dimension::Unit>& target = pUnit->pMovementData->action.goal.unit;
 					if((unsigned) id < pUnit->type->canBuild.size() && pUnit->type->canBuild.at(id) == target->type)
 					{
-						if (!target->isCompleted)
+						if (!target->IsCompleted())
 						{
 							stringstream status;
 							int size = pUnit->actionQueue.size();
@@ -0,0 +1,319 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Open list microbenchmark.
+ *
+ * Runs the same A* searches over a seeded random grid once with the
+ * binary heap from binaryheap.h and once with the 4-ary heap from
+ * quadheap.h, and prints the time spent and the number of heap
+ * operations for each. Scores are formed like in aipathfinding.cpp,
+ * as (f<<16)+h with small integer step costs, and the sum of the path
+ * costs is printed as well, which must be equal for both heaps.
+ *
+ * Usage:
+ *   nightfall-heapbench [--size <n>] [--searches <n>] [--seed <n>]
+ */
+
+#include "sdlheader.h"
+
+#define BINARY_HEAP_DATATYPE int
+#include "binaryheap.h"
+#define QUAD_HEAP_DATATYPE int
+#include "quadheap.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+
+using namespace std;
+
+namespace
+{
+	// Step costs, like GetTraversalTime() gives for a unit walking straight and diagonally
+	const int STRAIGHT_COST = 10;
+	const int DIAGONAL_COST = 14;
+
+	// Chance in percent for a square to be blocked
+	const int BLOCKED_PERCENT = 25;
+
+	struct Random
+	{
+		Uint32 state;
+
+		Random(Uint32 seed) : state(seed ? seed : 1)
+		{
+		}
+
+		Uint32 Next()
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+	};
+
+	struct Grid
+	{
+		int size;
+		std::vector<unsigned char> cost; // Cost multiplier per square; 0 if blocked
+	};
+
+	struct BinaryHeap
+	{
+		binary_heap_t* heap;
+		std::vector<Uint32> scores;
+		std::vector<int> data;
+		std::vector<int> positions;
+
+		BinaryHeap(int max_items) : scores(max_items), data(max_items), positions(max_items)
+		{
+			heap = binary_heap_create(&scores[0], &data[0], &positions[0]);
+		}
+
+		~BinaryHeap()
+		{
+			binary_heap_destroy(heap);
+		}
+
+		void Push(int item, Uint32 score) { binary_heap_push_item(heap, item, score); }
+		int Pop() { return binary_heap_pop_item(heap, -1); }
+		void Lower(int item, Uint32 score) { binary_heap_lower_item_score(heap, item, score); }
+		void Clear() { binary_heap_pop_all(heap); }
+	};
+
+	struct QuadHeap
+	{
+		quad_heap_t* heap;
+		std::vector<int> positions;
+
+		QuadHeap(int max_items) : positions(max_items)
+		{
+			heap = quad_heap_create(max_items, &positions[0]);
+		}
+
+		~QuadHeap()
+		{
+			quad_heap_destroy(heap);
+		}
+
+		void Push(int item, Uint32 score) { quad_heap_push_item(heap, item, score); }
+		int Pop() { return quad_heap_pop_item(heap, -1); }
+		void Lower(int item, Uint32 score) { quad_heap_lower_item_score(heap, item, score); }
+		void Clear() { quad_heap_pop_all(heap); }
+	};
+
+	struct Result
+	{
+		double seconds;
+		Uint64 pushes, pops, lowers;
+		Uint64 totalCost;
+		int found;
+	};
+
+	int Heuristic(int x, int y, int goal_x, int goal_y)
+	{
+		int dx = abs(x - goal_x), dy = abs(y - goal_y);
+		if (dx < dy)
+		{
+			return dx * DIAGONAL_COST + (dy - dx) * STRAIGHT_COST;
+		}
+		return dy * DIAGONAL_COST + (dx - dy) * STRAIGHT_COST;
+	}
+
+	template <typename Heap>
+	Result RunSearches(const Grid& grid, const std::vector<int>& endpoints)
+	{
+		const int num_squares = grid.size * grid.size;
+		const int dirs[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+		std::vector<int> g(num_squares);
+		std::vector<unsigned char> state(num_squares); // 0 = unvisited, 1 = open, 2 = closed
+		Heap heap(num_squares);
+		Result result;
+		clock_t start;
+
+		memset(&result, 0, sizeof(result));
+		start = clock();
+
+		for (unsigned i = 0; i + 1 < endpoints.size(); i += 2)
+		{
+			int start_square = endpoints[i], goal_square = endpoints[i+1];
+			int goal_x = goal_square % grid.size, goal_y = goal_square / grid.size;
+			int cur;
+
+			memset(&state[0], 0, num_squares);
+			heap.Clear();
+
+			g[start_square] = 0;
+			state[start_square] = 1;
+			heap.Push(start_square, 0);
+			result.pushes++;
+
+			while ((cur = heap.Pop()) != -1)
+			{
+				int x = cur % grid.size, y = cur / grid.size;
+
+				result.pops++;
+				state[cur] = 2;
+				if (cur == goal_square)
+				{
+					result.totalCost += g[cur];
+					result.found++;
+					break;
+				}
+
+				for (int d = 0; d < 8; d++)
+				{
+					int nx = x + dirs[d][0], ny = y + dirs[d][1];
+					int next, new_g, h;
+					Uint32 score;
+
+					if (nx < 0 || ny < 0 || nx >= grid.size || ny >= grid.size)
+					{
+						continue;
+					}
+					next = ny * grid.size + nx;
+					if (!grid.cost[next] || state[next] == 2)
+					{
+						continue;
+					}
+
+					new_g = g[cur] + (dirs[d][0] && dirs[d][1] ? DIAGONAL_COST : STRAIGHT_COST) * grid.cost[next];
+					if (state[next] == 1 && new_g >= g[next])
+					{
+						continue;
+					}
+
+					h = Heuristic(nx, ny, goal_x, goal_y);
+					score = ((Uint32) (new_g + h) << 16) + h;
+					g[next] = new_g;
+					if (state[next] == 1)
+					{
+						heap.Lower(next, score);
+						result.lowers++;
+					}
+					else
+					{
+						state[next] = 1;
+						heap.Push(next, score);
+						result.pushes++;
+					}
+				}
+			}
+		}
+
+		result.seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+		return result;
+	}
+
+	void PrintResult(const char* name, const Result& result)
+	{
+		Uint64 ops = result.pushes + result.pops + result.lowers;
+		cout << name << ": " << result.seconds * 1000.0 << " ms, "
+		     << result.pushes << " pushes, " << result.pops << " pops, " << result.lowers << " lowers, "
+		     << (ops ? result.seconds * 1e9 / ops : 0.0) << " ns/op, "
+		     << result.found << " paths, total cost " << result.totalCost << endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int size = 256, searches = 200;
+	Uint32 seed = 1;
+	Grid grid;
+	std::vector<int> endpoints;
+	Result binary, quad;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && !strcmp(argv[i], "--size"))
+		{
+			size = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && !strcmp(argv[i], "--searches"))
+		{
+			searches = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && !strcmp(argv[i], "--seed"))
+		{
+			seed = (Uint32) atoi(argv[++i]);
+		}
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--size <n>] [--searches <n>] [--seed <n>]" << endl;
+			return 1;
+		}
+	}
+
+	if (size < 2 || searches < 1)
+	{
+		cerr << "Size must be at least 2 and searches at least 1" << endl;
+		return 1;
+	}
+
+	Random random(seed);
+
+	grid.size = size;
+	grid.cost.resize(size * size);
+	for (int i = 0; i < size * size; i++)
+	{
+		if ((int) (random.Next() % 100) < BLOCKED_PERCENT)
+		{
+			grid.cost[i] = 0;
+		}
+		else
+		{
+			grid.cost[i] = 1 + random.Next() % 3;
+		}
+	}
+
+	for (int i = 0; i < searches; i++)
+	{
+		int from, to;
+		do
+		{
+			from = random.Next() % (size * size);
+		} while (!grid.cost[from]);
+		do
+		{
+			to = random.Next() % (size * size);
+		} while (!grid.cost[to]);
+		endpoints.push_back(from);
+		endpoints.push_back(to);
+	}
+
+	binary = RunSearches<BinaryHeap>(grid, endpoints);
+	quad = RunSearches<QuadHeap>(grid, endpoints);
+
+	PrintResult("binary heap", binary);
+	PrintResult("4-ary heap ", quad);
+
+	if (binary.totalCost != quad.totalCost || binary.found != quad.found)
+	{
+		cerr << "Heaps disagree on the paths found" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
@@ -322,6 +322,22 @@ void ParseArguments(int argc, char** argv)
 				ss >> Game::AI::numLuaAIThreads;
 			}
 		}
+		else if (!strcmp(argv[i], "--simpleai-threads"))
+		{
+			if (++i < argc)
+			{
+				std::stringstream ss(argv[i]);
+				ss >> Game::AI::numSimpleAIThreads;
+			}
+		}
+		else if (!strcmp(argv[i], "--pathfinding-threads"))
+		{
+			if (++i < argc)
+			{
+				std::stringstream ss(argv[i]);
+				ss >> Game::AI::numPathfindingThreads;
+			}
+		}
 		else if (!strcmp(argv[i], "--config-file"))
 		{
 			if (++i < argc)
@@ -360,90 +360,115 @@ namespace Game
 			return ret;
 		}
 
-		int EncodePath(AI::Node* pGoal, Uint8* data, int max_size)
+		//
+		// Paths are sent as their starting square followed by a list of parts.
+		// A part is either a single step to a neighbouring square, written as
+		// a 0 bit and a 3-bit direction, or a straight line of at least
+		// PATH_MIN_LINE_LENGTH steps, written as a 1 bit and the distance
+		// along each axis. The receiver recreates the squares of a line with
+		// AI::LineSquare(), so only lines that cover exactly the squares of
+		// the path are used. Smoothed paths mostly consist of such lines.
+		//
+
+#define PATH_LINE_BITS 5
+#define PATH_MAX_LINE_LENGTH ((1 << (PATH_LINE_BITS - 1)) - 1)
+// Shorter lines take more bits than single steps
+#define PATH_MIN_LINE_LENGTH 3
+
+		// The number of steps from the given square that a straight line covers exactly
+		int GetLineLengthInPath(AI::Path* path, int from)
 		{
-			AI::Node* curnode = pGoal;
+			AI::Node* nodes = path->nodes;
+			int best = 0;
+
+			for (int length = PATH_MIN_LINE_LENGTH; length <= PATH_MAX_LINE_LENGTH && from + length < path->numNodes; length++)
+			{
+				int dx = nodes[from + length].x - nodes[from].x;
+				int dy = nodes[from + length].y - nodes[from].y;
+				int step;
+
+				if (AI::LineLength(dx, dy) != length)
+				{
+					continue;
+				}
+
+				for (step = 1; step < length; step++)
+				{
+					AI::Node square = AI::LineSquare(nodes[from], dx, dy, step);
+					if (square.x != nodes[from + step].x || square.y != nodes[from + step].y)
+					{
+						break;
+					}
+				}
+
+				if (step == length)
+				{
+					best = length;
+				}
+			}
+
+			return best;
+		}
+
+		int EncodePath(AI::Path* path, Uint8* data, int max_size)
+		{
+			AI::Node* nodes = path->nodes;
 			BitStream bitstream(data, max_size);
 			int len;
-			int numsteps = 0;
+			int numparts = 0;
 			int stepcodes[3][3] = {{0, 1, 2},
 			                       {7,-1, 3},
 			                       {6, 5, 4}};
 
 			bitstream.Seek(12);
-			bitstream.WriteInteger(12, pGoal->x);
-			bitstream.WriteInteger(12, pGoal->y);
+			bitstream.WriteInteger(12, path->Start().x);
+			bitstream.WriteInteger(12, path->Start().y);
 
-			while (curnode->pParent)
+			for (int i = 0; i < path->numNodes - 1; )
 			{
-				int stepcode = -1;
-				if (fabs((float)curnode->pParent->x - curnode->x) <= 1 && fabs((float)curnode->pParent->y - curnode->y) <= 1)
-				{
-					stepcode = stepcodes[(curnode->pParent->y - curnode->y)+1][(curnode->pParent->x - curnode->x)+1];
-				}
-				if (stepcode != -1)
+				int line_length = GetLineLengthInPath(path, i);
+				if (line_length)
 				{
-					bitstream.WriteInteger(3, stepcode);
+					bitstream.WriteBit(1);
+					bitstream.WriteInteger(PATH_LINE_BITS, nodes[i + line_length].x - nodes[i].x);
+					if (!bitstream.WriteInteger(PATH_LINE_BITS, nodes[i + line_length].y - nodes[i].y))
+					{
+						return 0;
+					}
+					i += line_length;
 				}
 				else
 				{
-					return 0;
+					int stepcode = -1;
+					if (abs(nodes[i+1].x - nodes[i].x) <= 1 && abs(nodes[i+1].y - nodes[i].y) <= 1)
+					{
+						stepcode = stepcodes[(nodes[i+1].y - nodes[i].y)+1][(nodes[i+1].x - nodes[i].x)+1];
+					}
+					if (stepcode == -1)
+					{
+						return 0;
+					}
+					bitstream.WriteBit(0);
+					if (!bitstream.WriteInteger(3, stepcode))
+					{
+						return 0;
+					}
+					i++;
 				}
-				numsteps++;
-				curnode = curnode->pParent;
+				numparts++;
 			}
 
 			len = bitstream.BytesUsed();
 			bitstream.Seek(data);
-			bitstream.WriteInteger(12, numsteps);
+			bitstream.WriteInteger(12, numparts);
 
 			return len;
 		}
 
-		void DeallocPath(AI::Node *pGoal)
+		int DecodePath(AI::Path *&path, Uint8* data, int max_size)
 		{
-			delete[] pGoal;
-		}
-
-		void ClonePath(AI::Node *&pStart, AI::Node *&pGoal)
-		{
-			AI::Node *new_nodes, *new_start, *new_cur, *cur, *new_last;
-			int num_nodes = 0, i;
-			cur = pGoal;
-			while (cur)
-			{
-				num_nodes++;
-				cur = cur->pParent;
-			}
-			new_nodes = new AI::Node[num_nodes];
-
-			new_cur = &new_nodes[0];
-			new_start = new_cur;
-			cur = pGoal;
-			new_last = NULL;
-			i = 1;
-			while (cur)
-			{
-				new_cur->x = cur->x;
-				new_cur->y = cur->y;
-				cur = cur->pParent;
-				new_last = new_cur;
-				if (cur)
-				{
-					new_cur = &new_nodes[i++];
-					new_cur->pChild = new_last;
-					new_last->pParent = new_cur;
-				}
-			}
-			pStart = new_cur;
-			pGoal = new_start;
-		}
-
-		int DecodePath(AI::Node *&pStart, AI::Node *&pGoal, Uint8* data, int max_size)
-		{
-			AI::Node *new_nodes, *curnode, *lastnode;
 			BitStream bitstream(data, max_size);
-			int numsteps = bitstream.ReadInteger(12);
+			int numparts = bitstream.ReadInteger(12);
 			int stepcodes[8][2] = {{-1, -1},
 			                       { 0, -1},
 			                       { 1, -1},
@@ -452,40 +477,68 @@ namespace Game
 			                       { 0,  1},
 			                       {-1,  1},
 			                       {-1,  0}};
+			vector<AI::Node> squares;
+			AI::Node start;
 
-			new_nodes = new AI::Node[numsteps+1];
-
-			curnode = &new_nodes[0];
-			pGoal = curnode;
+			if (numparts == -1)
+			{
+				path = NULL;
+				return ERROR_GENERAL;
+			}
 
-			curnode->x = bitstream.ReadInteger(12);
-			curnode->y = bitstream.ReadInteger(12);
+			start.x = bitstream.ReadInteger(12);
+			start.y = bitstream.ReadInteger(12);
 
-			if (curnode->x == -1 || curnode->y == -1 || numsteps == -1)
+			if (start.x == -1 || start.y == -1)
 			{
-				DeallocPath(pGoal);
-				pStart = NULL;
+				path = NULL;
 				return ERROR_GENERAL;
 			}
 
-			for (int i = 0; i < numsteps; i++)
+			squares.push_back(start);
+
+			for (int i = 0; i < numparts; i++)
 			{
-				int stepcode = bitstream.ReadInteger(3);
-				if (stepcode == -1)
+				AI::Node from = squares.back();
+				int is_line = bitstream.ReadBit();
+				if (is_line == 1)
+				{
+					int dx = bitstream.ReadInteger(PATH_LINE_BITS);
+					int dy = bitstream.ReadInteger(PATH_LINE_BITS);
+					if (dx == -1 || dy == -1)
+					{
+						path = NULL;
+						return ERROR_GENERAL;
+					}
+
+					// Sign extend
+					dx = (dx ^ (1 << (PATH_LINE_BITS - 1))) - (1 << (PATH_LINE_BITS - 1));
+					dy = (dy ^ (1 << (PATH_LINE_BITS - 1))) - (1 << (PATH_LINE_BITS - 1));
+
+					for (int step = 1; step <= AI::LineLength(dx, dy); step++)
+					{
+						squares.push_back(AI::LineSquare(from, dx, dy, step));
+					}
+				}
+				else
 				{
-					DeallocPath(pGoal);
-					pGoal = NULL;
-					return ERROR_GENERAL;
+					int stepcode = is_line == 0 ? bitstream.ReadInteger(3) : -1;
+					if (stepcode == -1)
+					{
+						path = NULL;
+						return ERROR_GENERAL;
+					}
+					from.x += stepcodes[stepcode][0];
+					from.y += stepcodes[stepcode][1];
+					squares.push_back(from);
 				}
-				lastnode = curnode;
-				curnode = &new_nodes[i+1];
-				curnode->x = lastnode->x + stepcodes[stepcode][0];
-				curnode->y = lastnode->y + stepcodes[stepcode][1];
-				lastnode->pParent = curnode;
-				curnode->pChild = lastnode;
 			}
 
-			pStart = curnode;
+			path = AI::AllocPath(squares.size());
+			for (unsigned i = 0; i < squares.size(); i++)
+			{
+				path->nodes[i] = squares[i];
+			}
 
 			return SUCCESS;
 		}
@@ -529,19 +582,17 @@ namespace Game
 			SDL_UnlockMutex(prepareActionMutex);
 		}
 
-		void PreparePath(const gc_ptr<Dimension::Unit>& unit, AI::Node* pStart, AI::Node* pGoal)
+		void PreparePath(const gc_ptr<Dimension::Unit>& unit, AI::Path* new_path)
 		{
 			NetPath* path = new NetPath;
-			ClonePath(pStart, pGoal);
 			path->unit_id = unit->GetIndependentHandle();
-			path->pStart = pStart;
-			path->pGoal = pGoal;
+			path->path = AI::ClonePath(new_path);
 			path->valid_at_frame = AI::currentFrame + netDelay;
 			if (networkType == SERVER)
 			{
 				NetPath* path_copy = new NetPath;
 				*path_copy = *path;
-				ClonePath(path_copy->pStart, path_copy->pGoal);
+				path_copy->path = AI::ClonePath(path_copy->path);
 				waitingPaths.push_back(path_copy);
 			}
 			unsentPaths.push_back(path);
@@ -1206,6 +1257,11 @@ namespace Game
 							{
 								Dimension::ActionArguments args = actiondata->arg != 0xFFFF ? actiondata->arg + Dimension::HandleTraits<Dimension::UnitType>::base : -1;
 								AI::ApplyAction(unit, actiondata->action, actiondata->x, actiondata->y, target, args, ByteToRotation(actiondata->rot));
+								if (!unit->owner->isRemote)
+								{
+									// Only the owner calculates the path, and sends it on like any other
+									Dimension::ChangePath(unit, actiondata->x, actiondata->y, actiondata->action, target, args, ByteToRotation(actiondata->rot), AI::PATHPRIORITY_REMOTE_COMMAND);
+								}
 #ifdef CHECKSUM_DEBUG_HIGH
 								checksum_output << "ActionData chunk on frame " << AI::currentFrame << "\n";
 								checksum_output << actiondata->unit_id << " " << actiondata->goalunit_id << " " << actiondata->action << " " << actiondata->x << " " << actiondata->y << " " << actiondata->arg << " " << unit << " " << target << " " << (target ? target->pMovementData->action.action : -1) << " " << "\n";
@@ -1233,9 +1289,7 @@ namespace Game
 						if (unit)
 						{
 							AI::DeallocPathfindingNodes(unit);
-							unit->pMovementData->pStart = path->pStart;
-							unit->pMovementData->pGoal = path->pGoal;
-							unit->pMovementData->pCurGoalNode = NULL;
+							unit->pMovementData->pPath = path->path;
 #ifdef CHECKSUM_DEBUG_HIGH
 							checksum_output << "Path chunk on frame " << AI::currentFrame << "\n";
 							checksum_output << path->unit_id << "\n";
@@ -2770,8 +2824,8 @@ namespace Game
 			chunk->data = data;
 			APPEND32BIT(data, path->valid_at_frame)
 			APPEND16BIT(data, path->unit_id)
-			len = EncodePath(path->pGoal, data, 1536-6);
-			DeallocPath(path->pGoal);
+			len = EncodePath(path->path, data, 1536-6);
+			AI::FreePath(path->path);
 			if (!len)
 			{
 				delete[] data;
@@ -2796,7 +2850,7 @@ namespace Game
 			path->valid_at_frame = READ32BIT(data);
 			path->unit_id = READ16BIT(data);
 
-			if (DecodePath(path->pStart, path->pGoal, data, chunk->length-6) != SUCCESS)
+			if (DecodePath(path->path, data, chunk->length-6) != SUCCESS)
 			{
 				delete path;
 				return ERROR_GENERAL;
@@ -2806,7 +2860,7 @@ namespace Game
 			{
 				NetPath* path_copy = new NetPath;
 				*path_copy = *path;
-				ClonePath(path_copy->pStart, path_copy->pGoal);
+				path_copy->path = AI::ClonePath(path_copy->path);
 				unsentPaths.push_back(path_copy);
 			}
 			return SUCCESS;
@@ -2981,25 +3035,25 @@ namespace Game
 #ifdef CHECKSUM_DEBUG
 				sstr << (Uint32) floor((float)unit->curAssociatedSquare.y) << " ";
 #endif
-				checksum ^= ((Uint32) floor(unit->health))<<16;
+				checksum ^= ((Uint32) floor(unit->GetHealth()))<<16;
 #ifdef CHECKSUM_DEBUG
-				sstr << (Uint32) floor(unit->health) << " ";
+				sstr << (Uint32) floor(unit->GetHealth()) << " ";
 #endif
-				checksum ^= ((Uint32) floor(unit->power))<<24;
+				checksum ^= ((Uint32) floor(unit->GetPower()))<<24;
 #ifdef CHECKSUM_DEBUG
-				sstr << (Uint32) floor(unit->power) << " ";
+				sstr << (Uint32) floor(unit->GetPower()) << " ";
 #endif
-				checksum ^= unit->isCompleted;
+				checksum ^= unit->IsCompleted();
 #ifdef CHECKSUM_DEBUG
-				sstr << unit->isCompleted << " ";
+				sstr << unit->IsCompleted() << " ";
 #endif
-				checksum ^= unit->isDisplayed<<1;
+				checksum ^= unit->IsDisplayed()<<1;
 #ifdef CHECKSUM_DEBUG
-				sstr << unit->isDisplayed << " ";
+				sstr << unit->IsDisplayed() << " ";
 #endif
-				checksum ^= unit->isMoving<<2;
+				checksum ^= unit->IsMoving()<<2;
 #ifdef CHECKSUM_DEBUG
-				sstr << unit->isMoving << " ";
+				sstr << unit->IsMoving() << " ";
 #endif
 				checksum ^= unit->isLighted<<3;
 #ifdef CHECKSUM_DEBUG
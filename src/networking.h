@@ -54,8 +54,7 @@ namespace Game
 		struct NetPath
 		{
 			Uint16 unit_id;
-			AI::Node *pStart;
-			AI::Node *pGoal;
+			AI::Path *path;
 			Uint32 valid_at_frame;
 		};
 		
@@ -84,7 +83,7 @@ namespace Game
 		};
 		
 		void PrepareAction(const gc_ptr<Dimension::Unit>& unit, const gc_ptr<Dimension::Unit>& target, int x, int y, AI::UnitAction action, const Dimension::ActionArguments& args, float rotation);
-		void PreparePath(const gc_ptr<Dimension::Unit>& unit, AI::Node* pStart, AI::Node* pGoal);
+		void PreparePath(const gc_ptr<Dimension::Unit>& unit, AI::Path* path);
 		void PrepareCreation(const gc_ptr<Dimension::UnitType>& unittype, int x, int y, float rot);
 		void PrepareDamaging(const gc_ptr<Dimension::Unit>& unit, float damage);
 		void PrepareSell(const gc_ptr<Dimension::Player>& owner, int amount);
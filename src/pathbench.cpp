@@ -0,0 +1,389 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Headless pathfinding benchmark.
+ *
+ * Loads a level without graphics, spreads a mix of unit types over the
+ * map and keeps the pathfinding threads busy with paths to random goals,
+ * picked from a seeded generator so that runs can be compared. When all
+ * requests have been answered, throughput and time-to-path percentiles
+ * are printed per movement type.
+ *
+ * Usage:
+ *   nightfall-pathbench [--level <name>] [--units <type>:<count>[,...]]
+ *                       [--requests <n>] [--seed <n>] [--pathfinding-threads <n>]
+ *
+ * The level's own units are left where its script puts them, and act
+ * as obstacles. Time-to-path is measured in milliseconds from the call
+ * to CommandPathfinding() until the path has been applied to the unit.
+ */
+
+#include "game.h"
+#include "window.h"
+#include "font.h"
+#include "paths.h"
+#include "configuration.h"
+#include "dimension.h"
+#include "unit.h"
+#include "unittype.h"
+#include "unitsquares.h"
+#include "aipathfinding.h"
+#include "randomgenerator.h"
+#include "sdlheader.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+
+using namespace Game;
+using namespace std;
+
+namespace
+{
+	// How many times to try to find a free square for a unit before giving up on it
+	const int PLACEMENT_ATTEMPTS = 1000;
+
+	const char* movementTypeNames[Dimension::MOVEMENT_TYPES_NUM] = {
+		"human",
+		"small vehicle",
+		"medium vehicle",
+		"large vehicle",
+		"building",
+		"airborne",
+		"sea"
+	};
+
+	struct BenchRequest
+	{
+		gc_ptr<Dimension::Unit> unit;
+		int goalX, goalY;
+		Uint32 startTime;
+	};
+
+	struct MovementTypeStats
+	{
+		int numComplete;
+		int numPartial;
+		int numFailed;
+		vector<Uint32> times;
+
+		MovementTypeStats() : numComplete(0), numPartial(0), numFailed(0) {}
+	};
+
+	string levelName = "default";
+	string unitMix = "";
+	int numRequests = 1000;
+	unsigned long seed = 1;
+
+	void ParseArguments(int argc, char** argv)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (!strcmp(argv[i], "--level") && i+1 < argc)
+			{
+				levelName = argv[++i];
+			}
+			else if (!strcmp(argv[i], "--units") && i+1 < argc)
+			{
+				unitMix = argv[++i];
+			}
+			else if (!strcmp(argv[i], "--requests") && i+1 < argc)
+			{
+				stringstream ss(argv[++i]);
+				ss >> numRequests;
+			}
+			else if (!strcmp(argv[i], "--seed") && i+1 < argc)
+			{
+				stringstream ss(argv[++i]);
+				ss >> seed;
+			}
+			else if (!strcmp(argv[i], "--pathfinding-threads") && i+1 < argc)
+			{
+				stringstream ss(argv[++i]);
+				ss >> AI::numPathfindingThreads;
+			}
+			else
+			{
+				cout << "Unknown argument " << argv[i] << endl;
+			}
+		}
+	}
+
+	gc_ptr<Dimension::UnitType> FindUnitType(const string& id)
+	{
+		for (vector<gc_ptr<Dimension::Player> >::iterator it = Dimension::pWorld->vPlayers.begin(); it != Dimension::pWorld->vPlayers.end(); it++)
+		{
+			map<string, gc_ptr<Dimension::UnitType> >::iterator type = (*it)->unitTypeMap.find(id);
+			if (type != (*it)->unitTypeMap.end() && type->second)
+			{
+				return type->second;
+			}
+		}
+		return NULL;
+	}
+
+	//
+	// Place the units of the mix, given as a comma separated list of
+	// <unit type id>:<count>, at random free squares.
+	//
+	int PlaceUnits(MTRand& rand, vector<gc_ptr<Dimension::Unit> >& units)
+	{
+		stringstream mix(unitMix);
+		string entry;
+
+		while (getline(mix, entry, ','))
+		{
+			string::size_type colon = entry.find(':');
+			string id = entry.substr(0, colon);
+			int count = 1;
+			gc_ptr<Dimension::UnitType> type = FindUnitType(id);
+
+			if (colon != string::npos)
+			{
+				stringstream ss(entry.substr(colon+1));
+				ss >> count;
+			}
+
+			if (!type)
+			{
+				cout << "No unit type with id " << id << " found" << endl;
+				return ERROR_GENERAL;
+			}
+
+			if (!type->isMobile)
+			{
+				cout << "Unit type " << id << " can not move" << endl;
+				return ERROR_GENERAL;
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				gc_ptr<Dimension::Unit> unit;
+				for (int j = 0; j < PLACEMENT_ATTEMPTS && !unit; j++)
+				{
+					int x = rand.randInt(Dimension::pWorld->width - 1);
+					int y = rand.randInt(Dimension::pWorld->height - 1);
+					unit = Dimension::CreateUnit(type, x, y);
+				}
+				if (unit)
+				{
+					units.push_back(unit);
+				}
+				else
+				{
+					cout << "Found no room for unit " << i << " of type " << id << endl;
+				}
+			}
+		}
+
+		Dimension::DisplayScheduledUnits();
+
+		return SUCCESS;
+	}
+
+	Uint32 Percentile(const vector<Uint32>& sorted_times, int percent)
+	{
+		if (sorted_times.empty())
+		{
+			return 0;
+		}
+		return sorted_times[(sorted_times.size() - 1) * percent / 100];
+	}
+
+	void RunBenchmark(MTRand& rand, vector<gc_ptr<Dimension::Unit> >& units)
+	{
+		vector<BenchRequest> pending;
+		vector<gc_ptr<Dimension::Unit> > idle = units;
+		MovementTypeStats stats[Dimension::MOVEMENT_TYPES_NUM];
+		int numIssued = 0, numAnswered = 0;
+		int calcs_before = AI::cCount;
+		Uint32 bench_start = SDL_GetTicks(), bench_time;
+
+		while (numAnswered < numRequests)
+		{
+			while (numIssued < numRequests && idle.size())
+			{
+				BenchRequest request;
+				request.unit = idle.back();
+				request.goalX = rand.randInt(Dimension::pWorld->width - 1);
+				request.goalY = rand.randInt(Dimension::pWorld->height - 1);
+				request.startTime = SDL_GetTicks();
+				idle.pop_back();
+
+				AI::CommandPathfinding(request.unit, request.unit->curAssociatedSquare.x, request.unit->curAssociatedSquare.y, request.goalX, request.goalY);
+				pending.push_back(request);
+				numIssued++;
+			}
+
+			SDL_Delay(1);
+
+			AI::ApplyAllNewPaths();
+
+			for (unsigned i = 0; i < pending.size(); i++)
+			{
+				BenchRequest& request = pending[i];
+				const gc_ptr<Dimension::Unit>& unit = request.unit;
+
+				if (AI::IsUndergoingPathCalc(unit))
+				{
+					continue;
+				}
+
+				MovementTypeStats& type_stats = stats[unit->type->movementType];
+				AI::Path* path = unit->pMovementData->pPath;
+
+				type_stats.times.push_back(SDL_GetTicks() - request.startTime);
+
+				if (!path)
+				{
+					type_stats.numFailed++;
+				}
+				else if (path->Goal().x == request.goalX && path->Goal().y == request.goalY)
+				{
+					type_stats.numComplete++;
+				}
+				else
+				{
+					type_stats.numPartial++;
+				}
+
+				// The units stay where they are, as no AI frames are run
+				AI::DeallocPathfindingNodes(unit);
+				unit->pMovementData->action.action = AI::ACTION_NONE;
+
+				idle.push_back(unit);
+				pending.erase(pending.begin() + i--);
+				numAnswered++;
+			}
+		}
+
+		bench_time = SDL_GetTicks() - bench_start;
+		if (!bench_time)
+		{
+			bench_time = 1;
+		}
+
+		cout << endl;
+		cout << "Level:               " << levelName << endl;
+		cout << "Seed:                " << seed << endl;
+		cout << "Pathfinding threads: " << AI::numPathfindingThreads << endl;
+		cout << "Units:               " << units.size() << endl;
+		cout << "Requests:            " << numRequests << endl;
+		cout << "Time:                " << bench_time << " ms" << endl;
+		cout << "Paths/sec:           " << (double) numAnswered * 1000 / bench_time << endl;
+		cout << "Nodes expanded/sec:  " << (double) (AI::cCount - calcs_before) * 1000 / bench_time << endl;
+
+		for (int i = 0; i < Dimension::MOVEMENT_TYPES_NUM; i++)
+		{
+			MovementTypeStats& type_stats = stats[i];
+			int num = type_stats.times.size();
+
+			if (!num)
+			{
+				continue;
+			}
+
+			sort(type_stats.times.begin(), type_stats.times.end());
+
+			cout << endl;
+			cout << movementTypeNames[i] << ": " << num << " paths" << endl;
+			cout << "  time-to-path p50/p95/p99: " << Percentile(type_stats.times, 50) << " / "
+			                                       << Percentile(type_stats.times, 95) << " / "
+			                                       << Percentile(type_stats.times, 99) << " ms" << endl;
+			cout << "  reached goal:  " << (double) type_stats.numComplete * 100 / num << "%" << endl;
+			cout << "  partial path:  " << (double) type_stats.numPartial * 100 / num << "%" << endl;
+			cout << "  failed:        " << (double) type_stats.numFailed * 100 / num << "%" << endl;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	vector<gc_ptr<Dimension::Unit> > units;
+
+	Utilities::InitPaths(argv[0]);
+
+	ParseArguments(argc, argv);
+
+	Window::noWindow = true;
+	Rules::noGraphics = true;
+	Rules::noSound = true;
+	Rules::CurrentLevel = levelName;
+
+	if (Window::Init() != SUCCESS)
+	{
+		cerr << "Failed to initialize SDL: " << SDL_GetError() << endl;
+		return ERROR_GENERAL;
+	}
+
+	gc_marker_base::initgc();
+	gc_marker_base::register_static_shader(Window::GUI::FontHandle::static_shade);
+	gc_marker_base::register_static_shader(Window::GUI::Font::static_shade);
+	gc_marker_base::register_static_shader(Window::GUI::TextRenderer::static_shade);
+
+	Utilities::mainConfig.SetFile("config.txt");
+	Utilities::mainConfig.SetRestriction("screen width", new Utilities::ConfigurationFile::TypeRestriction<int>(800));
+	Utilities::mainConfig.SetRestriction("screen height", new Utilities::ConfigurationFile::TypeRestriction<int>(600));
+	Utilities::mainConfig.SetRestriction("screen bpp", new Utilities::ConfigurationFile::TypeRestriction<int>(32));
+	Utilities::mainConfig.SetRestriction("fullscreen", new Utilities::ConfigurationFile::TypeRestriction<int>(0));
+	Utilities::mainConfig.SetRestriction("default font", new Utilities::ConfigurationFile::TypeRestriction<std::string>("vera.ttf"));
+	Utilities::mainConfig.Parse();
+
+	if (Window::OpenDynamic() != SUCCESS)
+	{
+		cerr << "Window subsystem could not be initialized!" << endl;
+		return ERROR_GENERAL;
+	}
+
+	Window::GUI::InitDefaultFont(Utilities::mainConfig.GetValue("default font"));
+
+	if (Rules::CurGame::New()->StartGame() != SUCCESS)
+	{
+		return ERROR_GENERAL;
+	}
+
+	// Units created by the level script are displayed on the first AI frame, which is never run here
+	Dimension::DisplayScheduledUnits();
+
+	MTRand rand(seed);
+
+	if (PlaceUnits(rand, units) != SUCCESS)
+	{
+		return ERROR_GENERAL;
+	}
+
+	if (units.empty())
+	{
+		cout << "No units to benchmark with; use --units <type>:<count>" << endl;
+		return ERROR_GENERAL;
+	}
+
+	RunBenchmark(rand, units);
+
+	units.clear();
+	Rules::CurGame::Instance()->EndGame();
+	SDL_Quit();
+
+	return SUCCESS;
+}
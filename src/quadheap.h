@@ -0,0 +1,157 @@
+/*
+ * Nightfall - Real-time strategy game
+ *
+ * Copyright (c) 2008 Marcus Klang, Alexander Toresson and Leonard Wickmark
+ * 
+ * This file is part of Nightfall.
+ * 
+ * Nightfall is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Nightfall is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Nightfall.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A 4-ary heap, used as the open list of A*.
+ *
+ * Works like the heap in binaryheap.h, but each node has four children
+ * instead of two, which halves the depth of the heap, and the score and
+ * data of an item are kept next to each other, so that comparing the
+ * children of a node touches a single cache line. Items are moved into
+ * the hole left by the item being placed instead of being swapped with
+ * it. positions must have room for the largest data value, and is kept
+ * up to date with where each item is in the heap.
+ */
+
+typedef struct
+{
+	Uint32 score;
+	QUAD_HEAP_DATATYPE data;
+} quad_heap_item_t;
+
+typedef struct
+{
+	quad_heap_item_t *items;
+	int *positions;
+	int num_items;
+} quad_heap_t;
+
+#define QUAD_HEAP_PARENT(x) (((x)-1)>>2)
+#define QUAD_HEAP_FIRST_CHILD(x) (((x)<<2)+1)
+
+quad_heap_t *quad_heap_create(int max_items, int *positions)
+{
+	quad_heap_t *heap = (quad_heap_t*) malloc(sizeof(quad_heap_t));
+	heap->items = (quad_heap_item_t*) malloc(sizeof(quad_heap_item_t) * max_items);
+	heap->positions = positions;
+	heap->num_items = 0;
+	return heap;
+}
+
+void quad_heap_destroy(quad_heap_t *heap)
+{
+	free(heap->items);
+	free(heap);
+}
+
+// Move the item up from the hole at pos until its parent has a lower score
+void quad_heap_sift_up(quad_heap_t *heap, int pos, quad_heap_item_t item)
+{
+	quad_heap_item_t *items = heap->items;
+	int *positions = heap->positions;
+	while (pos != 0)
+	{
+		int parent_pos = QUAD_HEAP_PARENT(pos);
+		if (items[parent_pos].score <= item.score)
+		{
+			break;
+		}
+		items[pos] = items[parent_pos];
+		positions[items[pos].data] = pos;
+		pos = parent_pos;
+	}
+	items[pos] = item;
+	positions[item.data] = pos;
+}
+
+void quad_heap_push_item(quad_heap_t *heap, QUAD_HEAP_DATATYPE new_data, Uint32 score)
+{
+	quad_heap_item_t item;
+	item.score = score;
+	item.data = new_data;
+	quad_heap_sift_up(heap, heap->num_items++, item);
+}
+
+QUAD_HEAP_DATATYPE quad_heap_pop_item(quad_heap_t *heap, QUAD_HEAP_DATATYPE def)
+{
+	quad_heap_item_t *items = heap->items;
+	int *positions = heap->positions;
+	QUAD_HEAP_DATATYPE ret;
+	quad_heap_item_t item;
+	int pos = 0, num_items;
+
+	if (!heap->num_items)
+	{
+		return def;
+	}
+
+	ret = items[0].data;
+	num_items = --heap->num_items;
+	if (!num_items)
+	{
+		return ret;
+	}
+
+	// Move the last item down from the top until its children all have higher scores
+	item = items[num_items];
+	while (1)
+	{
+		int child = QUAD_HEAP_FIRST_CHILD(pos);
+		int end = child + 4 < num_items ? child + 4 : num_items;
+		int best = child;
+		if (child >= num_items)
+		{
+			break;
+		}
+		for (child++; child < end; child++)
+		{
+			if (items[child].score < items[best].score)
+			{
+				best = child;
+			}
+		}
+		if (items[best].score >= item.score)
+		{
+			break;
+		}
+		items[pos] = items[best];
+		positions[items[pos].data] = pos;
+		pos = best;
+	}
+	items[pos] = item;
+	positions[item.data] = pos;
+
+	return ret;
+}
+
+void quad_heap_lower_item_score(quad_heap_t *heap, QUAD_HEAP_DATATYPE altered_data, Uint32 score)
+{
+	quad_heap_item_t item;
+	item.score = score;
+	item.data = altered_data;
+	quad_heap_sift_up(heap, heap->positions[altered_data], item);
+}
+
+void quad_heap_pop_all(quad_heap_t *heap)
+{
+	heap->num_items = 0;
+}
+
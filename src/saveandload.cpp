@@ -176,14 +176,12 @@ namespace Game
 			xmlfile.EndTag();
 		}
 
-		void OutputPath(Utilities::XMLWriter &xmlfile, std::string tag, AI::Node *pGoal, AI::Node *pStart)
+		void OutputPath(Utilities::XMLWriter &xmlfile, std::string tag, AI::Path *path)
 		{
-			AI::Node *cur_node = pGoal;
 			xmlfile.BeginTag(tag);
-				while (cur_node)
+				for (int i = path->numNodes - 1; i >= 0; i--)
 				{
-					OutputIntPosition(xmlfile, "elem", cur_node->x, cur_node->y);
-					cur_node = cur_node->pParent;
+					OutputIntPosition(xmlfile, "elem", path->nodes[i].x, path->nodes[i].y);
 				}
 			xmlfile.EndTag();
 		}
@@ -192,13 +190,13 @@ namespace Game
 		{
 			xmlfile.BeginTag("movementData");
 				OutputActionData(xmlfile, "actionData", &unit->pMovementData->action);
-				if (unit->pMovementData->pCurGoalNode)
+				if (unit->pMovementData->pPath && unit->pMovementData->pPath->cursor != -1)
 				{
-					OutputIntPosition(xmlfile, "curGoalNode", unit->pMovementData->pCurGoalNode->x, unit->pMovementData->pCurGoalNode->y);
+					OutputIntPosition(xmlfile, "curGoalNode", unit->pMovementData->pPath->CurGoal().x, unit->pMovementData->pPath->CurGoal().y);
 				}
-				if (unit->pMovementData->pStart)
+				if (unit->pMovementData->pPath)
 				{
-					OutputPath(xmlfile, "path", unit->pMovementData->pGoal, unit->pMovementData->pStart);
+					OutputPath(xmlfile, "path", unit->pMovementData->pPath);
 				}
 				if (unit->pMovementData->_currentState != AI::INTTHRSTATE_NONE)
 				{
@@ -223,7 +221,7 @@ namespace Game
 
 				OutputString(xmlfile, "type", unit->type->id);
 
-				OutputFloatPosition(xmlfile, "pos", unit->pos.x, unit->pos.y);
+				OutputFloatPosition(xmlfile, "pos", unit->GetPosition().x, unit->GetPosition().y);
 				
 				OutputIntPosition(xmlfile, "curAssociatedSquare", unit->curAssociatedSquare);
 
@@ -234,8 +232,8 @@ namespace Game
 				
 				OutputInt(xmlfile, "faceTarget", unit->faceTarget);
 				
-				OutputFloat(xmlfile, "health", unit->health);
-				OutputFloat(xmlfile, "power", unit->power);
+				OutputFloat(xmlfile, "health", unit->GetHealth());
+				OutputFloat(xmlfile, "power", unit->GetPower());
 				OutputUint32(xmlfile, "lastAttack", unit->lastAttack);
 				OutputUint32(xmlfile, "lastAttacked", unit->lastAttacked);
 				OutputUint32(xmlfile, "lastCommand", unit->lastCommand);
@@ -245,9 +243,9 @@ namespace Game
 				OutputFloat(xmlfile, "completeness", unit->completeness);
 				OutputFloat(xmlfile, "actionCompleteness", unit->action_completeness);
 
-				OutputBool(xmlfile, "isCompleted", unit->isCompleted);
-				OutputBool(xmlfile, "isDisplayed", unit->isDisplayed);
-				OutputBool(xmlfile, "isMoving", unit->isMoving);
+				OutputBool(xmlfile, "isCompleted", unit->IsCompleted());
+				OutputBool(xmlfile, "isDisplayed", unit->IsDisplayed());
+				OutputBool(xmlfile, "isMoving", unit->IsMoving());
 				
 				OutputFloat(xmlfile, "rotation", unit->rotation);
 
@@ -653,7 +651,7 @@ namespace Game
 				unit->rotation = d;
 
 				elem->Iterate("isMoving", ParseBoolBlock);
-				unit->isMoving = b;
+				unit->SetMoving(b);
 				
 				elem->Iterate("action_completeness", ParseDoubleBlock);
 				unit->action_completeness = d;
@@ -661,7 +659,7 @@ namespace Game
 				elem->Iterate("lastSeenPosition", ParseLastSeenPosition);
 
 				elem->Iterate("pos", ParsePosition);
-				unit->pos = pos;
+				unit->SetPosition(pos.x, pos.y);
 
 			}
 			else
@@ -670,10 +668,10 @@ namespace Game
 			}
 			
 			elem->Iterate("health", ParseDoubleBlock);
-			unit->health = d;
+			unit->SetHealth(d);
 
 			elem->Iterate("power", ParseDoubleBlock);
-			unit->power = d;
+			unit->SetPower(d);
 
 			elem->Iterate("completeness", ParseDoubleBlock);
 			unit->completeness = d;
@@ -735,58 +733,48 @@ namespace Game
 
 		void ParsePath(Utilities::XMLElement *elem)
 		{
-			AI::Node *pStart = NULL, *pGoal = NULL, *pCur = NULL, *pLast = NULL;
-
 			elem->Iterate("elem", ParseNode);
 
-			AI::Node *pNodes = new AI::Node[nodes.size()];
-
-			int i = 0;
-			for (std::vector<IntPosition>::iterator it = nodes.begin(); it != nodes.end(); it++, i++)
+			if (nodes.empty())
 			{
-				pCur = &pNodes[i];
-
-				if (!pGoal)
-				{
-					pGoal = pCur;
-				}
-
-				pCur->pChild = pLast;
-
-				pCur->x = it->x;
-				pCur->y = it->y;
+				return;
+			}
 
-				if (pLast)
-				{
-					pLast->pParent = pCur;
-				}
+			// The squares are saved from the goal to the start
+			AI::Path *path = AI::AllocPath(nodes.size());
 
-				pLast = pCur;
+			int i = nodes.size() - 1;
+			for (std::vector<IntPosition>::iterator it = nodes.begin(); it != nodes.end(); it++, i--)
+			{
+				path->nodes[i].x = it->x;
+				path->nodes[i].y = it->y;
 			}
-			pStart = pCur;
 
-			unit->pMovementData->pGoal = pGoal;
-			unit->pMovementData->pStart = pStart;
+			unit->pMovementData->pPath = path;
 
 			nodes.clear();
 		}
 
 		void ParseCurGoalNode(Utilities::XMLElement *elem)
 		{
-			AI::Node *pCur = unit->pMovementData->pGoal;
+			AI::Path *path = unit->pMovementData->pPath;
 			elem->Iterate("x", ParseIntBlock);
 			pos_int.x = i;
 			elem->Iterate("y", ParseIntBlock);
 			pos_int.y = i;
 
-			while (pCur)
+			if (!path)
+			{
+				return;
+			}
+
+			for (int j = path->numNodes - 1; j >= 0; j--)
 			{
-				if (pos_int.x == pCur->x && pos_int.y == pCur->y)
+				if (pos_int.x == path->nodes[j].x && pos_int.y == path->nodes[j].y)
 				{
-					unit->pMovementData->pCurGoalNode = pCur;
+					path->cursor = j;
 					break;
 				}
-				pCur = pCur->pParent;
 			}
 		}
 
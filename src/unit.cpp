@@ -35,6 +35,7 @@
 #include "utilities.h"
 #include "research.h"
 #include <cstdarg>
+#include <algorithm>
 #include <set>
 #include <list>
 #include "hashmap.h"
@@ -64,8 +65,7 @@ namespace Game
 			
 			if (ghost)
 			{
-				ghost->pos.x = goal.pos.x;
-				ghost->pos.y = goal.pos.y;
+				ghost->SetPosition(goal.pos.x, goal.pos.y);
 				ghost->rotation = rotation;
 			}
 		}
@@ -82,7 +82,7 @@ namespace Game
 			if (fx == NULL)
 				return;
 
-			Utilities::Vector3D groundPos = Dimension::GetTerrainCoord(unit->pos.x, unit->pos.y);
+			Utilities::Vector3D groundPos = Dimension::GetTerrainCoord(unit->GetPosition().x, unit->GetPosition().y);
 			Audio::PlayOnceFromLocation(fx->pSound, &fx->channel, groundPos,
 				Game::Dimension::Camera::instance.GetPosVector(),
 				fx->strength);
@@ -98,7 +98,7 @@ namespace Game
 			
 			Audio::AudioFXInfo* inf = unit->type->actionSounds[action];
 			
-			Utilities::Vector3D groundPos = Dimension::GetTerrainCoord(unit->pos.x, unit->pos.y);
+			Utilities::Vector3D groundPos = Dimension::GetTerrainCoord(unit->GetPosition().x, unit->GetPosition().y);
 			unit->soundNodes[action].node = Audio::CreateSoundNode(inf->pSound, groundPos, Utilities::Vector3D(), inf->strength, -1);
 			Audio::SetSpeakerUnit(unit->soundNodes[action].node, unit);
 			unit->soundNodes[action].active = true;
@@ -136,7 +136,7 @@ namespace Game
 			double income = 0;
 			for (vector<gc_ptr<Unit> >::iterator it = player->vUnits.begin(); it != player->vUnits.end(); it++)
 			{
-				if ((*it)->isDisplayed)
+				if ((*it)->IsDisplayed())
 				{
 					gc_ptr<UnitType> unittype = (*it)->type;
 					income += unittype->powerIncrement;
@@ -151,7 +151,7 @@ namespace Game
 			double income = 0;
 			for (vector<gc_ptr<Unit> >::iterator it = player->vUnits.begin(); it != player->vUnits.end(); it++)
 			{
-				if ((*it)->isDisplayed)
+				if ((*it)->IsDisplayed())
 				{
 					gc_ptr<UnitType> unittype = (*it)->type;
 					if (unittype->powerType == POWERTYPE_TWENTYFOURSEVEN)
@@ -243,7 +243,7 @@ namespace Game
 		void FacePos(gc_ptr<Unit>& unit, Position pos)
 		{
 			Utilities::Vector3D direction, zero_rot;
-			direction.set(pos.x - unit->pos.x, 0.0, pos.y - unit->pos.y);
+			direction.set(pos.x - unit->GetPosition().x, 0.0, pos.y - unit->GetPosition().y);
 			direction.normalize();
 			zero_rot.set(-1.0, 0.0, 0.0);
 			unit->rotation = acos(zero_rot.dot(direction)) * (float) (180 / PI);
@@ -252,7 +252,7 @@ namespace Game
 
 		void FaceUnit(gc_ptr<Unit>& unit, const gc_ptr<Unit>& targetUnit)
 		{
-			FacePos(unit, targetUnit->pos);
+			FacePos(unit, targetUnit->GetPosition());
 		}
 
 		void PerformBuild(gc_ptr<Unit>& unit)
@@ -314,7 +314,7 @@ namespace Game
 								{
 									for (int x = start_x; x < start_x + build_type->widthOnMap; x++)
 									{
-										if (x >= 0 && y >= 0 && x < pWorld->width && y < pWorld->height && pppElements[y][x] && !pppElements[y][x]->isMoving)
+										if (x >= 0 && y >= 0 && x < pWorld->width && y < pWorld->height && pppElements[y][x] && !pppElements[y][x]->IsMoving())
 										{
 											if (curtime - pppElements[y][x]->lastCommand > AI::aiFps)
 											{
@@ -351,7 +351,7 @@ namespace Game
 				return;
 			}
 
-			if (unit->type->isMobile && unit->faceTarget != FACETARGET_TARGET && newUnit->isDisplayed)
+			if (unit->type->isMobile && unit->faceTarget != FACETARGET_TARGET && newUnit->IsDisplayed())
 			{
 				FaceUnit(unit, newUnit);
 				unit->faceTarget = FACETARGET_TARGET;
@@ -376,22 +376,22 @@ namespace Game
 			unit->owner->resources.money -= build_cost;
 
 			newUnit->completeness += 100.0f / float(requirements.time * AI::aiFps);
-			newUnit->health += (float) newUnit->type->maxHealth / float(requirements.time * AI::aiFps);
+			newUnit->SetHealth(newUnit->GetHealth() + (float) newUnit->type->maxHealth / float(requirements.time * AI::aiFps));
 
-			if (newUnit->health >= newUnit->type->maxHealth)
+			if (newUnit->GetHealth() >= newUnit->type->maxHealth)
 			{
-				newUnit->health = (float) newUnit->type->maxHealth;
+				newUnit->SetHealth((float) newUnit->type->maxHealth);
 			}
 
 			if (newUnit->completeness >= 100.0)
 			{
 				newUnit->completeness = 100.0;
-				if (newUnit->isCompleted == false)
+				if (newUnit->IsCompleted() == false)
 				{
 #ifdef CHECKSUM_DEBUG_HIGH
 					Networking::checksum_output << "BUILD DONE " << AI::currentFrame << ": " << unit->GetHandle() << " " << newUnit->GetHandle() << "\n";
 #endif
-					newUnit->isCompleted = true;
+					newUnit->SetCompleted(true);
 
  					unit->type->numBuilt++;
  					unit->type->numExisting++;
@@ -526,7 +526,7 @@ namespace Game
 			if (pUnit->pMovementData->action.goal.unit && pUnit->pMovementData->action.goal.unit->pMovementData->action.action != AI::ACTION_DIE)
 			{
 				gc_ptr<Unit> target = pUnit->pMovementData->action.goal.unit;
-				if (!pUnit->pMovementData->action.goal.unit->isDisplayed)
+				if (!pUnit->pMovementData->action.goal.unit->IsDisplayed())
 				{
 					int new_x = pUnit->curAssociatedSquare.x, new_y = pUnit->curAssociatedSquare.y;
 
@@ -576,16 +576,16 @@ namespace Game
 #ifdef CHECKSUM_DEBUG_HIGH
 			Networking::checksum_output << "DAMAGE " << AI::currentFrame << ": " << target->GetHandle() << " " << damage << "\n";
 #endif
-			if (target->health > 1e-3)
+			if (target->GetHealth() > 1e-3)
 			{
 				target->lastAttacked = AI::currentFrame; // only update time of last attack if the unit is not already dead
 			}
-			target->health -= damage;
+			target->SetHealth(target->GetHealth() - damage);
 			if (target->pMovementData->action.action == AI::ACTION_DIE)
 			{
 				return true;
 			}
-			if (target->health <= 1e-3 && target->pMovementData->action.action != AI::ACTION_DIE)
+			if (target->GetHealth() <= 1e-3 && target->pMovementData->action.action != AI::ACTION_DIE)
 			{
 #ifdef CHECKSUM_DEBUG_HIGH
 				Networking::checksum_output << "DIE" << "\n";
@@ -649,10 +649,10 @@ namespace Game
 			}
 			else
 			{
-				goto_pos = target->pos;
+				goto_pos = target->GetPosition();
 				goal_pos = Utilities::Vector3D(goto_pos.x, goto_pos.y, Dimension::GetTerrainHeight(goto_pos.x, goto_pos.y));
 				goal_pos.z += target->type->height * 0.25f * 0.0625f;
-				gc_root_ptr<Projectile>::type proj = CreateProjectile(attacker->type->projectileType, Utilities::Vector3D(attacker->pos.x, attacker->pos.y, GetTerrainHeight(attacker->pos.x, attacker->pos.y)), goal_pos, attacker);
+				gc_root_ptr<Projectile>::type proj = CreateProjectile(attacker->type->projectileType, Utilities::Vector3D(attacker->GetPosition().x, attacker->GetPosition().y, GetTerrainHeight(attacker->GetPosition().x, attacker->GetPosition().y)), goal_pos, attacker);
 				proj->goalUnit = target;
 				attacker->vProjectiles.push_back(proj);
 				UnitMainNode::GetInstance()->ScheduleProjectileAddition(proj);
@@ -718,7 +718,7 @@ namespace Game
 							if (target == proj->attacker)
 								continue;
 
-							Utilities::Vector3D unit_pos = GetTerrainCoord(target->pos.x, target->pos.y);
+							Utilities::Vector3D unit_pos = GetTerrainCoord(target->GetPosition().x, target->GetPosition().y);
 							if (proj_pos.distance(unit_pos) <= max_radius)
 							{
 								units_hit.push_back(target);
@@ -736,7 +736,7 @@ namespace Game
 #ifdef CHECKSUM_DEBUG_HIGH
 					Networking::checksum_output << "HIT " << target->GetHandle() << "\n";
 #endif
-					if (proj->attacker->isDisplayed)
+					if (proj->attacker->IsDisplayed())
 					{
 						// Make the attacked player aware of where its attacker is
 						proj->attacker->lastSeenPositions[target->owner->index] = proj->attacker->curAssociatedSquare;
@@ -830,46 +830,36 @@ namespace Game
 			}
 		}
 
-		void ChangePath(const gc_ptr<Unit>& pUnit, int goal_x, int goal_y, AI::UnitAction action, const gc_ptr<Unit>& target, const ActionArguments& args, float rotation)
+		void ChangePath(const gc_ptr<Unit>& pUnit, int goal_x, int goal_y, AI::UnitAction action, const gc_ptr<Unit>& target, const ActionArguments& args, float rotation, AI::PathPriority priority)
 		{
 			if (pUnit->type->isMobile)
 			{
-				AI::CommandPathfinding(pUnit, pUnit->curAssociatedSquare.x, pUnit->curAssociatedSquare.y, goal_x, goal_y, action, target, args, rotation);
+				AI::CommandPathfinding(pUnit, pUnit->curAssociatedSquare.x, pUnit->curAssociatedSquare.y, goal_x, goal_y, action, target, args, rotation, priority);
 			}
 		}
 
 		bool CheckPath(const gc_ptr<Unit>& pUnit)
 		{
-			AI::Node *curnode = pUnit->pMovementData->pStart, *parent;
+			AI::Path *path = pUnit->pMovementData->pPath;
 			bool invalid_path = false;
 
-			// The code below checks whether the path is correct. It cannot, however, check whether pointers
-			// are valid in any other way than checking whether they are NULL or do not match other pointers. Non-null
-			// invalid pointers will cause _crashes_, and that is not the fault of this piece of code nor this routine.
-			if (curnode->pParent)
+			// The code below checks whether the path is correct, that is, whether it is non-empty and
+			// every square in it is next to the one before it.
+			if (path->numNodes < 1)
 			{
 				invalid_path = true;
-				cout << "CRITICAL ERROR IN PATH DETECTED BY CheckPath(): pStart has pParent" << endl;
+				cout << "CRITICAL ERROR IN PATH DETECTED BY CheckPath(): PATH HAS NO SQUARES" << endl;
 			}
 			else
 			{
-				parent = curnode;
-				curnode = curnode->pChild;
-				while (curnode)
+				for (int i = 1; i < path->numNodes; i++)
 				{
-					if (curnode->pParent != parent)
+					if (abs(path->nodes[i].x - path->nodes[i-1].x) > 1 || abs(path->nodes[i].y - path->nodes[i-1].y) > 1)
 					{
 						invalid_path = true;
-						cout << "CRITICAL ERROR IN PATH DETECTED BY CheckPath(): pNode->pChild->pParent != pNode" << endl;
+						cout << "CRITICAL ERROR IN PATH DETECTED BY CheckPath(): SQUARES IN PATH ARE NOT ADJACENT" << endl;
 						break;
 					}
-					parent = curnode;
-					curnode = curnode->pChild;
-				}
-				if (parent->pChild == NULL && parent != pUnit->pMovementData->pGoal)
-				{
-					invalid_path = true;
-					cout << "CRITICAL ERROR IN PATH DETECTED BY CheckPath(): pGoal IS NOT THE LAST ITEM IN LINKED LIST OF NODES" << endl;
 				}
 			}
 			return invalid_path;
@@ -883,9 +873,9 @@ namespace Game
 			int start_x, start_y;
 			int end_x, end_y;
 			bool noloop = true;
-			if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pCurGoalNode->x, pUnit->pMovementData->pCurGoalNode->y, SIW_IGNORE_MOVING))
+			if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pPath->CurGoal().x, pUnit->pMovementData->pPath->CurGoal().y, SIW_IGNORE_MOVING))
 			{
-				if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pCurGoalNode->x, pUnit->pMovementData->pCurGoalNode->y, SIW_IGNORE_OWN_MOBILE_UNITS))
+				if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pPath->CurGoal().x, pUnit->pMovementData->pPath->CurGoal().y, SIW_IGNORE_OWN_MOBILE_UNITS))
 				{
 					return true;
 				}
@@ -894,7 +884,7 @@ namespace Game
 			{
 				return true;
 			}
-			GetUnitUpperLeftCorner(pUnit, pUnit->pMovementData->pCurGoalNode->x, pUnit->pMovementData->pCurGoalNode->y, start_x_new, start_y_new);
+			GetUnitUpperLeftCorner(pUnit, pUnit->pMovementData->pPath->CurGoal().x, pUnit->pMovementData->pPath->CurGoal().y, start_x_new, start_y_new);
 			GetUnitUpperLeftCorner(pUnit, pUnit->curAssociatedSquare.x, pUnit->curAssociatedSquare.y, start_x, start_y);
 			end_x = start_x + pUnit->type->widthOnMap - 1;
 			end_y = start_y + pUnit->type->heightOnMap - 1;
@@ -909,11 +899,11 @@ namespace Game
 						Dimension::Unit* curUnit = pppElements[y][x];
 						pUnit->isWaiting = true;
 						found = true;
-						if (curtime - curUnit->lastCommand > (AI::aiFps >> 2) && !curUnit->isMoving && !curUnit->isPushed && !curUnit->isWaiting && !AI::IsUndergoingPathCalc(curUnit))
+						if (curtime - curUnit->lastCommand > (AI::aiFps >> 2) && !curUnit->IsMoving() && !curUnit->isPushed && !curUnit->isWaiting && !AI::IsUndergoingPathCalc(curUnit))
 						{
-							int diff_x = pUnit->pMovementData->pCurGoalNode->x - pUnit->curAssociatedSquare.x;
-							int diff_y = pUnit->pMovementData->pCurGoalNode->y - pUnit->curAssociatedSquare.y;
-							int goto_x = pUnit->pMovementData->pCurGoalNode->x, goto_y = pUnit->pMovementData->pCurGoalNode->y;
+							int diff_x = pUnit->pMovementData->pPath->CurGoal().x - pUnit->curAssociatedSquare.x;
+							int diff_y = pUnit->pMovementData->pPath->CurGoal().y - pUnit->curAssociatedSquare.y;
+							int goto_x = pUnit->pMovementData->pPath->CurGoal().x, goto_y = pUnit->pMovementData->pPath->CurGoal().y;
 							int unit_x = curUnit->curAssociatedSquare.x, unit_y = curUnit->curAssociatedSquare.y;
 							int start_x_path = start_x - ((curUnit->type->widthOnMap-1) << 1) - 1;
 							int start_y_path = start_y - ((curUnit->type->heightOnMap-1) << 1) - 1;
@@ -1095,7 +1085,7 @@ namespace Game
 									goto_new_y = curUnit->curAssociatedSquare.y + dirs[i][1];
 									if (dirs_possible[i] && SquaresAreWalkable(curUnit, goto_new_x, goto_new_y, flags[j]))
 									{
-										if (DoesNotBlock(curUnit, pUnit->type, goto_x, goto_y, goto_new_x, goto_new_y) && (!pUnit->pusher || DoesNotBlock(curUnit, pUnit->pusher->type, pUnit->pusher->pMovementData->pCurGoalNode->x, pUnit->pusher->pMovementData->pCurGoalNode->y, goto_new_x, goto_new_y)))
+										if (DoesNotBlock(curUnit, pUnit->type, goto_x, goto_y, goto_new_x, goto_new_y) && (!pUnit->pusher || DoesNotBlock(curUnit, pUnit->pusher->type, pUnit->pusher->pMovementData->pPath->CurGoal().x, pUnit->pusher->pMovementData->pPath->CurGoal().y, goto_new_x, goto_new_y)))
 										{
 											cout << "Move " << curUnit << " " << goto_new_x << " " << goto_new_y << " " << flags[j] << " " << i << endl;
 											numSentCommands++;
@@ -1147,20 +1137,20 @@ namespace Game
 			float distance, distance_per_frame;
 			Position goto_pos;
 			Utilities::Vector3D move; // abused to calculate movement per axis in 2d and the rotation of the model when going in a specific direction...
-			goto_pos.x = (float) pUnit->pMovementData->pCurGoalNode->x + 0.5f;
-			goto_pos.y = (float) pUnit->pMovementData->pCurGoalNode->y + 0.5f;
+			goto_pos.x = (float) pUnit->pMovementData->pPath->CurGoal().x + 0.5f;
+			goto_pos.y = (float) pUnit->pMovementData->pPath->CurGoal().y + 0.5f;
 
 			distance_per_frame = pUnit->type->movementSpeed / (float) AI::aiFps / 
 				             ((float)GetTraversalTime(pUnit,
-						               pUnit->pMovementData->pCurGoalNode->pParent->x,
-							       pUnit->pMovementData->pCurGoalNode->pParent->y,
-							       pUnit->pMovementData->pCurGoalNode->x - pUnit->pMovementData->pCurGoalNode->pParent->x,
-							       pUnit->pMovementData->pCurGoalNode->y - pUnit->pMovementData->pCurGoalNode->pParent->y)
+						               pUnit->pMovementData->pPath->CurGoalParent().x,
+							       pUnit->pMovementData->pPath->CurGoalParent().y,
+							       pUnit->pMovementData->pPath->CurGoal().x - pUnit->pMovementData->pPath->CurGoalParent().x,
+							       pUnit->pMovementData->pPath->CurGoal().y - pUnit->pMovementData->pPath->CurGoalParent().y)
 				              / 10.0f);
 
-			distance = Distance2D(goto_pos.x - pUnit->pos.x, goto_pos.y - pUnit->pos.y);
+			distance = Distance2D(goto_pos.x - pUnit->GetPosition().x, goto_pos.y - pUnit->GetPosition().y);
 
-			move.set(goto_pos.x - pUnit->pos.x, 0.0, goto_pos.y - pUnit->pos.y);
+			move.set(goto_pos.x - pUnit->GetPosition().x, 0.0, goto_pos.y - pUnit->GetPosition().y);
 			move.normalize();
 			move *= distance_per_frame;
 
@@ -1187,7 +1177,7 @@ namespace Game
 				return true;
 			}
 
-			if (pUnit->pMovementData->pStart)
+			if (pUnit->pMovementData->pPath)
 			{
 				if ((action == AI::ACTION_FOLLOW || action == AI::ACTION_ATTACK) && !pUnit->owner->isRemote)
 				{
@@ -1198,9 +1188,10 @@ namespace Game
 					}
 				}
 			
-				if (!pUnit->pMovementData->pCurGoalNode)
+				if (pUnit->pMovementData->pPath->cursor == -1)
 				{
-					AI::Node *curnode = pUnit->pMovementData->pStart;
+					AI::Path *path = pUnit->pMovementData->pPath;
+					int curnode = 0;
 					bool recalc_path = CheckPath(pUnit);
 					pUnit->isWaiting = false;
 					
@@ -1210,27 +1201,28 @@ namespace Game
 					}
 					else
 					{
-						while (curnode)
+						while (curnode < path->numNodes)
 						{
-							if (curnode->x == pUnit->curAssociatedSquare.x &&
-							    curnode->y == pUnit->curAssociatedSquare.y)
+							if (path->nodes[curnode].x == pUnit->curAssociatedSquare.x &&
+							    path->nodes[curnode].y == pUnit->curAssociatedSquare.y)
 							{
 #ifdef CHECKSUM_DEBUG_HIGH
-								Networking::checksum_output << "START PATH GOAL " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << curnode->x << " " << curnode->y << "\n";
+								Networking::checksum_output << "START PATH GOAL " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << path->nodes[curnode].x << " " << path->nodes[curnode].y << "\n";
 #endif
 								break;
 							}
-							curnode = curnode->pChild;
+							curnode++;
 						}
 
-						if (!curnode)
+						if (curnode == path->numNodes)
 						{
 							recalc_path = true;
-							pUnit->pMovementData->pCurGoalNode = NULL;
+							path->cursor = -1;
 						}
 						else
 						{
-							pUnit->pMovementData->pCurGoalNode = curnode->pChild;
+							// -1 if the unit is already at the goal
+							path->cursor = curnode + 1 < path->numNodes ? curnode + 1 : -1;
 						}
 					}
 
@@ -1257,14 +1249,15 @@ namespace Game
 										  pUnit->pMovementData->action.rotation);
 							}
 						}
-						pUnit->pMovementData->pCurGoalNode = NULL;
+						if (pUnit->pMovementData->pPath)
+							pUnit->pMovementData->pPath->cursor = -1;
 						should_move = false;
-						pUnit->isMoving = false;
+						pUnit->SetMoving(false);
 					}
 					else
 					{
 						pUnit->pMovementData->switchedSquare = false;
-						if (!pUnit->pMovementData->pCurGoalNode || !pUnit->pMovementData->pCurGoalNode->pParent)
+						if (pUnit->pMovementData->pPath->cursor < 1)
 						{
 #ifdef CHECKSUM_DEBUG_HIGH
 							Networking::checksum_output << "ONE NODE PATH " << AI::currentFrame << ": " << pUnit->GetHandle() << "\n";
@@ -1299,9 +1292,8 @@ namespace Game
 									}
 								}
 							}
-							pUnit->isMoving = false;
+							pUnit->SetMoving(false);
 							pUnit->isPushed = false;
-							pUnit->pMovementData->pCurGoalNode = NULL;
 							should_move = false;
 							AI::DeallocPathfindingNodes(pUnit);
 						}
@@ -1309,7 +1301,7 @@ namespace Game
 						{
 							NewGoalNode(pUnit);
 /*							PushUnits(pUnit);
-							if (!pUnit->pMovementData->pStart)
+							if (!pUnit->pMovementData->pPath)
 							{
 								return true;
 							}*/
@@ -1323,7 +1315,7 @@ namespace Game
 				Networking::checksum_output << "PATHWAIT " << AI::currentFrame << ": " << pUnit->GetHandle() << "\n";
 #endif
 				should_move = false;
-				pUnit->isMoving = false;
+				pUnit->SetMoving(false);
 				if (!pUnit->owner->isRemote && !AI::IsUndergoingPathCalc(pUnit))
 				{
 					ChangePath(pUnit, pUnit->pMovementData->action.goal.pos.x, pUnit->pMovementData->action.goal.pos.y, pUnit->pMovementData->action.action, pUnit->pMovementData->action.goal.unit, pUnit->pMovementData->action.args, pUnit->pMovementData->action.rotation);
@@ -1337,7 +1329,7 @@ namespace Game
 				distance = pUnit->pMovementData->distanceLeft;
 				
 #ifdef CHECKSUM_DEBUG_HIGH
-				Networking::checksum_output << "MOVE " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pos.x << " " << pUnit->pos.y << " " << move.x << " " << move.y << " " << pUnit->type->movementSpeed << " " << AI::aiFps << " " << GetTraversalTime(pUnit, pUnit->pMovementData->pCurGoalNode->pParent->x, pUnit->pMovementData->pCurGoalNode->pParent->y, pUnit->pMovementData->pCurGoalNode->x - pUnit->pMovementData->pCurGoalNode->pParent->x, pUnit->pMovementData->pCurGoalNode->y - pUnit->pMovementData->pCurGoalNode->pParent->y) << " " << distance_per_frame << " " << distance << " " << power_usage << "\n";
+				Networking::checksum_output << "MOVE " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->GetPosition().x << " " << pUnit->GetPosition().y << " " << move.x << " " << move.y << " " << pUnit->type->movementSpeed << " " << AI::aiFps << " " << GetTraversalTime(pUnit, pUnit->pMovementData->pPath->CurGoalParent().x, pUnit->pMovementData->pPath->CurGoalParent().y, pUnit->pMovementData->pPath->CurGoal().x - pUnit->pMovementData->pPath->CurGoalParent().x, pUnit->pMovementData->pPath->CurGoal().y - pUnit->pMovementData->pPath->CurGoalParent().y) << " " << distance_per_frame << " " << distance << " " << power_usage << "\n";
 #endif
 				
 				if (distance < distance_per_frame)
@@ -1346,37 +1338,37 @@ namespace Game
 				}
 
 				if (!pUnit->pMovementData->switchedSquare &&
-				    Distance2D(pUnit->pos.x + move.x - (float) pUnit->pMovementData->pCurGoalNode->pParent->x - 0.5f,
-					       pUnit->pos.y + move.y - (float) pUnit->pMovementData->pCurGoalNode->pParent->y - 0.5f) > 
-				    Distance2D(pUnit->pos.x + move.x - (float) pUnit->pMovementData->pCurGoalNode->x - 0.5f,
-					       pUnit->pos.y + move.y - (float) pUnit->pMovementData->pCurGoalNode->y - 0.5f))
+				    Distance2D(pUnit->GetPosition().x + move.x - (float) pUnit->pMovementData->pPath->CurGoalParent().x - 0.5f,
+					       pUnit->GetPosition().y + move.y - (float) pUnit->pMovementData->pPath->CurGoalParent().y - 0.5f) > 
+				    Distance2D(pUnit->GetPosition().x + move.x - (float) pUnit->pMovementData->pPath->CurGoal().x - 0.5f,
+					       pUnit->GetPosition().y + move.y - (float) pUnit->pMovementData->pPath->CurGoal().y - 0.5f))
 				{
 #ifdef CHECKSUM_DEBUG_HIGH
-					Networking::checksum_output << "ATTEMPT " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pMovementData->pCurGoalNode->x << " " << pUnit->pMovementData->pCurGoalNode->y << "\n";
+					Networking::checksum_output << "ATTEMPT " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pMovementData->pPath->CurGoal().x << " " << pUnit->pMovementData->pPath->CurGoal().y << "\n";
 #endif
-					if (!UpdateAssociatedSquares(pUnit, pUnit->pMovementData->pCurGoalNode->x,
-								            pUnit->pMovementData->pCurGoalNode->y,
-								            pUnit->pMovementData->pCurGoalNode->pParent->x,
-								            pUnit->pMovementData->pCurGoalNode->pParent->y))
+					if (!UpdateAssociatedSquares(pUnit, pUnit->pMovementData->pPath->CurGoal().x,
+								            pUnit->pMovementData->pPath->CurGoal().y,
+								            pUnit->pMovementData->pPath->CurGoalParent().x,
+								            pUnit->pMovementData->pPath->CurGoalParent().y))
 					{
 						should_move = false;
-						pUnit->isMoving = false;
+						pUnit->SetMoving(false);
 /*						pUnit->pushID = 0;
 						pUnit->pusher = NULL;*/
-						if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pCurGoalNode->x, pUnit->pMovementData->pCurGoalNode->y, SIW_IGNORE_MOVING | SIW_ALLKNOWING))
+						if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pPath->CurGoal().x, pUnit->pMovementData->pPath->CurGoal().y, SIW_IGNORE_MOVING | SIW_ALLKNOWING))
 						{
 							bool recalc = true;
 							
 /*							if (pUnit->isWaiting)
 							{ 
-								if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pCurGoalNode->x, pUnit->pMovementData->pCurGoalNode->y, SIW_IGNORE_OWN_MOBILE_UNITS))
+								if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pPath->CurGoal().x, pUnit->pMovementData->pPath->CurGoal().y, SIW_IGNORE_OWN_MOBILE_UNITS))
 								{
 									recalc = true;
 								}
 							}
 							else
 							{
-								if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pCurGoalNode->x, pUnit->pMovementData->pCurGoalNode->y, SIW_IGNORE_OWN_MOBILE_UNITS | SIW_CONSIDER_WAITING))
+								if (!SquaresAreWalkable(pUnit, pUnit->pMovementData->pPath->CurGoal().x, pUnit->pMovementData->pPath->CurGoal().y, SIW_IGNORE_OWN_MOBILE_UNITS | SIW_CONSIDER_WAITING))
 								{
 									recalc = true;
 								}
@@ -1421,7 +1413,7 @@ namespace Game
 					{
 						pUnit->isWaiting = false;
 						pUnit->pMovementData->switchedSquare = true;
-						pUnit->isMoving = true;
+						pUnit->SetMoving(true);
 					}
 
 				}
@@ -1433,9 +1425,8 @@ namespace Game
 #endif
 					pUnit->owner->resources.power -= power_usage;
 			
-					pUnit->pos.x += move.x;
-					pUnit->pos.y += move.z;
-					pUnit->isMoving = true;
+					pUnit->SetPosition(pUnit->GetPosition().x + move.x, pUnit->GetPosition().y + move.z);
+					pUnit->SetMoving(true);
 
 					if (pUnit->faceTarget != FACETARGET_PATH)
 					{
@@ -1449,15 +1440,15 @@ namespace Game
 					if (distance < distance_per_frame)
 					{
 						pUnit->pMovementData->distanceLeft = 0;
-						if (pUnit->pMovementData->pCurGoalNode->x == pUnit->pMovementData->pGoal->x &&
-						    pUnit->pMovementData->pCurGoalNode->y == pUnit->pMovementData->pGoal->y)
+						if (pUnit->pMovementData->pPath->CurGoal().x == pUnit->pMovementData->pPath->Goal().x &&
+						    pUnit->pMovementData->pPath->CurGoal().y == pUnit->pMovementData->pPath->Goal().y)
 						{
 							pUnit->isWaiting = false;
 							pUnit->isPushed = false;
 /*							pUnit->pushID = 0;
 							pUnit->pusher = NULL;*/
 #ifdef CHECKSUM_DEBUG_HIGH
-							Networking::checksum_output << "REACH " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pMovementData->pGoal->x << " " << pUnit->pMovementData->pGoal->y << "\n";
+							Networking::checksum_output << "REACH " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pMovementData->pPath->Goal().x << " " << pUnit->pMovementData->pPath->Goal().y << "\n";
 #endif
 							if (pUnit->pMovementData->action.goal.unit)
 							{
@@ -1489,25 +1480,24 @@ namespace Game
 									}
 								}
 							}
-							pUnit->isMoving = false;
-							pUnit->pMovementData->pCurGoalNode = NULL;
+							pUnit->SetMoving(false);
 							AI::DeallocPathfindingNodes(pUnit);
 						}
 						else
 						{
-							if (pUnit->pMovementData->pCurGoalNode->pChild && pUnit->pMovementData->pCurGoalNode->pChild->pParent != pUnit->pMovementData->pCurGoalNode)
+							if (pUnit->pMovementData->pPath->cursor + 1 >= pUnit->pMovementData->pPath->numNodes)
 							{
-								cout << "ERROR: pCurGoalNode != pCurGoalNode->pChild->pParent" << endl;
-								pUnit->pMovementData->pCurGoalNode = NULL;
+								cout << "ERROR: Path ended before its goal was reached" << endl;
+								pUnit->pMovementData->pPath->cursor = -1;
 							}
 							else
 							{
-								pUnit->pMovementData->pCurGoalNode = pUnit->pMovementData->pCurGoalNode->pChild;
+								pUnit->pMovementData->pPath->cursor++;
 								NewGoalNode(pUnit);
 //								PushUnits(pUnit);
 							}
 #ifdef CHECKSUM_DEBUG_HIGH
-							Networking::checksum_output << "NEXT GOAL " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pMovementData->pCurGoalNode->x << " " << pUnit->pMovementData->pCurGoalNode->y << "\n";
+							Networking::checksum_output << "NEXT GOAL " << AI::currentFrame << ": " << pUnit->GetHandle() << " " << pUnit->pMovementData->pPath->CurGoal().x << " " << pUnit->pMovementData->pPath->CurGoal().y << "\n";
 #endif
 							pUnit->pMovementData->switchedSquare = false;
 						}
@@ -1588,22 +1578,88 @@ namespace Game
 			return ((float)r_seed / 65535.0f);
 		}
 
+		UnitComponents unitComponents;
+
+		void AddUnitToList(vector<gc_ptr<Unit> >& units, const gc_ptr<Unit>& unit, int UnitListIndices::*index)
+		{
+			unit->listIndices.*index = units.size();
+			units.push_back(unit);
+		}
+
+		bool UnitIsInList(const vector<gc_ptr<Unit> >& units, const gc_ptr<Unit>& unit, int UnitListIndices::*index)
+		{
+			int i = unit->listIndices.*index;
+			return i >= 0 && i < (int) units.size() && units[i] == unit;
+		}
+
+		// Removes the unit by moving the last unit of the list into its place.
+		void RemoveUnitFromList(vector<gc_ptr<Unit> >& units, const gc_ptr<Unit>& unit, int UnitListIndices::*index)
+		{
+			if (!UnitIsInList(units, unit, index))
+			{
+				return;
+			}
+			int i = unit->listIndices.*index;
+			units[i] = units.back();
+			units[i]->listIndices.*index = i;
+			units.pop_back();
+			unit->listIndices.*index = -1;
+		}
+
+		// Only called between AI frames, as the components of other units are moved.
+		void AddUnitToWorld(const gc_ptr<Unit>& unit)
+		{
+			int i = pWorld->vUnits.size();
+			assert(i < UnitComponents::capacity);
+			unitComponents.health[i] = unit->unlistedHealth;
+			unitComponents.power[i] = unit->unlistedPower;
+			unitComponents.pos[i] = unit->unlistedPos;
+			unitComponents.flags[i] = unit->unlistedFlags;
+			unitComponents.ownerIndex[i] = unit->owner->index;
+			unitComponents.typeIndex[i] = unit->type->GetHandle() - HandleTraits<UnitType>::base;
+			AddUnitToList(pWorld->vUnits, unit, &UnitListIndices::world);
+		}
+
+		void RemoveUnitFromWorld(const gc_ptr<Unit>& unit)
+		{
+			if (!UnitIsInList(pWorld->vUnits, unit, &UnitListIndices::world))
+			{
+				return;
+			}
+			int i = unit->listIndices.world;
+			int last = pWorld->vUnits.size() - 1;
+			unit->unlistedHealth = unitComponents.health[i];
+			unit->unlistedPower = unitComponents.power[i];
+			unit->unlistedPos = unitComponents.pos[i];
+			unit->unlistedFlags = unitComponents.flags[i];
+			unitComponents.health[i] = unitComponents.health[last];
+			unitComponents.power[i] = unitComponents.power[last];
+			unitComponents.pos[i] = unitComponents.pos[last];
+			unitComponents.flags[i] = unitComponents.flags[last];
+			unitComponents.ownerIndex[i] = unitComponents.ownerIndex[last];
+			unitComponents.typeIndex[i] = unitComponents.typeIndex[last];
+			RemoveUnitFromList(pWorld->vUnits, unit, &UnitListIndices::world);
+		}
+
 		void PrepareUnitEssentials(gc_ptr<Unit>& unit, const gc_ptr<UnitType>& type)
 		{
 			assert(unit);
 			assert(type);
 
 			unit->type = type;
-			unit->power = (float) type->maxPower;
+			unit->unlistedFlags = 0;
+			unit->isBeingRemoved = false;
+			unit->SetHealth(0.0);
+			unit->SetPower((float) type->maxPower);
 			unit->owner = type->player;
 			unit->rotation = Utilities::RandomDegree();
 			unit->lastAttack = 0;
 			unit->lastAttacked = 0;
 			unit->lastCommand = 0;
-			unit->isDisplayed = false;
+			unit->SetDisplayed(false);
 			unit->lightState = LIGHT_ON;
 			unit->isLighted = false;
-			unit->isMoving = false;
+			unit->SetMoving(false);
 			unit->isWaiting = false;
 			unit->isPushed = false;
 			unit->hasSeen = false;
@@ -1612,13 +1668,16 @@ namespace Game
 			unit->pusher = NULL;*/
 			unit->faceTarget = FACETARGET_NONE;
 			unit->action_completeness = 0.0f;
-			unit->hasPower = false;
+			unit->SetHasPower(false);
 			unit->curAssociatedSquare.x = -1;
 			unit->curAssociatedSquare.y = -1;
 			unit->curAssociatedBigSquare.x = -1;
 			unit->curAssociatedBigSquare.y = -1;
+			unit->bigSquareIndex = -1;
+			unit->bigSquareUpdateScheduled = false;
 			unit->rallypoint = NULL;
 			unit->aiFrame = 0;
+			unit->targetCacheExpiry = 0;
 
 			unit->pMovementData = new AI::MovementData;
 			AI::InitMovementData(unit);
@@ -1654,14 +1713,14 @@ namespace Game
 			if (!complete)
 			{
 				unit->completeness = 0.0;
-				unit->isCompleted = false;
-				unit->health = 0.0;
+				unit->SetCompleted(false);
+				unit->SetHealth(0.0);
 			}
 			else
 			{
 				unit->completeness = 100.0;
-				unit->isCompleted = true;
-				unit->health = (float) type->maxHealth;
+				unit->SetCompleted(true);
+				unit->SetHealth((float) type->maxHealth);
 			}
 			
 #ifdef CHECKSUM_DEBUG_HIGH
@@ -1698,8 +1757,6 @@ namespace Game
 
 			if (unit->type->isMobile)
 				numUnitsPerAreaMap[unit->type->heightOnMap-1][unit->type->movementType]++;
-			else
-				AI::AddUnitToAreaMap(unit);
 
 			SDL_LockMutex(unitsScheduledForDisplayMutex);
 			unitsScheduledForDisplay.push_back(unit);
@@ -1714,28 +1771,33 @@ namespace Game
 			{
 				return false;
 			}
+
+			// No room left in unitComponents
+			if (pWorld->vUnits.size() >= (unsigned) UnitComponents::capacity)
+			{
+				return false;
+			}
 		
 //			std::cout << "display " << unit->GetHandle() << " (" << unit << ")" << std::endl;
 
-			pWorld->vUnits.push_back(unit);
+			AddUnitToWorld(unit);
 			if (unit->type->hasAI)
 			{
-				pWorld->vUnitsWithAI.push_back(unit);
+				AddUnitToList(pWorld->vUnitsWithAI, unit, &UnitListIndices::worldWithAI);
 			}
-			unit->owner->vUnits.push_back(unit);
+			AddUnitToList(unit->owner->vUnits, unit, &UnitListIndices::owner);
 			if (unit->type->hasLuaAI)
 			{
-				unit->owner->vUnitsWithLuaAI.push_back(unit);
+				AddUnitToList(unit->owner->vUnitsWithLuaAI, unit, &UnitListIndices::ownerWithLuaAI);
 			}
 
-			unit->pos.x = (float) unit->curAssociatedSquare.x + 0.5;
-			unit->pos.y = (float) unit->curAssociatedSquare.y + 0.5;
+			unit->SetPosition((float) unit->curAssociatedSquare.x + 0.5, (float) unit->curAssociatedSquare.y + 0.5);
 
-			unit->isDisplayed = true;
+			unit->SetDisplayed(true);
 
-			SetAssociatedSquares(unit, (int) unit->pos.x, (int) unit->pos.y);
+			SetAssociatedSquares(unit, (int) unit->GetPosition().x, (int) unit->GetPosition().y);
 
-			if (!unit->isCompleted)
+			if (!unit->IsCompleted())
 			{
 				Incomplete(unit);
 			}
@@ -1795,7 +1857,7 @@ namespace Game
 
 			AI::SendUnitEventToLua_UnitKilled(unit);
 			
-			unit->health = 0;
+			unit->SetHealth(0);
 			unit->pMovementData->action.action = AI::ACTION_DIE;
 
 			PlayActionSound(unit, Audio::SFX_ACT_DEATH_FNF);
@@ -1805,16 +1867,29 @@ namespace Game
 				//Start an explosion
 				if(UnitIsVisible(unit, Dimension::currentPlayerView))
 				{
-					FX::pParticleSystems->InitEffect(unit->pos.x, unit->pos.y, 0.0f, unit->type->size, FX::PARTICLE_SPHERICAL_EXPLOSION);
+					FX::pParticleSystems->InitEffect(unit->GetPosition().x, unit->GetPosition().y, 0.0f, unit->type->size, FX::PARTICLE_SPHERICAL_EXPLOSION);
 				}
 			}
 
 		}
 
-		void RemoveUnitFromLists(gc_ptr<Unit> unit)
+		// Drops all units that are being removed from one of the unit vectors, keeping the
+		// order of the others.
+		static void RemoveUnitsBeingRemoved(vector<gc_ptr<Unit> >& units)
+		{
+			vector<gc_ptr<Unit> >::iterator dest = units.begin();
+			for (vector<gc_ptr<Unit> >::iterator it = units.begin(); it != units.end(); it++)
+			{
+				if (!(*it)->isBeingRemoved)
+				{
+					*dest++ = *it;
+				}
+			}
+			units.erase(dest, units.end());
+		}
+
+		static void RemoveSingleUnitFromLists(const gc_ptr<Unit>& unit)
 		{
-			unsigned int i, j;
-			
 #ifdef CHECKSUM_DEBUG_HIGH
 			Networking::checksum_output << "REMOVEUNITFROMLISTS " << AI::currentFrame << ": " << unit->GetHandle() << "\n";
 #endif
@@ -1822,71 +1897,22 @@ namespace Game
 
 			DeleteAssociatedSquares(unit, unit->curAssociatedSquare.x, unit->curAssociatedSquare.y);
 
-			if (unit->isCompleted)
+			if (unit->IsCompleted())
 			{
 				unit->type->numExisting--;
  				RecheckAllRequirements(unit->owner);
 			}
 
  			displayedUnitPointers.remove(unit);
- 			unit->isDisplayed = false;
+ 			unit->SetDisplayed(false);
 
 //			std::cout << "Delete " << unit->GetHandle() << std::endl;
 
-			for (vector<gc_ptr<Unit> >::iterator it = pWorld->vUnits.begin(); it != pWorld->vUnits.end(); it++)
-			{
-				if (*it == unit)
-				{
-					pWorld->vUnits.erase(it);
-					break;
-				}
-			}
-
-			if (unit->type->hasAI)
-			{
-				for (vector<gc_ptr<Unit> >::iterator it = pWorld->vUnitsWithAI.begin(); it != pWorld->vUnitsWithAI.end(); it++)
-				{
-					if (*it == unit)
-					{
-						pWorld->vUnitsWithAI.erase(it);
-						break;
-					}
-				}
-			}
+			RemoveUnitFromWorld(unit);
+			RemoveUnitFromList(pWorld->vUnitsWithAI, unit, &UnitListIndices::worldWithAI);
 			
-			if (unit->owner == GetCurrentPlayer())
-			{
-				vector<gc_ptr<Unit> >::iterator it = unitsDisplayQueue.begin();
-				while (it != unitsDisplayQueue.end())
-				{
-					if (*it == unit)
-					{
-						unitsDisplayQueue.erase(it);
-						break;
-					}
-					it++;
-				}
-			}
-
-			for (vector<gc_ptr<Unit> >::iterator it = unit->owner->vUnits.begin(); it != unit->owner->vUnits.end(); it++)
-			{
-				if (*it == unit)
-				{
-					unit->owner->vUnits.erase(it);
-					break;
-				}
-			}
-			if (unit->type->hasLuaAI)
-			{
-				for (vector<gc_ptr<Unit> >::iterator it = unit->owner->vUnitsWithLuaAI.begin(); it != unit->owner->vUnitsWithLuaAI.end(); it++)
-				{
-					if (*it == unit)
-					{
-						unit->owner->vUnitsWithLuaAI.erase(it);
-						break;
-					}
-				}
-			}
+			RemoveUnitFromList(unit->owner->vUnits, unit, &UnitListIndices::owner);
+			RemoveUnitFromList(unit->owner->vUnitsWithLuaAI, unit, &UnitListIndices::ownerWithLuaAI);
 			
 			for (vector<gc_ptr<Projectile> >::iterator it = unit->vProjectiles.begin(); it != unit->vProjectiles.end(); it++)
 			{
@@ -1898,20 +1924,6 @@ namespace Game
 			if (unitsScheduledForDeletion.find(unit) != unitsScheduledForDeletion.end())
 				unitsScheduledForDeletion.erase(unit);
 
-			for (j = 0; j < 10; j++)
-			{
-				for (i = 0; i < unitGroups[j].size(); i++)
-				{
-					if (unitGroups[j].at(i) == unit)
-					{
-						unitGroups[j].erase(unitGroups[j].begin() + i);
-						break;
-					}
-				}
-			}
-
-			DeselectUnit(unit);
-
 			RemoveUnitFromBigSquare(unit);
 			
 			if (unit->usedInAreaMaps)
@@ -1929,39 +1941,84 @@ namespace Game
 
 			if (unit->type->isMobile)
 				numUnitsPerAreaMap[unit->type->heightOnMap-1][unit->type->movementType]--;
+		}
+
+		// Takes a batch of units out of all lists, in the given order. The display queue,
+		// the groups, the selection and the actions of the remaining units that target
+		// any of the removed units are each handled in a single pass for the whole batch,
+		// with pathfinding paused only once.
+		static void RemoveUnitsFromLists(const vector<gc_ptr<Unit> >& units)
+		{
+			unsigned int i, j;
+
+			for (i = 0; i < units.size(); i++)
+			{
+				units[i]->isBeingRemoved = true;
+			}
+
+			for (i = 0; i < units.size(); i++)
+			{
+				RemoveSingleUnitFromLists(units[i]);
+			}
+
+			RemoveUnitsBeingRemoved(unitsDisplayQueue);
+
+			for (j = 0; j < 10; j++)
+			{
+				RemoveUnitsBeingRemoved(unitGroups[j]);
+			}
+
+			for (i = 0; i < unitsSelected.size(); i++)
+			{
+				if (unitsSelected[i]->isBeingRemoved)
+				{
+					UnitMainNode::GetInstance()->ScheduleDeselection(unitsSelected[i]);
+				}
+			}
+			RemoveUnitsBeingRemoved(unitsSelected);
 
 			AI::PausePathfinding();
 
 			for (i = 0; i < pWorld->vUnits.size(); i++)
 			{
 				const gc_ptr<Unit>& curUnit = pWorld->vUnits.at(i);
-				while (curUnit->pMovementData->action.goal.unit == unit)
+				while (curUnit->pMovementData->action.goal.unit && curUnit->pMovementData->action.goal.unit->isBeingRemoved)
 				{
 					AI::CancelAction(curUnit);
 				}
-				if (curUnit->pMovementData->_action.goal.unit == unit)
+				if (curUnit->pMovementData->_action.goal.unit && curUnit->pMovementData->_action.goal.unit->isBeingRemoved)
 				{
 					AI::CancelUndergoingProc(curUnit);
 				}
-				if (curUnit->pMovementData->_newAction.goal.unit == unit)
+				if (curUnit->pMovementData->_newAction.goal.unit && curUnit->pMovementData->_newAction.goal.unit->isBeingRemoved)
 				{
 					AI::DequeueNewPath(curUnit);
 				}
 			}
 
-			UnitMainNode::GetInstance()->ScheduleUnitNodeDeletion(unit);
-
-			if (AI::IsUndergoingPathCalc(unit))
+			for (i = 0; i < units.size(); i++)
 			{
-				AI::QuitUndergoingProc(unit);
-				AI::ResumePathfinding();
-				return;
+				const gc_ptr<Unit>& unit = units[i];
+
+				UnitMainNode::GetInstance()->ScheduleUnitNodeDeletion(unit);
+
+				if (AI::IsUndergoingPathCalc(unit))
+				{
+					// A pathfinding thread still works on the unit, so keep its handle
+					AI::QuitUndergoingProc(unit);
+				}
+				else
+				{
+					unit->RevokeHandle();
+				}
 			}
-			
-			AI::ResumePathfinding();
 
-			unit->RevokeHandle();
+			AI::ResumePathfinding();
+		}
 
+		void RemoveUnitFromLists(gc_ptr<Unit> unit)
+		{
+			RemoveUnitsFromLists(vector<gc_ptr<Unit> >(1, unit));
 		}
 
 		Unit::~Unit()
@@ -1980,13 +2037,13 @@ namespace Game
 			gc_ptr<Unit> unit = new Unit;
 			unit->AssignHandle();
 
-			unit->completeness = 100.0;
-			unit->isCompleted = true;
-			unit->health = (float) type->maxHealth;
-
 			PrepareUnitEssentials(unit, type);
 //			PrepareAnimationData(unit);
 
+			unit->completeness = 100.0;
+			unit->SetCompleted(true);
+			unit->SetHealth((float) type->maxHealth);
+
 			return unit;
 		}
 
@@ -2009,11 +2066,17 @@ namespace Game
 			unitsScheduledForDeletion.insert(unit);
 		}
 
+		// Units are taken out of the unit lists by moving the last unit into their
+		// place, so the order of the lists depends on the order of removal. The set
+		// is ordered by pointer, which differs between the machines of a networked
+		// game, so remove in handle order to keep the lists equal on all of them.
 		void DeleteScheduledUnits()
 		{
 			while (unitsScheduledForDeletion.size())
 			{
-				RemoveUnitFromLists(*unitsScheduledForDeletion.begin());
+				vector<gc_ptr<Unit> > units(unitsScheduledForDeletion.begin(), unitsScheduledForDeletion.end());
+				sort(units.begin(), units.end(), UnitBinPred);
+				RemoveUnitsFromLists(units);
 			}
 		}
 
@@ -102,16 +102,67 @@ namespace Game
 			}
 		};
 
+		// Positions of a unit in the unit vectors it is a member of, so that it
+		// can be taken out of them without a scan; -1 when not a member.
+		struct UnitListIndices
+		{
+			int world;          // pWorld->vUnits
+			int worldWithAI;    // pWorld->vUnitsWithAI
+			int owner;          // owner->vUnits
+			int ownerWithLuaAI; // owner->vUnitsWithLuaAI
+			int bigSquare;      // unitsInBigSquares
+
+			UnitListIndices() : world(-1), worldWithAI(-1), owner(-1), ownerWithLuaAI(-1), bigSquare(-1)
+			{
+			}
+		};
+
+		//
+		// The hot per-frame state of the units in pWorld->vUnits, kept in arrays
+		// indexed the same way as vUnits, so that the passes over all units every
+		// AI frame read it in order from packed memory; unit handles are spread
+		// over the whole handle range, and would not be. The entries are moved
+		// along with the units when units are added to or removed from vUnits,
+		// which is only done between AI frames. Units not in vUnits keep their
+		// state in the Unit itself.
+		//
+		enum UnitFlags
+		{
+			UNITFLAG_COMPLETED = 1,
+			UNITFLAG_DISPLAYED = 2,
+			UNITFLAG_HAS_POWER = 4,
+			UNITFLAG_MOVING = 8
+		};
+
+		struct UnitComponents
+		{
+			enum { capacity = HandleTraits<Unit>::num };
+
+			float    health[capacity];
+			float    power[capacity];
+			Position pos[capacity];
+			Uint8    flags[capacity];      // UNITFLAG_*
+			Uint16   ownerIndex[capacity]; // index of the owner in pWorld->vPlayers
+			Uint16   typeIndex[capacity];  // handle of the type, less HandleTraits<UnitType>::base
+		};
+
+		extern UnitComponents unitComponents;
+
 		struct Unit : HasHandle<Unit>
 		{
-			float               health;
-			float               power;
+			float               unlistedHealth; // health, power, position and flags while not in pWorld->vUnits; see UnitComponents
+			float               unlistedPower;
+			Position            unlistedPos;
+			Uint8               unlistedFlags;
 			gc_ptr<UnitType>   type;
 			gc_ptr<Player>     owner;
-			Position            pos;
 			std::vector<IntPosition> lastSeenPositions;
 			IntPosition         curAssociatedSquare;
 			IntPosition         curAssociatedBigSquare;
+			int                 bigSquareIndex; // Index of the unit in its big square's cell of units; -1 if not in one
+			bool                bigSquareUpdateScheduled; // the unit is in ScheduledBigSquareUpdates
+			bool                isBeingRemoved; // the unit is in the batch RemoveUnitsFromLists is taking out of the lists
+			UnitListIndices     listIndices;
 			float               rotation;  // how rotated the model is
 			std::deque<ActionQueueItem>  actionQueue;
 			gc_ptr<AI::MovementData> pMovementData;
@@ -121,18 +172,16 @@ namespace Game
 			Uint32              lastCommand;
 			float               completeness;
 			float               action_completeness;
-			bool                isCompleted;
-			bool                isDisplayed;
-			bool                isMoving;
 			bool                isLighted;   // the unit has squares added that are marked as lighted
 			bool                hasSeen;     // the unit has squares added that are marked as seen
 			bool                isWaiting;
 			bool                isPushed;
-			bool                hasPower;
 			LightState          lightState;
 			gc_ptr<IntPosition> rallypoint;
 			AI::UnitAIFuncs     unitAIFuncs;
 			int                 aiFrame;
+			gc_ptr<Unit>        cachedTarget;      // nearest enemy in sight, found by AcquireTargets()
+			Uint32              targetCacheExpiry; // frame from which cachedTarget is no longer used
 			UnitSoundStatus soundNodes[Audio::SFX_ACT_COUNT];
 			int                 usedInAreaMaps;
 /*			Uint32              pushID;
@@ -141,6 +190,58 @@ namespace Game
 
 			~Unit();
 
+			float GetHealth() const
+			{
+				return listIndices.world != -1 ? unitComponents.health[listIndices.world] : unlistedHealth;
+			}
+
+			void SetHealth(float health)
+			{
+				(listIndices.world != -1 ? unitComponents.health[listIndices.world] : unlistedHealth) = health;
+			}
+
+			float GetPower() const
+			{
+				return listIndices.world != -1 ? unitComponents.power[listIndices.world] : unlistedPower;
+			}
+
+			void SetPower(float power)
+			{
+				(listIndices.world != -1 ? unitComponents.power[listIndices.world] : unlistedPower) = power;
+			}
+
+			const Position& GetPosition() const
+			{
+				return listIndices.world != -1 ? unitComponents.pos[listIndices.world] : unlistedPos;
+			}
+
+			void SetPosition(float x, float y)
+			{
+				Position& pos = listIndices.world != -1 ? unitComponents.pos[listIndices.world] : unlistedPos;
+				pos.x = x;
+				pos.y = y;
+			}
+
+			bool GetFlag(Uint8 flag) const
+			{
+				return ((listIndices.world != -1 ? unitComponents.flags[listIndices.world] : unlistedFlags) & flag) != 0;
+			}
+
+			void SetFlag(Uint8 flag, bool value)
+			{
+				Uint8& flags = listIndices.world != -1 ? unitComponents.flags[listIndices.world] : unlistedFlags;
+				flags = value ? flags | flag : flags & ~flag;
+			}
+
+			bool IsCompleted() const         { return GetFlag(UNITFLAG_COMPLETED); }
+			void SetCompleted(bool value)    { SetFlag(UNITFLAG_COMPLETED, value); }
+			bool IsDisplayed() const         { return GetFlag(UNITFLAG_DISPLAYED); }
+			void SetDisplayed(bool value)    { SetFlag(UNITFLAG_DISPLAYED, value); }
+			bool HasPower() const            { return GetFlag(UNITFLAG_HAS_POWER); }
+			void SetHasPower(bool value)     { SetFlag(UNITFLAG_HAS_POWER, value); }
+			bool IsMoving() const            { return GetFlag(UNITFLAG_MOVING); }
+			void SetMoving(bool value)       { SetFlag(UNITFLAG_MOVING, value); }
+
 			void shade()
 			{
 				type.shade();
@@ -148,6 +249,7 @@ namespace Game
 				pMovementData.shade();
 				gc_shade_container(vProjectiles);
 				rallypoint.shade();
+				cachedTarget.shade();
 			}
 		};
 
@@ -156,6 +258,9 @@ namespace Game
 		extern std::vector<gc_ptr<Unit> > unitsDisplayQueue;
 		extern std::vector<gc_ptr<Unit> > unitGroups[10];
 
+		void AddUnitToList(std::vector<gc_ptr<Unit> >& units, const gc_ptr<Unit>& unit, int UnitListIndices::*index);
+		void RemoveUnitFromList(std::vector<gc_ptr<Unit> >& units, const gc_ptr<Unit>& unit, int UnitListIndices::*index);
+
 		void PlayActionSound(const gc_ptr<Unit>& unit, Audio::SoundNodeAction action);
 		void PlayRepeatingActionSound(const gc_ptr<Unit>& unit, Audio::SoundNodeAction action);
 		void StopRepeatingActionSound(const gc_ptr<Unit>& unit, Audio::SoundNodeAction action);
@@ -174,7 +279,7 @@ namespace Game
 		void HandleProjectiles(const gc_ptr<Player>& player);
 		void HandleProjectiles(const gc_ptr<Unit>& unit);
 		bool CanReach(const gc_ptr<Unit>& attacker, const gc_ptr<Unit>& target);
-		void ChangePath(const gc_ptr<Unit>& pUnit, int goal_x, int goal_y, AI::UnitAction action, const gc_ptr<Unit>& target, const ActionArguments& args, float rotation);
+		void ChangePath(const gc_ptr<Unit>& pUnit, int goal_x, int goal_y, AI::UnitAction action, const gc_ptr<Unit>& target, const ActionArguments& args, float rotation, AI::PathPriority priority = AI::PATHPRIORITY_REPATH);
 
 		void SelectUnit(const gc_ptr<Unit>& unit);
 		void DeselectUnit(const gc_ptr<Unit>& unit);
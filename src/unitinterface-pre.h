@@ -47,6 +47,12 @@ namespace UnitLuaInterface
 		AI_CONTEXT_PLAYER
 	};
 	
+	//
+	// While set, unit commands given through lua are orders of the player at this
+	// computer passed on by its CommandUnit handler, not commands of the lua AI.
+	//
+	void SetForwardingPlayerOrders(bool forwarding);
+
 	void ApplyScheduledActions();
 	void ApplyScheduledDamagings();
 	void PostProcessStrings();
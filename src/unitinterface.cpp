@@ -25,6 +25,7 @@
 #include "unitsquares.h"
 #include "unitrender.h"
 #include "aipathfinding.h"
+#include "aigrouppath.h"
 #include "environment.h"
 #include "networking.h"
 #include "vfs.h"
@@ -124,7 +125,7 @@ namespace UnitLuaInterface
 		CHECK_UNIT_PTR(pUnit);
 
 		if (IsDisplayedUnitPointer(pUnit))
-			health = pUnit->health;
+			health = pUnit->GetHealth();
 
 		lua_pushnumber(pVM, health);
 		return 1;
@@ -148,7 +149,7 @@ namespace UnitLuaInterface
 		const gc_ptr<Unit>& pUnit = _GetUnit(lua_touserdata(pVM, 1));
 
 		if (IsDisplayedUnitPointer(pUnit))
-			power = pUnit->power;
+			power = pUnit->GetPower();
 
 		lua_pushnumber(pVM, power);
 		return 1;
@@ -197,8 +198,8 @@ namespace UnitLuaInterface
 
 		if (IsDisplayedUnitPointer(pUnit))
 		{
-			position[0] = pUnit->pos.x;
-			position[1] = pUnit->pos.y;
+			position[0] = pUnit->GetPosition().x;
+			position[1] = pUnit->GetPosition().y;
 		}
 
 		lua_pushnumber(pVM, position[0]);
@@ -375,7 +376,18 @@ namespace UnitLuaInterface
 
 		if (IsDisplayedUnitPointer(pUnit))
 		{
-			retUnit = GetNearestUnitInRange(pUnit, rangeType, PSBitmask);
+			if (rangeType == RANGE_SIGHT && PSBitmask == PLAYER_STATE_ENEMY)
+			{
+				retUnit = GetNearestEnemyInSight(pUnit);
+			}
+			else if (PSBitmask == PLAYER_STATE_ENEMY)
+			{
+				retUnit = GetNearestEnemyInRange(pUnit, rangeType);
+			}
+			else
+			{
+				retUnit = GetNearestUnitInRange(pUnit, rangeType, PSBitmask);
+			}
 		}
 		
 		if (retUnit)
@@ -389,6 +401,52 @@ namespace UnitLuaInterface
 		return 1;
 	}
 
+	// Push the units as an array of unit pointers
+	void PushUnitArray(lua_State* pVM, const vector<gc_ptr<Unit> >& units)
+	{
+		lua_newtable(pVM);
+		for (unsigned i = 0; i < units.size(); i++)
+		{
+			lua_pushlightuserdata(pVM, (void*) units[i]->GetHandle());
+			lua_rawseti(pVM, -2, i + 1);
+		}
+	}
+
+	int LGetNearestUnitsInRange(lua_State* pVM)
+	{
+		const gc_ptr<Unit>& pUnit = _GetUnit(lua_touserdata(pVM, 1));
+		RangeType rangeType = (RangeType) lua_tointeger(pVM, 2);
+		PlayerState PSBitmask = lua_tointeger(pVM, 3);
+		int num = lua_tointeger(pVM, 4);
+
+		vector<gc_ptr<Unit> > units;
+
+		if (IsDisplayedUnitPointer(pUnit) && num > 0)
+		{
+			GetNearestUnitsInRange(pUnit, rangeType, PSBitmask, num, units);
+		}
+
+		PushUnitArray(pVM, units);
+		return 1;
+	}
+
+	int LGetUnitsInRange(lua_State* pVM)
+	{
+		const gc_ptr<Unit>& pUnit = _GetUnit(lua_touserdata(pVM, 1));
+		RangeType rangeType = (RangeType) lua_tointeger(pVM, 2);
+		PlayerState PSBitmask = lua_tointeger(pVM, 3);
+
+		vector<gc_ptr<Unit> > units;
+
+		if (IsDisplayedUnitPointer(pUnit))
+		{
+			GetUnitsInRange(pUnit, rangeType, PSBitmask, units);
+		}
+
+		PushUnitArray(pVM, units);
+		return 1;
+	}
+
 	int LGetNearestSuitableAndLightedPosition(lua_State* pVM)
 	{
 		gc_ptr<UnitType> pUnitType = _GetUnitType(lua_touserdata(pVM, 1));
@@ -616,7 +674,7 @@ namespace UnitLuaInterface
 		if (health > pUnit->type->maxHealth)
 			health = (float) pUnit->type->maxHealth;
 
-		pUnit->health = health;
+		pUnit->SetHealth(health);
 
 		LUA_SUCCESS
 	}
@@ -634,7 +692,7 @@ namespace UnitLuaInterface
 		if (power > pUnit->type->maxPower)
 			power = (float) pUnit->type->maxPower;
 
-		pUnit->power = power;
+		pUnit->SetPower(power);
 
 		LUA_SUCCESS
 	}
@@ -950,7 +1008,8 @@ namespace UnitLuaInterface
 	struct ScheduledAction : public BaseActionData
 	{
 		gc_ptr<Unit> unit;
-		ScheduledAction(const gc_ptr<Unit>& unit, int end_x, int end_y, const gc_ptr<Unit>& goal, UnitAction action, const ActionArguments& args, float rotation) : unit(unit)
+		Game::AI::PathPriority priority; // Where the command came from
+		ScheduledAction(const gc_ptr<Unit>& unit, int end_x, int end_y, const gc_ptr<Unit>& goal, UnitAction action, const ActionArguments& args, float rotation, Game::AI::PathPriority priority) : unit(unit), priority(priority)
 		{
 			this->goal.pos.x = end_x;
 			this->goal.pos.y = end_y;
@@ -964,17 +1023,81 @@ namespace UnitLuaInterface
 	vector<ScheduledAction*> scheduledActions;
 	SDL_mutex* scheduledActionsMutex = NULL;
 
+	// Only changed on the main thread while no lua AI is running
+	bool forwardingPlayerOrders = false;
+
+	void SetForwardingPlayerOrders(bool forwarding)
+	{
+		forwardingPlayerOrders = forwarding;
+	}
+
+#ifdef USE_GROUP_PATHFINDING
+	// Whether the scheduled action moves its unit to a position, so that it may share its path with others
+	bool CanMoveAsGroup(const ScheduledAction* action)
+	{
+		return (action->action == ACTION_GOTO || action->action == ACTION_MOVE_ATTACK) &&
+		       !action->goal.unit && action->unit->type->isMobile;
+	}
+
+	// The group shares one request, so everything it is made with must be the same for all of its units
+	bool CanMoveInSameGroup(const ScheduledAction* a, const ScheduledAction* b)
+	{
+		return a->action == b->action && a->goal.pos.x == b->goal.pos.x && a->goal.pos.y == b->goal.pos.y &&
+		       a->args.argHandle == b->args.argHandle && a->rotation == b->rotation &&
+		       a->unit->owner == b->unit->owner && a->priority == b->priority;
+	}
+#endif
+
 	void ApplyScheduledActions()
 	{
+#ifdef USE_GROUP_PATHFINDING
+		// Units given the same order this frame, usually a selection sent somewhere
+		vector<vector<ScheduledAction*> > groups;
+#endif
+
 		for (vector<ScheduledAction*>::iterator it = scheduledActions.begin(); it != scheduledActions.end(); it++)
 		{
 			ScheduledAction *action = *it;
 			if (action->unit)
 			{
 				ApplyAction(action->unit, action->action, action->goal.pos.x, action->goal.pos.y, action->goal.unit, action->args, action->rotation);
-				Game::Dimension::ChangePath(action->unit, action->goal.pos.x, action->goal.pos.y, action->action, action->goal.unit, action->args, action->rotation);
+#ifdef USE_GROUP_PATHFINDING
+				if (CanMoveAsGroup(action))
+				{
+					vector<vector<ScheduledAction*> >::iterator group = groups.begin();
+					while (group != groups.end() && !CanMoveInSameGroup(group->front(), action))
+					{
+						group++;
+					}
+					if (group == groups.end())
+					{
+						groups.push_back(vector<ScheduledAction*>());
+						group = groups.end() - 1;
+					}
+					group->push_back(action);
+					continue;
+				}
+#endif
+				Game::Dimension::ChangePath(action->unit, action->goal.pos.x, action->goal.pos.y, action->action, action->goal.unit, action->args, action->rotation, action->priority);
+			}
+		}
+
+#ifdef USE_GROUP_PATHFINDING
+		for (vector<vector<ScheduledAction*> >::iterator group = groups.begin(); group != groups.end(); group++)
+		{
+			const ScheduledAction* first = group->front();
+			vector<gc_ptr<Unit> > units;
+			for (vector<ScheduledAction*>::iterator it = group->begin(); it != group->end(); it++)
+			{
+				units.push_back((*it)->unit);
 			}
-			delete action;
+			Game::AI::CommandGroupPathfinding(units, first->goal.pos.x, first->goal.pos.y, first->action, first->args, first->rotation, first->priority);
+		}
+#endif
+
+		for (vector<ScheduledAction*>::iterator it = scheduledActions.begin(); it != scheduledActions.end(); it++)
+		{
+			delete *it;
 		}
 		scheduledActions.clear();
 	}
@@ -998,7 +1121,8 @@ namespace UnitLuaInterface
 		}
 		else
 		{
-			ScheduledAction *sAction = new ScheduledAction(unit, x, y, target, action, args, rotation);
+			Game::AI::PathPriority priority = forwardingPlayerOrders ? Game::AI::PATHPRIORITY_LOCAL_COMMAND : Game::AI::PATHPRIORITY_AI_COMMAND;
+			ScheduledAction *sAction = new ScheduledAction(unit, x, y, target, action, args, rotation, priority);
 
 			SDL_LockMutex(scheduledActionsMutex);
 			scheduledActions.push_back(sAction);
@@ -1623,7 +1747,7 @@ namespace UnitLuaInterface
 	int LIsValidUnit(lua_State* pVM)
 	{
 		const gc_ptr<Unit>& pUnit = _GetUnit(lua_touserdata(pVM, 1));
-		if (IsDisplayedUnitPointer(pUnit) && pUnit->isDisplayed)
+		if (IsDisplayedUnitPointer(pUnit) && pUnit->IsDisplayed())
 		{
 			LUA_SUCCESS
 		}
@@ -3212,6 +3336,8 @@ else \
 		pVM->RegisterFunction("GetUnitTargetPos", LGetUnitTargetPos);
 		
 		pVM->RegisterFunction("GetNearestUnitInRange", LGetNearestUnitInRange);
+		pVM->RegisterFunction("GetNearestUnitsInRange", LGetNearestUnitsInRange);
+		pVM->RegisterFunction("GetUnitsInRange", LGetUnitsInRange);
 		pVM->RegisterFunction("GetNearestSuitableAndLightedPosition", LGetNearestSuitableAndLightedPosition);
 		pVM->RegisterFunction("GetSuitablePositionForLightTower", LGetSuitablePositionForLightTower);
 		
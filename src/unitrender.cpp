@@ -349,8 +349,8 @@ namespace Game
 
 			Utilities::Matrix4x4& mVMatrix = matrices[MATRIXTYPE_MODELVIEW];
 
-			unit_x = unit->pos.x;
-			unit_z = unit->pos.y;
+			unit_x = unit->GetPosition().x;
+			unit_z = unit->GetPosition().y;
 
 			if ((type->widthOnMap >> 1) << 1 == type->widthOnMap)
 			{
@@ -372,7 +372,7 @@ namespace Game
 			// rotate so the unit will be placed correctly onto possibly leaning ground, by rotating by the difference between
 			// the up vector and the terrain normal (get degrees to rotate by with dot product, get axis with cross product)
 			up_vector.set(0.0f, 1.0f, 0.0f);
-			normal = GetTerrainNormal(unit->pos.x, unit->pos.y);
+			normal = GetTerrainNormal(unit->GetPosition().x, unit->GetPosition().y);
 
 			rotate_axis = up_vector;
 			rotate_axis.cross(normal);
@@ -594,7 +594,7 @@ namespace Game
 
 			glBegin(GL_QUADS);
 			
-				progress = (float) unit->health / (float) unit->type->maxHealth * (x_e - x_s);
+				progress = (float) unit->GetHealth() / (float) unit->type->maxHealth * (x_e - x_s);
 
 				glColor4f(0.0f, 1.0f, 0.0f, 1.0f);
 				glVertex3f(x_s, y_s, 0.0);
@@ -613,7 +613,7 @@ namespace Game
 					if (unit->pMovementData->action.goal.unit)
 					{
 						const gc_ptr<Unit>& target = unit->pMovementData->action.goal.unit;
-						if (!target->isCompleted)
+						if (!target->IsCompleted())
 						{
 							y_s = -0.3f;
 							y_e = -0.1f;
@@ -30,6 +30,7 @@ namespace Game
 	namespace Dimension
 	{
 		void ApplyScheduledBigSquareUpdates();
+		void AcquireTargets();
 	}
 }
 
@@ -24,19 +24,46 @@
 #include "aipathfinding.h"
 #include "environment.h"
 #include "unittype-pre.h"
-#include <set>
+#include <cstring>
+#include <climits>
+#include <algorithm>
 #include <iostream>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+//#define DEBUG_SQUARE_COUNTERS // Recount all seen and lighted squares after each incremental update
+
 using namespace std;
 
 namespace Game
 {
 	namespace Dimension
 	{
-		std::vector<gc_ptr<Unit> >**** unitsInBigSquaresPerPlayer;
+		//
+		// The units of one player in one big square. Their coordinates and flags
+		// are kept in arrays of their own, parallel to units, so that range
+		// queries can reject units without dereferencing them.
+		//
+		struct UnitCell
+		{
+			std::vector<gc_ptr<Unit> > units;
+			std::vector<Sint16> x, y;                       // curAssociatedSquare of each unit
+			std::vector<Sint16> startX, startY, endX, endY; // Squares covered by each unit
+			std::vector<Uint8> flags;                       // UNITCELL_*
+		};
+
+		const Uint8 UNITCELL_DISPLAYED = 1;
+
+		UnitCell****  unitCells; // [player][big y][big x]
 		std::vector<gc_ptr<Unit> >*** unitsInBigSquares;
 		char****      movementTypeWithSizeCanWalkOnSquare;
 		char***       traversalTimeBySize;
+		int***        uniformTraversalTimeBySize; // Per big square; -1 if the squares differ
 		int bigSquareHeight, bigSquareWidth;
 		int bigSquareRightShift = 4;
 		gc_root_ptr<RangeArray>::type nextToRangeArray;
@@ -723,15 +750,39 @@ namespace Game
 			return WithinRangeArray(target, attacker->curAssociatedSquare.x, attacker->curAssociatedSquare.y, attacker->type->sightRangeArray);
 		}
 
-		gc_ptr<Unit> GetNearestUnitInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state)
+		//
+		// Whether unit i of cell is within a range array, given with the
+		// squared distance from its center to its first uncovered square,
+		// from the square unit_x, unit_y.
+		//
+		inline bool CellUnitIsInRange(const UnitCell* cell, int i, int unit_x, int unit_y, int offset, int max_distance, char **array)
+		{
+			// Vector from the nearest square of the unit to the searching unit
+			int dx = unit_x - max((int) cell->startX[i], min(unit_x, (int) cell->endX[i]));
+			int dy = unit_y - max((int) cell->startY[i], min(unit_y, (int) cell->endY[i]));
+			return dx * dx + dy * dy <= max_distance && array[dy + offset][dx + offset];
+		}
+
+		//
+		// Calls visitor(cell, index, distance) for each unit of the players
+		// matching state that is within the given range of unit, where distance
+		// is the squared distance between the squares of the two units. Units
+		// are rejected using the coordinates in the cells only.
+		//
+		template <typename Visitor>
+		void VisitUnitsInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state, Visitor& visitor)
 		{
-			gc_ptr<Unit> bestUnit = NULL;
-			float bestDistance = 1000000.0, distance;
+			const gc_ptr<RangeArray>& rangeArray = rangeType == RANGE_SIGHT ? unit->type->sightRangeArray : unit->type->attackRangeArray;
 			int max_range = rangeType == RANGE_SIGHT ? (int) ceil(unit->type->sightRange) : (int) ceil(unit->type->attackMaxRange);
-			int big_start_x = (unit->curAssociatedSquare.x - max_range - 10) >> bigSquareRightShift;
-			int big_start_y = (unit->curAssociatedSquare.y - max_range - 10) >> bigSquareRightShift;
-			int big_end_x = (unit->curAssociatedSquare.x + max_range + 10) >> bigSquareRightShift;
-			int big_end_y = (unit->curAssociatedSquare.y + max_range + 10) >> bigSquareRightShift;
+			int unit_x = unit->curAssociatedSquare.x, unit_y = unit->curAssociatedSquare.y;
+			int big_start_x = (unit_x - max_range - 10) >> bigSquareRightShift;
+			int big_start_y = (unit_y - max_range - 10) >> bigSquareRightShift;
+			int big_end_x = (unit_x + max_range + 10) >> bigSquareRightShift;
+			int big_end_y = (unit_y + max_range + 10) >> bigSquareRightShift;
+			int offset = rangeArray->offset;
+			// Range arrays only cover squares strictly closer than offset+1
+			int max_distance = (offset + 1) * (offset + 1) - 1;
+			char **array = rangeArray->array;
 
 			if (big_start_y < 0)
 				big_start_y = 0;
@@ -744,45 +795,244 @@ namespace Game
 
 			if (big_end_x >= bigSquareWidth)
 				big_end_x = bigSquareWidth-1;
-			
+
 			for (vector<gc_ptr<Player> >::iterator it = pWorld->vPlayers.begin(); it != pWorld->vPlayers.end(); it++)
 			{
 				const gc_ptr<Player>& owner = *it;
-				if (unit->owner->states[owner->index] & state)
+				if (!(unit->owner->states[owner->index] & state))
+				{
+					continue;
+				}
+				for (int y = big_start_y; y <= big_end_y; y++)
+				{
+					for (int x = big_start_x; x <= big_end_x; x++)
+					{
+						const UnitCell* cell = unitCells[owner->index][y][x];
+						int num_units = cell->units.size();
+						for (int i = 0; i < num_units; i++)
+						{
+							if (!CellUnitIsInRange(cell, i, unit_x, unit_y, offset, max_distance, array))
+							{
+								continue;
+							}
+							if (!(cell->flags[i] & UNITCELL_DISPLAYED) || cell->units[i] == unit)
+							{
+								continue;
+							}
+							int cx = cell->x[i] - unit_x, cy = cell->y[i] - unit_y;
+							visitor(cell, i, cx * cx + cy * cy);
+						}
+					}
+				}
+			}
+		}
+
+		struct NearestUnitVisitor
+		{
+			const UnitCell* cell;
+			int index;
+			int distance;
+
+			NearestUnitVisitor() : cell(NULL), index(0), distance(INT_MAX)
+			{
+			}
+
+			void operator () (const UnitCell* cell, int index, int distance)
+			{
+				if (distance < this->distance)
+				{
+					this->cell = cell;
+					this->index = index;
+					this->distance = distance;
+				}
+			}
+		};
+
+		struct UnitInRange
+		{
+			const UnitCell* cell;
+			int index;
+			int distance;
+			int order; // Order of visiting, to keep sorting stable
+
+			bool operator < (const UnitInRange& other) const
+			{
+				return distance < other.distance || (distance == other.distance && order < other.order);
+			}
+		};
+
+		struct UnitsInRangeVisitor
+		{
+			std::vector<UnitInRange> found;
+
+			void operator () (const UnitCell* cell, int index, int distance)
+			{
+				UnitInRange unit;
+				unit.cell = cell;
+				unit.index = index;
+				unit.distance = distance;
+				unit.order = found.size();
+				found.push_back(unit);
+			}
+		};
+
+		gc_ptr<Unit> GetNearestUnitInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state)
+		{
+			NearestUnitVisitor visitor;
+			VisitUnitsInRange(unit, rangeType, state, visitor);
+			if (!visitor.cell)
+			{
+				return NULL;
+			}
+			return visitor.cell->units[visitor.index];
+		}
+
+		gc_ptr<Unit> GetNearestEnemyInRange(const gc_ptr<Unit>& unit, RangeType rangeType)
+		{
+			return GetNearestUnitInRange(unit, rangeType, PLAYER_STATE_ENEMY);
+		}
+
+		//
+		// Target acquisition. Before the AI threads are started each frame, the
+		// nearest enemy in sight of every idle or attacking unit whose target has
+		// expired is found in one sweep over the cells around them. A target found
+		// is reused for TARGET_CACHE_FRAMES frames, as long as it stays displayed
+		// and in sight; finding none is only trusted for the current frame, so that
+		// enemies coming into sight are noticed at once.
+		//
+
+		const Uint32 TARGET_CACHE_FRAMES = 3;
+
+		struct TargetSeeker
+		{
+			gc_ptr<Unit> unit;
+			int x, y;
+			int bigStartX, bigStartY, bigEndX, bigEndY; // Big squares searched by GetNearestUnitInRange()
+			int offset, maxDistance;
+			char **array;
+			const UnitCell* bestCell;
+			int bestIndex;
+			int bestDistance;
+		};
+
+		std::vector<TargetSeeker> targetSeekers;
+		std::vector<std::vector<int> > targetSeekersInBigSquare; // Indices into targetSeekers, per big square
+		std::vector<char> targetCellMarks;                      // Big squares searched by some seeker
+		std::vector<int> targetCells;                           // The marked big squares, in row-major order
+
+		bool NeedsTarget(const gc_ptr<Unit>& unit)
+		{
+			AI::UnitAction action = unit->pMovementData->action.action;
+			return unit->type->canAttack && unit->IsCompleted() && unit->IsDisplayed() && !unit->owner->isRemote &&
+			       (action == AI::ACTION_NONE || action == AI::ACTION_ATTACK) && AI::currentFrame >= unit->targetCacheExpiry;
+		}
+
+		void AcquireTargets()
+		{
+			int seeker_radius = 0;
+
+			targetSeekers.clear();
+			if (targetSeekersInBigSquare.size() != (unsigned) (bigSquareWidth * bigSquareHeight))
+			{
+				targetSeekersInBigSquare.resize(bigSquareWidth * bigSquareHeight);
+				targetCellMarks.assign(bigSquareWidth * bigSquareHeight, 0);
+			}
+
+			for (vector<gc_ptr<Unit> >::iterator it = pWorld->vUnits.begin(); it != pWorld->vUnits.end(); it++)
+			{
+				const gc_ptr<Unit>& unit = *it;
+				if (!NeedsTarget(unit) || unit->bigSquareIndex == -1)
+				{
+					continue;
+				}
+
+				TargetSeeker seeker;
+				int max_range = (int) ceil(unit->type->sightRange);
+				seeker.unit = unit;
+				seeker.x = unit->curAssociatedSquare.x;
+				seeker.y = unit->curAssociatedSquare.y;
+				seeker.bigStartX = max((seeker.x - max_range - 10) >> bigSquareRightShift, 0);
+				seeker.bigStartY = max((seeker.y - max_range - 10) >> bigSquareRightShift, 0);
+				seeker.bigEndX = min((seeker.x + max_range + 10) >> bigSquareRightShift, bigSquareWidth-1);
+				seeker.bigEndY = min((seeker.y + max_range + 10) >> bigSquareRightShift, bigSquareHeight-1);
+				seeker.offset = unit->type->sightRangeArray->offset;
+				seeker.maxDistance = (seeker.offset + 1) * (seeker.offset + 1) - 1;
+				seeker.array = unit->type->sightRangeArray->array;
+				seeker.bestCell = NULL;
+				seeker.bestIndex = 0;
+				seeker.bestDistance = INT_MAX;
+
+				seeker_radius = max(seeker_radius, ((max_range + 10) >> bigSquareRightShift) + 1);
+				for (int y = seeker.bigStartY; y <= seeker.bigEndY; y++)
+				{
+					for (int x = seeker.bigStartX; x <= seeker.bigEndX; x++)
+					{
+						targetCellMarks[y * bigSquareWidth + x] = 1;
+					}
+				}
+				targetSeekersInBigSquare[unit->curAssociatedBigSquare.y * bigSquareWidth + unit->curAssociatedBigSquare.x].push_back(targetSeekers.size());
+				targetSeekers.push_back(seeker);
+			}
+
+			if (targetSeekers.empty())
+			{
+				return;
+			}
+
+			targetCells.clear();
+			for (int i = 0; i < bigSquareWidth * bigSquareHeight; i++)
+			{
+				if (targetCellMarks[i])
+				{
+					targetCells.push_back(i);
+					targetCellMarks[i] = 0;
+				}
+			}
+
+			// Each cell searched by some seeker is tested once against the seekers in the big
+			// squares around it, in the same order as GetNearestUnitInRange() visits them, so
+			// that the results are the same
+			for (vector<gc_ptr<Player> >::iterator it = pWorld->vPlayers.begin(); it != pWorld->vPlayers.end(); it++)
+			{
+				int owner_index = (*it)->index;
+				for (vector<int>::iterator it_cell = targetCells.begin(); it_cell != targetCells.end(); it_cell++)
 				{
-					int owner_index = owner->index;
-					for (int y = big_start_y; y <= big_end_y; y++)
+					int x = *it_cell % bigSquareWidth, y = *it_cell / bigSquareWidth;
+					const UnitCell* cell = unitCells[owner_index][y][x];
+					int num_units = cell->units.size();
+					if (!num_units)
 					{
-						for (int x = big_start_x; x <= big_end_x; x++)
+						continue;
+					}
+					int seekers_start_x = max(x - seeker_radius, 0), seekers_end_x = min(x + seeker_radius, bigSquareWidth-1);
+					int seekers_start_y = max(y - seeker_radius, 0), seekers_end_y = min(y + seeker_radius, bigSquareHeight-1);
+					for (int sy = seekers_start_y; sy <= seekers_end_y; sy++)
+					{
+						for (int sx = seekers_start_x; sx <= seekers_end_x; sx++)
 						{
-							for (vector<gc_ptr<Unit> >::iterator it_unit = unitsInBigSquaresPerPlayer[owner_index][y][x]->begin(); it_unit != unitsInBigSquaresPerPlayer[owner_index][y][x]->end(); it_unit++)
+							const std::vector<int>& seekers = targetSeekersInBigSquare[sy * bigSquareWidth + sx];
+							for (std::vector<int>::const_iterator it_seeker = seekers.begin(); it_seeker != seekers.end(); it_seeker++)
 							{
-								const gc_ptr<Unit>& curUnit = *it_unit;
-								if (curUnit != unit && curUnit->isDisplayed)
+								TargetSeeker& seeker = targetSeekers[*it_seeker];
+								if (x < seeker.bigStartX || x > seeker.bigEndX || y < seeker.bigStartY || y > seeker.bigEndY ||
+								    !(seeker.unit->owner->states[owner_index] & PLAYER_STATE_ENEMY))
 								{
-									bool found = false;
-									if (rangeType == RANGE_SIGHT)
-									{
-										if (CanSee(unit, curUnit))
-										{
-											found = true;
-										}
-									}
-									else if (rangeType == RANGE_ATTACK)
+									continue;
+								}
+								for (int i = 0; i < num_units; i++)
+								{
+									if (!CellUnitIsInRange(cell, i, seeker.x, seeker.y, seeker.offset, seeker.maxDistance, seeker.array) ||
+									    !(cell->flags[i] & UNITCELL_DISPLAYED) || cell->units[i] == seeker.unit)
 									{
-										if (CanReach(unit, curUnit))
-										{
-											found = true;
-										}
+										continue;
 									}
-									if (found)
+									int cx = cell->x[i] - seeker.x, cy = cell->y[i] - seeker.y;
+									int distance = cx * cx + cy * cy;
+									if (distance < seeker.bestDistance)
 									{
-										distance = Distance2D(curUnit->pos.x - unit->pos.x, curUnit->pos.y - unit->pos.y);
-										if (distance < bestDistance)
-										{
-											bestUnit = curUnit;
-											bestDistance = distance;
-										}
+										seeker.bestCell = cell;
+										seeker.bestIndex = i;
+										seeker.bestDistance = distance;
 									}
 								}
 							}
@@ -790,25 +1040,210 @@ namespace Game
 					}
 				}
 			}
-			return bestUnit;
+
+			for (vector<TargetSeeker>::iterator it = targetSeekers.begin(); it != targetSeekers.end(); it++)
+			{
+				const gc_ptr<Unit>& unit = it->unit;
+				unit->cachedTarget = it->bestCell ? it->bestCell->units[it->bestIndex] : gc_ptr<Unit>();
+				unit->targetCacheExpiry = AI::currentFrame + (it->bestCell ? TARGET_CACHE_FRAMES : 1);
+				targetSeekersInBigSquare[unit->curAssociatedBigSquare.y * bigSquareWidth + unit->curAssociatedBigSquare.x].clear();
+			}
+			targetSeekers.clear();
+		}
+
+		gc_ptr<Unit> GetNearestEnemyInSight(const gc_ptr<Unit>& unit)
+		{
+			if (AI::currentFrame < unit->targetCacheExpiry)
+			{
+				const gc_ptr<Unit>& target = unit->cachedTarget;
+				if (!target || (target->IsDisplayed() && CanSee(unit, target)))
+				{
+					return target;
+				}
+			}
+			return GetNearestEnemyInRange(unit, RANGE_SIGHT);
+		}
+
+		void GetNearestUnitsInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state, unsigned num, std::vector<gc_ptr<Unit> >& units)
+		{
+			UnitsInRangeVisitor visitor;
+			VisitUnitsInRange(unit, rangeType, state, visitor);
+			if (num < visitor.found.size())
+			{
+				partial_sort(visitor.found.begin(), visitor.found.begin() + num, visitor.found.end());
+				visitor.found.resize(num);
+			}
+			else
+			{
+				sort(visitor.found.begin(), visitor.found.end());
+			}
+			for (vector<UnitInRange>::iterator it = visitor.found.begin(); it != visitor.found.end(); it++)
+			{
+				units.push_back(it->cell->units[it->index]);
+			}
+		}
+
+		void GetUnitsInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state, std::vector<gc_ptr<Unit> >& units)
+		{
+			UnitsInRangeVisitor visitor;
+			VisitUnitsInRange(unit, rangeType, state, visitor);
+			for (vector<UnitInRange>::iterator it = visitor.found.begin(); it != visitor.found.end(); it++)
+			{
+				units.push_back(it->cell->units[it->index]);
+			}
+		}
+
+		//
+		// Visibility bitmaps. A bit is set while the counter of the square in
+		// NumUnitsSeeingSquare of the player, or in NumLightsOnSquare, is nonzero,
+		// so that visibility can be queried a word of squares at a time.
+		//
+
+		Uint64*** visibleBits; // Indexed by player, y and word
+		Uint64**  lightedBits; // Indexed by y and word
+		int       visibilityRowWords;
+
+		Uint64** CreateBitmap()
+		{
+			Uint64** bits = new Uint64*[pWorld->height];
+			for (int y = 0; y < pWorld->height; y++)
+			{
+				bits[y] = new Uint64[visibilityRowWords];
+				memset(bits[y], 0, visibilityRowWords * sizeof(Uint64));
+			}
+			return bits;
+		}
+
+		inline bool BitIsSet(Uint64** bits, int x, int y)
+		{
+			return (bits[y][x >> 6] >> (x & 63)) & 1;
+		}
+
+		inline int CountBits(Uint64 word)
+		{
+#ifdef __GNUC__
+			return __builtin_popcountll(word);
+#else
+			int num = 0;
+			for (; word; word &= word - 1)
+			{
+				num++;
+			}
+			return num;
+#endif
+		}
+
+		// Mask of the bits of word w that are within [start_x, end_x]
+		inline Uint64 RowMask(int w, int start_x, int end_x)
+		{
+			Uint64 mask = ~(Uint64) 0;
+			if (w == start_x >> 6)
+			{
+				mask &= mask << (start_x & 63);
+			}
+			if (w == end_x >> 6)
+			{
+				mask &= ~(Uint64) 0 >> (63 - (end_x & 63));
+			}
+			return mask;
+		}
+
+		// Clips a rectangle to the map; returns false if nothing is left of it
+		bool ClipToMap(int& start_x, int& start_y, int& end_x, int& end_y)
+		{
+			start_x = max(start_x, 0);
+			start_y = max(start_y, 0);
+			end_x = min(end_x, pWorld->width - 1);
+			end_y = min(end_y, pWorld->height - 1);
+			return start_x <= end_x && start_y <= end_y;
+		}
+
+		// Counts the squares of the rectangle set in bits, and in also_bits if not NULL
+		int CountBitsInRect(Uint64** bits, Uint64** also_bits, int start_x, int start_y, int end_x, int end_y)
+		{
+			int num = 0;
+			if (!ClipToMap(start_x, start_y, end_x, end_y))
+			{
+				return 0;
+			}
+			for (int y = start_y; y <= end_y; y++)
+			{
+				for (int w = start_x >> 6; w <= end_x >> 6; w++)
+				{
+					Uint64 word = bits[y][w] & RowMask(w, start_x, end_x);
+					if (also_bits)
+					{
+						word &= also_bits[y][w];
+					}
+					num += CountBits(word);
+				}
+			}
+			return num;
+		}
+
+		bool AnyBitInRect(Uint64** bits, int start_x, int start_y, int end_x, int end_y)
+		{
+			if (!ClipToMap(start_x, start_y, end_x, end_y))
+			{
+				return false;
+			}
+			for (int y = start_y; y <= end_y; y++)
+			{
+				for (int w = start_x >> 6; w <= end_x >> 6; w++)
+				{
+					if (bits[y][w] & RowMask(w, start_x, end_x))
+					{
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		bool AnySquareIsVisible(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y)
+		{
+			return AnyBitInRect(visibleBits[player->index], start_x, start_y, end_x, end_y);
+		}
+
+		int CountVisibleSquares(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y)
+		{
+			return CountBitsInRect(visibleBits[player->index], NULL, start_x, start_y, end_x, end_y);
+		}
+
+		int CountLightedSquares(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y)
+		{
+			return CountBitsInRect(visibleBits[player->index], lightedBits, start_x, start_y, end_x, end_y);
+		}
+
+		bool AllSquaresAreLighted(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y)
+		{
+			if (start_x < 0 || start_y < 0 || end_x >= pWorld->width || end_y >= pWorld->height)
+			{
+				return false;
+			}
+			return CountLightedSquares(player, start_x, start_y, end_x, end_y) == (end_x - start_x + 1) * (end_y - start_y + 1);
 		}
 
 		bool UnitIsRendered(const gc_ptr<Unit>& unit, const gc_ptr<Player>& player)
 		{
 			int start_x, start_y;
-			Uint16** NumUnitsSeeingSquare = player->NumUnitsSeeingSquare;
-			if (!unit->isDisplayed)
+			Uint64** bits = visibleBits[player->index];
+			if (!unit->IsDisplayed())
 			{
 				return false;
 			}
 			GetUnitUpperLeftCorner(unit, start_x, start_y);
+			if (!AnyBitInRect(bits, start_x, start_y, start_x + unit->type->widthOnMap - 1, start_y + unit->type->heightOnMap - 1))
+			{
+				return false;
+			}
 			for (int y = start_y; y < start_y + unit->type->heightOnMap; y++)
 			{
 				for (int x = start_x; x < start_x + unit->type->widthOnMap; x++)
 				{
 					if (x >= 0 && y >= 0 && x < pWorld->width && y < pWorld->height)
 					{
-						if (BigSquareIsRendered(x, y) && NumUnitsSeeingSquare[y][x])
+						if (BitIsSet(bits, x, y) && BigSquareIsRendered(x, y))
 						{
 							return true;
 						}
@@ -843,39 +1278,28 @@ namespace Game
 		bool UnitIsVisible(const gc_ptr<Unit>& unit, const gc_ptr<Player>& player)
 		{
 			int start_x, start_y;
-			int end_x, end_y;
-			Uint16** NumUnitsSeeingSquare = player->NumUnitsSeeingSquare;
-			if (!unit->isDisplayed)
+			if (!unit->IsDisplayed())
 			{
 				return false;
 			}
 			GetUnitUpperLeftCorner(unit, start_x, start_y);
-			end_x = start_x + unit->type->widthOnMap - 1;
-			end_y = start_y + unit->type->heightOnMap - 1;
-			for (int y = start_y; y <= end_y; y++)
+			if (AnySquareIsVisible(player, start_x, start_y, start_x + unit->type->widthOnMap - 1, start_y + unit->type->heightOnMap - 1))
 			{
-				Uint16* row = NumUnitsSeeingSquare[y];
-				for (int x = start_x; x <= end_x; x++)
-				{
-					if (row[x])
-					{
-						return true;
-					}
-				}
+				return true;
 			}
 			return false;
 		}
 
 		inline bool SquareIsVisible_UnGuarded(const gc_ptr<Player>& player, int x, int y)
 		{
-			return player->NumUnitsSeeingSquare[y][x];
+			return BitIsSet(visibleBits[player->index], x, y);
 		}
 
 		bool SquareIsVisible(const gc_ptr<Player>& player, int x, int y)
 		{
 			if (x >= 0 && y >= 0 && x < pWorld->width && y < pWorld->height)
 			{
-				return player->NumUnitsSeeingSquare[y][x];
+				return BitIsSet(visibleBits[player->index], x, y);
 			}
 			else
 			{
@@ -942,52 +1366,163 @@ namespace Game
 			return MovementTypeCanWalkOnSquares_UnGuarded(mType, size, x, y);
 		}
 
-		bool MovementTypeCanWalkOnSquare_Pathfinding(MovementType mType, int size, int pos_x, int pos_y)
+		//
+		// The clearance of a square is the number of unit sizes, as counted by the
+		// pathfinder (one less than the height of the unit on the map), that fit
+		// on it, taking both the terrain and the immobile units into account. A
+		// unit of a size can walk on a square if the clearance of the square is
+		// greater than the size. The squares covered by a unit grow with its size,
+		// so a unit that fits on a square also fits there when one size smaller.
+		//
+		unsigned char*** clearanceMaps; // Indexed by movement type, y and x; NULL until calculated
+
+		// The clearance maps again, as one bit per square and size
+		Uint64****       walkabilityBits; // Indexed by size, movement type, y and word
+		int              walkabilityRowWords;
+
+		unsigned char CalculateClearance(MovementType mType, int pos_x, int pos_y)
 		{
 			int start_x, start_y;
-			int end_x, end_y;
-			if (pos_x < 0 || pos_y < 0 || pos_x >= pWorld->width || pos_y >= pWorld->height)
-			{
-				return false;
-			}
-			if (!MovementTypeCanWalkOnSquares_UnGuarded(mType, size+1, pos_x, pos_y))
-			{
-				return false;
-			}
-			GetSizeUpperLeftCorner(size, pos_x, pos_y, start_x, start_y);
-			end_x = start_x + size - 1;
-			end_y = start_y + size - 1;
-			for (int y = start_y; y <= end_y; y++)
+			int size;
+			for (size = 0; size < 4; size++)
 			{
-				for (int x = start_x; x <= end_x; x++)
+				// The terrain under a unit of the size...
+				GetSizeUpperLeftCorner(size+1, pos_x, pos_y, start_x, start_y);
+				for (int y = start_y; y <= start_y + size; y++)
 				{
-					gc_ptr<Unit> pUnit = pppElements[y][x];
-					if (pUnit && !pUnit->type->isMobile)
+					for (int x = start_x; x <= start_x + size; x++)
 					{
-						pUnit->usedInAreaMaps = true;
-						return false;
+						if (!MovementTypeCanWalkOnSquare_NoPrecalc(mType, x, y))
+						{
+							return size;
+						}
+					}
+				}
+
+				// ...and the immobile units in a square one smaller, which lies within it
+				GetSizeUpperLeftCorner(size, pos_x, pos_y, start_x, start_y);
+				for (int y = start_y; y < start_y + size; y++)
+				{
+					for (int x = start_x; x < start_x + size; x++)
+					{
+						const gc_ptr<Unit>& pUnit = pppElements[y][x];
+						if (pUnit && !pUnit->type->isMobile)
+						{
+							return size;
+						}
 					}
 				}
 			}
-			return true;
+			return size;
 		}
 
-		inline bool UnitTypeCanWalkOnSquare(const gc_ptr<UnitType>& type, int x, int y)
+		inline void SetClearance(MovementType mType, int x, int y, unsigned char clearance)
 		{
-			return MovementTypeCanWalkOnSquare(type->movementType, x, y);
+			Uint64 bit = (Uint64) 1 << (x & 63);
+			clearanceMaps[mType][y][x] = clearance;
+			for (int size = 0; size < 4; size++)
+			{
+				if (clearance > size)
+				{
+					walkabilityBits[size][mType][y][x >> 6] |= bit;
+				}
+				else
+				{
+					walkabilityBits[size][mType][y][x >> 6] &= ~bit;
+				}
+			}
 		}
 
-		inline bool UnitTypeCanWalkOnSquare_UnGuarded(const gc_ptr<UnitType>& type, int x, int y)
+		void CalculateClearanceMap(MovementType mType)
 		{
-			return MovementTypeCanWalkOnSquare_UnGuarded(type->movementType, x, y);
+			clearanceMaps[mType] = new unsigned char*[pWorld->height];
+			for (int size = 0; size < 4; size++)
+			{
+				walkabilityBits[size][mType] = new Uint64*[pWorld->height];
+			}
+			for (int y = 0; y < pWorld->height; y++)
+			{
+				clearanceMaps[mType][y] = new unsigned char[pWorld->width];
+				for (int size = 0; size < 4; size++)
+				{
+					walkabilityBits[size][mType][y] = new Uint64[walkabilityRowWords];
+					memset(walkabilityBits[size][mType][y], 0, walkabilityRowWords * sizeof(Uint64));
+				}
+				for (int x = 0; x < pWorld->width; x++)
+				{
+					SetClearance(mType, x, y, CalculateClearance(mType, x, y));
+				}
+			}
 		}
 
-		inline bool UnitTypeCanWalkOnSquares(const gc_ptr<UnitType>& type, int x, int y)
+		//
+		// Recalculate the clearance around an immobile unit that has been placed on
+		// or removed from the map. Units covering the squares next to it are the
+		// largest ones that may be affected.
+		//
+		void UpdateClearance(const gc_ptr<Unit>& unit, int pos_x, int pos_y)
 		{
-			return MovementTypeCanWalkOnSquares(type->movementType, type->heightOnMap, x, y);
+			int start_x, start_y, end_x, end_y;
+			GetUnitUpperLeftCorner(unit, pos_x, pos_y, start_x, start_y);
+			end_x = min(start_x + unit->type->widthOnMap, pWorld->width - 1);
+			end_y = min(start_y + unit->type->heightOnMap, pWorld->height - 1);
+			start_x = max(start_x - 1, 0);
+			start_y = max(start_y - 1, 0);
+
+			for (int i = 0; i < MOVEMENT_TYPES_NUM; i++)
+			{
+				if (!clearanceMaps[i])
+				{
+					continue;
+				}
+				for (int y = start_y; y <= end_y; y++)
+				{
+					for (int x = start_x; x <= end_x; x++)
+					{
+						SetClearance((MovementType) i, x, y, CalculateClearance((MovementType) i, x, y));
+					}
+				}
+			}
 		}
 
-		inline bool UnitTypeCanWalkOnSquares_UnGuarded(const gc_ptr<UnitType>& type, int x, int y)
+		bool MovementTypeCanWalkOnSquare_Pathfinding(MovementType mType, int size, int pos_x, int pos_y)
+		{
+			if (pos_x < 0 || pos_y < 0 || pos_x >= pWorld->width || pos_y >= pWorld->height)
+			{
+				return false;
+			}
+			if (!clearanceMaps[mType])
+			{
+				return CalculateClearance(mType, pos_x, pos_y) > size;
+			}
+			return clearanceMaps[mType][pos_y][pos_x] > size;
+		}
+
+		const Uint64* GetWalkabilityRow(MovementType mType, int size, int y)
+		{
+			if (!walkabilityBits[size][mType])
+			{
+				return NULL;
+			}
+			return walkabilityBits[size][mType][y];
+		}
+
+		inline bool UnitTypeCanWalkOnSquare(const gc_ptr<UnitType>& type, int x, int y)
+		{
+			return MovementTypeCanWalkOnSquare(type->movementType, x, y);
+		}
+
+		inline bool UnitTypeCanWalkOnSquare_UnGuarded(const gc_ptr<UnitType>& type, int x, int y)
+		{
+			return MovementTypeCanWalkOnSquare_UnGuarded(type->movementType, x, y);
+		}
+
+		inline bool UnitTypeCanWalkOnSquares(const gc_ptr<UnitType>& type, int x, int y)
+		{
+			return MovementTypeCanWalkOnSquares(type->movementType, type->heightOnMap, x, y);
+		}
+
+		inline bool UnitTypeCanWalkOnSquares_UnGuarded(const gc_ptr<UnitType>& type, int x, int y)
 		{
 			return MovementTypeCanWalkOnSquares_UnGuarded(type->movementType, type->heightOnMap, x, y);
 		}
@@ -1013,7 +1548,7 @@ namespace Game
 					{
 						return false;
 					}*/
-					if (flags & SIW_IGNORE_MOVING && curUnit->isMoving)
+					if (flags & SIW_IGNORE_MOVING && curUnit->IsMoving())
 					{
 						return true;
 					}
@@ -1048,7 +1583,7 @@ namespace Game
 				{
 					return false;
 				}*/
-				if (flags & SIW_IGNORE_MOVING && curUnit->isMoving)
+				if (flags & SIW_IGNORE_MOVING && curUnit->IsMoving())
 				{
 					return true;
 				}
@@ -1159,30 +1694,16 @@ namespace Game
 			return SquaresAreWalkable(type, x, y, SIW_DEFAULT);
 		}
 
-		bool SquareIsLighted(const gc_ptr<Player>& player, int x, int y)
+		inline bool SquareIsLighted_UnGuarded(const gc_ptr<Player>& player, int x, int y)
 		{
-			if (x >= 0 && y >= 0 && x < pWorld->width && y < pWorld->height)
-			{
-				if (player->NumUnitsSeeingSquare[y][x])
-				{
-					return pWorld->NumLightsOnSquare[y][x];
-				}
-				else
-				{
-					return false;
-				}
-			}
-			else
-			{
-				return false;
-			}
+			return (visibleBits[player->index][y][x >> 6] & lightedBits[y][x >> 6]) >> (x & 63) & 1;
 		}
 
-		inline bool SquareIsLighted_UnGuarded(const gc_ptr<Player>& player, int x, int y)
+		bool SquareIsLighted(const gc_ptr<Player>& player, int x, int y)
 		{
-			if (player->NumUnitsSeeingSquare[y][x])
+			if (x >= 0 && y >= 0 && x < pWorld->width && y < pWorld->height)
 			{
-				return pWorld->NumLightsOnSquare[y][x];
+				return SquareIsLighted_UnGuarded(player, x, y);
 			}
 			else
 			{
@@ -1197,40 +1718,14 @@ namespace Game
 			GetTypeUpperLeftCorner(type, x, y, start_x, start_y);
 			end_y = start_y + type->heightOnMap - 1;
 			end_x = start_x + type->widthOnMap - 1;
-			if (start_x < 0 || start_y < 0 || end_x >= pWorld->width || end_y >= pWorld->height)
-			{
-				return false;
-			}
-			for (int ny = start_y; ny <= end_y; ny++)
-			{
-				for (int nx = start_x; nx <= end_x; nx++)
-				{
-					if (!SquareIsLighted_UnGuarded(type->player, nx, ny))
-					{
-						return false;
-					}
-				}
-			}
-			return true;
+			return AllSquaresAreLighted(type->player, start_x, start_y, end_x, end_y);
 		}
 
 		bool SquaresAreLightedAround(const gc_ptr<UnitType>& type, int x, int y)
 		{
 			int start_x, start_y;
 			GetTypeUpperLeftCorner(type, x, y, start_x, start_y);
-			start_x--;
-			start_y--;
-			for (int ny = start_y; ny < start_y + type->heightOnMap + 2; ny++)
-			{
-				for (int nx = start_x; nx < start_x + type->widthOnMap + 2; nx++)
-				{
-					if (!SquareIsLighted(type->player, nx, ny))
-					{
-						return false;
-					}
-				}
-			}
-			return true;
+			return AllSquaresAreLighted(type->player, start_x - 1, start_y - 1, start_x + type->widthOnMap, start_y + type->heightOnMap);
 		}
 
 		bool SquareIsGoal(const gc_ptr<Unit>& unit, int x, int y, bool use_internal)
@@ -1284,6 +1779,126 @@ namespace Game
 			}
 		}		
 
+		//
+		// Row kernels for the seen and lighted square counters, using SSE2 or AVX2
+		// when the compiler targets them.
+		//
+
+		void IncrementCounters(Uint16* counters, int num)
+		{
+			int i = 0;
+#ifdef __AVX2__
+			const __m256i ones256 = _mm256_set1_epi16(1);
+			for (; i + 16 <= num; i += 16)
+			{
+				__m256i* p = (__m256i*) (counters + i);
+				_mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), ones256));
+			}
+#endif
+#ifdef __SSE2__
+			const __m128i ones = _mm_set1_epi16(1);
+			for (; i + 8 <= num; i += 8)
+			{
+				__m128i* p = (__m128i*) (counters + i);
+				_mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p), ones));
+			}
+#endif
+			for (; i < num; i++)
+			{
+				counters[i]++;
+			}
+		}
+
+		void DecrementCounters(Uint16* counters, int num)
+		{
+			int i = 0;
+#ifdef __AVX2__
+			const __m256i ones256 = _mm256_set1_epi16(1);
+			for (; i + 16 <= num; i += 16)
+			{
+				__m256i* p = (__m256i*) (counters + i);
+				_mm256_storeu_si256(p, _mm256_sub_epi16(_mm256_loadu_si256(p), ones256));
+			}
+#endif
+#ifdef __SSE2__
+			const __m128i ones = _mm_set1_epi16(1);
+			for (; i + 8 <= num; i += 8)
+			{
+				__m128i* p = (__m128i*) (counters + i);
+				_mm_storeu_si128(p, _mm_sub_epi16(_mm_loadu_si128(p), ones));
+			}
+#endif
+			for (; i < num; i++)
+			{
+				counters[i]--;
+			}
+		}
+
+		// Returns the index of the first counter in [start, end) that equals value, or end if there is none
+		int FindCounter(const Uint16* counters, int start, int end, Uint16 value)
+		{
+			int i = start;
+#ifdef __SSE2__
+			const __m128i values = _mm_set1_epi16(value);
+			for (; i + 8 <= end; i += 8)
+			{
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (counters + i)), values)))
+				{
+					break;
+				}
+			}
+#endif
+			for (; i < end; i++)
+			{
+				if (counters[i] == value)
+				{
+					return i;
+				}
+			}
+			return end;
+		}
+
+		// Adds 1 to the counters of [start_x, end_x) in row y, and sets the bits of those that become nonzero
+		void AddToCounters(Uint16** counters, Uint64** bits, int y, int start_x, int end_x)
+		{
+			Uint16* row = counters[y];
+			IncrementCounters(row + start_x, end_x - start_x);
+			for (int x = FindCounter(row, start_x, end_x, 1); x < end_x; x = FindCounter(row, x + 1, end_x, 1))
+			{
+				bits[y][x >> 6] |= (Uint64) 1 << (x & 63);
+			}
+		}
+
+		// Subtracts 1 from the counters of [start_x, end_x) in row y, and clears the bits of those that become zero
+		void SubtractFromCounters(Uint16** counters, Uint64** bits, int y, int start_x, int end_x)
+		{
+			Uint16* row = counters[y];
+			DecrementCounters(row + start_x, end_x - start_x);
+			for (int x = FindCounter(row, start_x, end_x, 0); x < end_x; x = FindCounter(row, x + 1, end_x, 0))
+			{
+				bits[y][x >> 6] &= ~((Uint64) 1 << (x & 63));
+			}
+		}
+
+		// Refreshes the last seen positions of units on squares in [start_x, end_x) of row y that have just become seen
+		void SpotUnitsOnNewlySeenSquares(const gc_ptr<Unit>& unit, Uint16** NumUnitsSeeingSquare, int y, int start_x, int end_x)
+		{
+			const Uint16* counters = NumUnitsSeeingSquare[y];
+			for (int x = FindCounter(counters, start_x, end_x, 1); x < end_x; x = FindCounter(counters, x + 1, end_x, 1))
+			{
+				if (pppElements[y][x] && pppElements[y][x]->owner != unit->owner)
+				{
+					// A unit that might have been hidden before has been spotted.
+					// Update the lastSeenPosition in the spotted unit of the player
+					// of the spotting unit correctly.
+					int player_index = unit->owner->index;
+					gc_ptr<Unit> rev_unit = pppElements[y][x];
+
+					rev_unit->lastSeenPositions[player_index] = rev_unit->curAssociatedSquare;
+				}
+			}
+		}
+
 		// operation is 0 for removing seen squares, 1 for adding seen squares.
 		void UpdateSeenSquares(const gc_ptr<Unit>& unit, int x, int y, int operation)
 		{
@@ -1320,29 +1935,18 @@ namespace Game
 				end_x = x + rangeScanlines->scanlines[ry].endX;
 				start_x = start_x < 0 ? 0 : start_x;
 				end_x = end_x >= pWorld->width ? pWorld->width : end_x;
+				if (start_x >= end_x)
+				{
+					continue;
+				}
 				if (operation)
 				{
-					for (int nx = start_x; nx < end_x; nx++)
-					{
-						NumUnitsSeeingSquare[ny][nx]++;
-						if (NumUnitsSeeingSquare[ny][nx] == 1 && pppElements[ny][nx] && pppElements[ny][nx]->owner != unit->owner)
-						{
-							// A unit that might have been hidden before has been spotted.
-							// Update the lastSeenPosition in the spotted unit of the player
-							// of the spotting unit correctly.
-							int player_index = unit->owner->index;
-							gc_ptr<Unit> rev_unit = pppElements[ny][nx];
-
-							rev_unit->lastSeenPositions[player_index] = rev_unit->curAssociatedSquare;
-						}
-					}
+					AddToCounters(NumUnitsSeeingSquare, visibleBits[unit->owner->index], ny, start_x, end_x);
+					SpotUnitsOnNewlySeenSquares(unit, NumUnitsSeeingSquare, ny, start_x, end_x);
 				}
 				else
 				{
-					for (int nx = start_x; nx < end_x; nx++)
-					{
-						NumUnitsSeeingSquare[ny][nx]--;
-					}
+					SubtractFromCounters(NumUnitsSeeingSquare, visibleBits[unit->owner->index], ny, start_x, end_x);
 				}
 			}
 		}
@@ -1394,26 +1998,260 @@ namespace Game
 				start_x = start_x < 0 ? 0 : start_x;
 				end_x = end_x >= pWorld->width ? pWorld->width : end_x;
 
+				if (start_x >= end_x)
+				{
+					continue;
+				}
 				if (operation == 1)
 				{
-					for (int nx = start_x; nx < end_x; nx++)
+					AddToCounters(NumLightsOnSquare, lightedBits, ny, start_x, end_x);
+				}
+				else
+				{
+					SubtractFromCounters(NumLightsOnSquare, lightedBits, ny, start_x, end_x);
+				}
+			}
+		}
+
+		//
+		// Incremental updates of seen and lighted squares, for units that move to
+		// an adjacent square. Only the squares covered at one of the positions but
+		// not the other are touched, instead of removing and re-adding them all.
+		//
+
+		// Gets the squares of map row ny covered by the range centered at x, y, clipped
+		// to the map like UpdateSeenSquares() does. end_x is exclusive.
+		void GetRangeSpan(const gc_ptr<RangeScanlines>& rangeScanlines, int x, int y, int ny, int& start_x, int& end_x)
+		{
+			int ry = ny - y + rangeScanlines->yOffset;
+			start_x = end_x = 0;
+			if (ry >= 0 && ry < rangeScanlines->height)
+			{
+				start_x = max(x + rangeScanlines->scanlines[ry].startX, 0);
+				end_x = min(x + rangeScanlines->scanlines[ry].endX, pWorld->width);
+			}
+		}
+
+		// Splits [start, end) minus [cut_start, cut_end) into at most two spans, and returns how many
+		int SubtractSpan(int start, int end, int cut_start, int cut_end, int parts[2][2])
+		{
+			int num = 0;
+			if (start >= end)
+			{
+				return 0;
+			}
+			if (cut_start >= cut_end || cut_end <= start || cut_start >= end)
+			{
+				parts[0][0] = start;
+				parts[0][1] = end;
+				return 1;
+			}
+			if (start < cut_start)
+			{
+				parts[num][0] = start;
+				parts[num][1] = cut_start;
+				num++;
+			}
+			if (cut_end < end)
+			{
+				parts[num][0] = cut_end;
+				parts[num][1] = end;
+				num++;
+			}
+			return num;
+		}
+
+		// spot is true for seen squares, to update the last seen positions of units that become seen
+		void MoveRangeSquares(const gc_ptr<Unit>& unit, const gc_ptr<RangeScanlines>& rangeScanlines, Uint16** counters, Uint64** bits, bool spot, int old_x, int old_y, int new_x, int new_y)
+		{
+			int offset = rangeScanlines->yOffset;
+			int start_y = max(min(old_y, new_y) - offset, 0);
+			int end_y = min(max(old_y, new_y) + offset, pWorld->height - 1);
+			int parts[2][2];
+
+			for (int ny = start_y; ny <= end_y; ny++)
+			{
+				int old_start, old_end, new_start, new_end, num;
+				GetRangeSpan(rangeScanlines, old_x, old_y, ny, old_start, old_end);
+				GetRangeSpan(rangeScanlines, new_x, new_y, ny, new_start, new_end);
+
+				num = SubtractSpan(old_start, old_end, new_start, new_end, parts);
+				for (int i = 0; i < num; i++)
+				{
+					SubtractFromCounters(counters, bits, ny, parts[i][0], parts[i][1]);
+				}
+
+				num = SubtractSpan(new_start, new_end, old_start, old_end, parts);
+				for (int i = 0; i < num; i++)
+				{
+					AddToCounters(counters, bits, ny, parts[i][0], parts[i][1]);
+					if (spot)
 					{
-						NumLightsOnSquare[ny][nx]++;
+						SpotUnitsOnNewlySeenSquares(unit, counters, ny, parts[i][0], parts[i][1]);
 					}
 				}
-				else
+			}
+		}
+
+		// Same as UpdateSeenSquares(unit, old_x, old_y, 0) followed by UpdateSeenSquares(unit, new_x, new_y, 1)
+		void MoveSeenSquares(const gc_ptr<Unit>& unit, int old_x, int old_y, int new_x, int new_y)
+		{
+			if (unit->owner->isRemote)
+			{
+				return;
+			}
+
+			if (!unit->hasSeen)
+			{
+				UpdateSeenSquares(unit, new_x, new_y, 1);
+				return;
+			}
+
+			MoveRangeSquares(unit, unit->type->sightRangeScanlines, unit->owner->NumUnitsSeeingSquare, visibleBits[unit->owner->index], true, old_x, old_y, new_x, new_y);
+		}
+
+		// Same as UpdateLightedSquares(unit, old_x, old_y, 0) followed by UpdateLightedSquares(unit, new_x, new_y, 1)
+		void MoveLightedSquares(const gc_ptr<Unit>& unit, int old_x, int old_y, int new_x, int new_y)
+		{
+			if (!unit->isLighted || unit->lightState == LIGHT_OFF || unit->type->lightRange < 1e-3)
+			{
+				UpdateLightedSquares(unit, old_x, old_y, 0);
+				UpdateLightedSquares(unit, new_x, new_y, 1);
+				return;
+			}
+
+			MoveRangeSquares(unit, unit->type->lightRangeScanlines, pWorld->NumLightsOnSquare, lightedBits, false, old_x, old_y, new_x, new_y);
+		}
+
+#ifdef DEBUG_SQUARE_COUNTERS
+		// Adds the squares covered by a range the way UpdateSeenSquares() and UpdateLightedSquares() do
+		void CountRangeSquares(const gc_ptr<RangeScanlines>& rangeScanlines, int x, int y, vector<int>& counters)
+		{
+			int offset = rangeScanlines->yOffset;
+			for (int ny = max(y - offset, 0); ny <= min(y + offset, pWorld->height - 1); ny++)
+			{
+				int start_x = max(x + rangeScanlines->scanlines[ny - y + offset].startX, 0);
+				int end_x = min(x + rangeScanlines->scanlines[ny - y + offset].endX, pWorld->width);
+				for (int nx = start_x; nx < end_x; nx++)
+				{
+					counters[ny * pWorld->width + nx]++;
+				}
+			}
+		}
+
+		// Recounts the seen and lighted squares from the positions of all units, and reports counters that differ
+		void CheckSquareCounters()
+		{
+			int num_squares = pWorld->width * pWorld->height;
+			vector<int> lights(num_squares, 0);
+			vector<vector<int> > seen(pWorld->vPlayers.size(), vector<int>(num_squares, 0));
+
+			for (vector<gc_ptr<Unit> >::iterator it = pWorld->vUnits.begin(); it != pWorld->vUnits.end(); it++)
+			{
+				const gc_ptr<Unit>& unit = *it;
+				if (unit->hasSeen)
 				{
-					for (int nx = start_x; nx < end_x; nx++)
+					CountRangeSquares(unit->type->sightRangeScanlines, unit->curAssociatedSquare.x, unit->curAssociatedSquare.y, seen[unit->owner->index]);
+				}
+				if (unit->isLighted)
+				{
+					CountRangeSquares(unit->type->lightRangeScanlines, unit->curAssociatedSquare.x, unit->curAssociatedSquare.y, lights);
+				}
+			}
+
+			for (int y = 0; y < pWorld->height; y++)
+			{
+				for (int x = 0; x < pWorld->width; x++)
+				{
+					if (pWorld->NumLightsOnSquare[y][x] != lights[y * pWorld->width + x])
+					{
+						cout << "LIGHTED SQUARES MANAGEMENT WARNING: Counter at " << x << ", " << y << " is " << pWorld->NumLightsOnSquare[y][x] << ", recounted " << lights[y * pWorld->width + x] << endl;
+					}
+					if (BitIsSet(lightedBits, x, y) != (pWorld->NumLightsOnSquare[y][x] != 0))
+					{
+						cout << "LIGHTED SQUARES MANAGEMENT WARNING: Bit at " << x << ", " << y << " does not match the counter" << endl;
+					}
+					for (unsigned i = 0; i < pWorld->vPlayers.size(); i++)
 					{
-						NumLightsOnSquare[ny][nx]--;
+						const gc_ptr<Player>& player = pWorld->vPlayers[i];
+						if (!player->isRemote && player->NumUnitsSeeingSquare[y][x] != seen[i][y * pWorld->width + x])
+						{
+							cout << "SEEN SQUARES MANAGEMENT WARNING: Counter of player " << i << " at " << x << ", " << y << " is " << player->NumUnitsSeeingSquare[y][x] << ", recounted " << seen[i][y * pWorld->width + x] << endl;
+						}
+						if (BitIsSet(visibleBits[i], x, y) != (player->NumUnitsSeeingSquare[y][x] != 0))
+						{
+							cout << "SEEN SQUARES MANAGEMENT WARNING: Bit of player " << i << " at " << x << ", " << y << " does not match the counter" << endl;
+						}
 					}
 				}
 			}
 		}
+#endif
+
+		// Units that have moved to another big square since the last call to
+		// ApplyScheduledBigSquareUpdates, in the order they moved
+		vector<gc_ptr<Unit> > ScheduledBigSquareUpdates;
+
+		void SetUnitCellEntry(UnitCell* cell, int index, const gc_ptr<Unit>& unit)
+		{
+			int start_x, start_y;
+			GetUnitUpperLeftCorner(unit, start_x, start_y);
+			cell->x[index] = unit->curAssociatedSquare.x;
+			cell->y[index] = unit->curAssociatedSquare.y;
+			cell->startX[index] = start_x;
+			cell->startY[index] = start_y;
+			cell->endX[index] = start_x + unit->type->widthOnMap - 1;
+			cell->endY[index] = start_y + unit->type->heightOnMap - 1;
+			cell->flags[index] = unit->IsDisplayed() ? UNITCELL_DISPLAYED : 0;
+		}
+
+		void AddUnitToCell(UnitCell* cell, const gc_ptr<Unit>& unit)
+		{
+			int index = cell->units.size();
+			cell->units.push_back(unit);
+			cell->x.push_back(0);
+			cell->y.push_back(0);
+			cell->startX.push_back(0);
+			cell->startY.push_back(0);
+			cell->endX.push_back(0);
+			cell->endY.push_back(0);
+			cell->flags.push_back(0);
+			SetUnitCellEntry(cell, index, unit);
+			unit->bigSquareIndex = index;
+		}
 
-		set<gc_ptr<Unit> > ScheduledBigSquareUpdates;
+		// Moves the last unit of the cell into the place of the removed one
+		void RemoveUnitFromCell(UnitCell* cell, const gc_ptr<Unit>& unit)
+		{
+			int index = unit->bigSquareIndex, last = cell->units.size() - 1;
+			if (index < 0 || index > last || cell->units[index] != unit)
+			{
+				return;
+			}
+			if (index != last)
+			{
+				cell->units[index] = cell->units[last];
+				cell->x[index] = cell->x[last];
+				cell->y[index] = cell->y[last];
+				cell->startX[index] = cell->startX[last];
+				cell->startY[index] = cell->startY[last];
+				cell->endX[index] = cell->endX[last];
+				cell->endY[index] = cell->endY[last];
+				cell->flags[index] = cell->flags[last];
+				cell->units[index]->bigSquareIndex = index;
+			}
+			cell->units.pop_back();
+			cell->x.pop_back();
+			cell->y.pop_back();
+			cell->startX.pop_back();
+			cell->startY.pop_back();
+			cell->endX.pop_back();
+			cell->endY.pop_back();
+			cell->flags.pop_back();
+			unit->bigSquareIndex = -1;
+		}
 
-		bool SetAssociatedSquares(const gc_ptr<Unit>& unit, int new_x, int new_y)
+		bool SetAssociatedSquares(const gc_ptr<Unit>& unit, int new_x, int new_y, bool update_ranges)
 		{
 			int start_x, start_y, end_x, end_y;
 			if (!SquaresAreWalkable(unit, new_x, new_y, SIW_ALLKNOWING))
@@ -1421,8 +2259,11 @@ namespace Game
 				return false;
 			}
 			
-			UpdateSeenSquares(unit, new_x, new_y, 1); // add new
-			UpdateLightedSquares(unit, new_x, new_y, 1); // add new
+			if (update_ranges)
+			{
+				UpdateSeenSquares(unit, new_x, new_y, 1); // add new
+				UpdateLightedSquares(unit, new_x, new_y, 1); // add new
+			}
 			
 			unit->curAssociatedSquare.x = new_x;
 			unit->curAssociatedSquare.y = new_y;
@@ -1438,6 +2279,14 @@ namespace Game
 				}
 			}
 
+			if (!unit->type->isMobile)
+			{
+				UpdateClearance(unit, new_x, new_y);
+
+				// The area maps now depend on the unit; they are split by the clearance just updated
+				AI::AddUnitToAreaMap(unit);
+			}
+
 			for (unsigned int i = 0; i < pWorld->vPlayers.size(); i++)
 			{
 				if (UnitIsVisible(unit, pWorld->vPlayers.at(i)))
@@ -1452,9 +2301,16 @@ namespace Game
 			int new_big_x = new_x >> bigSquareRightShift;
 			int new_big_y = new_y >> bigSquareRightShift;
 
-			if (old_big_x != new_big_x || old_big_y != new_big_y)
+			if ((old_big_x != new_big_x || old_big_y != new_big_y) && !unit->bigSquareUpdateScheduled)
+			{
+				unit->bigSquareUpdateScheduled = true;
+				ScheduledBigSquareUpdates.push_back(unit);
+			}
+
+			// Until the unit is moved to its new cell, keep it up to date in the old one
+			if (unit->bigSquareIndex != -1)
 			{
-				ScheduledBigSquareUpdates.insert(unit);
+				SetUnitCellEntry(unitCells[unit->owner->index][old_big_y][old_big_x], unit->bigSquareIndex, unit);
 			}
 
 			return true;
@@ -1462,37 +2318,35 @@ namespace Game
 
 		void ApplyScheduledBigSquareUpdates()
 		{
-			for (set<gc_ptr<Unit> >::iterator it = ScheduledBigSquareUpdates.begin(); it != ScheduledBigSquareUpdates.end(); it++)
+			for (vector<gc_ptr<Unit> >::iterator it = ScheduledBigSquareUpdates.begin(); it != ScheduledBigSquareUpdates.end(); it++)
 			{
 				const gc_ptr<Unit>& unit = *it;
+
+				// Cleared if the unit has been taken out of its big square since it was scheduled
+				if (!unit->bigSquareUpdateScheduled)
+				{
+					continue;
+				}
+				unit->bigSquareUpdateScheduled = false;
+
 				int old_big_x = unit->curAssociatedBigSquare.x;
 				int old_big_y = unit->curAssociatedBigSquare.y;
 				int new_big_x = unit->curAssociatedSquare.x >> bigSquareRightShift;
 				int new_big_y = unit->curAssociatedSquare.y >> bigSquareRightShift;
 
+				// The unit may have gone back to its old big square after it was scheduled
+				if (old_big_x == new_big_x && old_big_y == new_big_y)
+				{
+					continue;
+				}
+
 				if (old_big_x > -1 && old_big_y > -1)
 				{
-					vector<gc_ptr<Unit> > *unit_vector = unitsInBigSquaresPerPlayer[unit->owner->index][old_big_y][old_big_x];
-					for (vector<gc_ptr<Unit> >::iterator it = unit_vector->begin(); it != unit_vector->end(); it++)
-					{
-						if (*it == unit)
-						{
-							unit_vector->erase(it);
-							break;
-						}
-					}
-					unit_vector = unitsInBigSquares[old_big_y][old_big_x];
-					for (vector<gc_ptr<Unit> >::iterator it = unit_vector->begin(); it != unit_vector->end(); it++)
-					{
-						if (*it == unit)
-						{
-							unit_vector->erase(it);
-							break;
-						}
-					}
+					RemoveUnitFromCell(unitCells[unit->owner->index][old_big_y][old_big_x], unit);
+					RemoveUnitFromList(*unitsInBigSquares[old_big_y][old_big_x], unit, &UnitListIndices::bigSquare);
 				}
-				unitsInBigSquaresPerPlayer[unit->owner->index][new_big_y][new_big_x]->push_back(unit);
-				unitsInBigSquares[new_big_y][new_big_x]->push_back(unit);
+				AddUnitToCell(unitCells[unit->owner->index][new_big_y][new_big_x], unit);
+				AddUnitToList(*unitsInBigSquares[new_big_y][new_big_x], unit, &UnitListIndices::bigSquare);
 				unit->curAssociatedBigSquare.x = new_big_x;
 				unit->curAssociatedBigSquare.y = new_big_y;
 			}
@@ -1501,35 +2355,24 @@ namespace Game
 
 		void RemoveUnitFromBigSquare(const gc_ptr<Unit>& unit)
 		{
+			unit->bigSquareUpdateScheduled = false;
+
 			if (unit->curAssociatedBigSquare.y > -1)
 			{
-				vector<gc_ptr<Unit> > *unit_vector = unitsInBigSquaresPerPlayer[unit->owner->index][unit->curAssociatedBigSquare.y][unit->curAssociatedBigSquare.x];
-				for (vector<gc_ptr<Unit> >::iterator it = unit_vector->begin(); it != unit_vector->end(); it++)
-				{
-					if (*it == unit)
-					{
-						unit_vector->erase(it);
-						break;
-					}
-				}
-				unit_vector = unitsInBigSquares[unit->curAssociatedBigSquare.y][unit->curAssociatedBigSquare.x];
-				for (vector<gc_ptr<Unit> >::iterator it = unit_vector->begin(); it != unit_vector->end(); it++)
-				{
-					if (*it == unit)
-					{
-						unit_vector->erase(it);
-						break;
-					}
-				}
+				RemoveUnitFromCell(unitCells[unit->owner->index][unit->curAssociatedBigSquare.y][unit->curAssociatedBigSquare.x], unit);
+				RemoveUnitFromList(*unitsInBigSquares[unit->curAssociatedBigSquare.y][unit->curAssociatedBigSquare.x], unit, &UnitListIndices::bigSquare);
 			}
 
 		}
 
-		void DeleteAssociatedSquares(const gc_ptr<Unit>& unit, int old_x, int old_y)
+		void DeleteAssociatedSquares(const gc_ptr<Unit>& unit, int old_x, int old_y, bool update_ranges)
 		{
 			int start_x, start_y, end_x, end_y;
-			UpdateSeenSquares(unit, old_x, old_y, 0); // remove old
-			UpdateLightedSquares(unit, old_x, old_y, 0); // remove old
+			if (update_ranges)
+			{
+				UpdateSeenSquares(unit, old_x, old_y, 0); // remove old
+				UpdateLightedSquares(unit, old_x, old_y, 0); // remove old
+			}
 
 			GetUnitUpperLeftCorner(unit, old_x, old_y, start_x, start_y);
 			end_x = start_x + unit->type->widthOnMap - 1;
@@ -1542,6 +2385,11 @@ namespace Game
 				}
 			}
 
+			if (!unit->type->isMobile)
+			{
+				UpdateClearance(unit, old_x, old_y);
+			}
+
 			return;
 		}
 
@@ -1560,8 +2408,30 @@ namespace Game
 				old_y = unit->curAssociatedSquare.y;
 			}
 
-			DeleteAssociatedSquares(unit, old_x, old_y);
-			return SetAssociatedSquares(unit, new_x, new_y);
+			if (new_x - old_x < -1 || new_x - old_x > 1 || new_y - old_y < -1 || new_y - old_y > 1)
+			{
+				DeleteAssociatedSquares(unit, old_x, old_y);
+				return SetAssociatedSquares(unit, new_x, new_y);
+			}
+
+			// A step to an adjacent square; only update the edges of the seen and lighted ranges
+			MoveSeenSquares(unit, old_x, old_y, new_x, new_y);
+			MoveLightedSquares(unit, old_x, old_y, new_x, new_y);
+
+			DeleteAssociatedSquares(unit, old_x, old_y, false);
+			if (!SetAssociatedSquares(unit, new_x, new_y, false))
+			{
+				// Leave the unit without ranges, like a failed SetAssociatedSquares() would
+				UpdateSeenSquares(unit, new_x, new_y, 0);
+				UpdateLightedSquares(unit, new_x, new_y, 0);
+				return false;
+			}
+
+#ifdef DEBUG_SQUARE_COUNTERS
+			CheckSquareCounters();
+#endif
+
+			return true;
 		}
 
 		void SetLightState(const gc_ptr<Unit>& unit, LightState lightState)
@@ -1573,7 +2443,12 @@ namespace Game
 
 		int GetTraversalTime(const gc_ptr<Unit>& unit, int x, int y, int dx, int dy)
 		{
-			int time = traversalTimeBySize[unit->type->widthOnMap-1][y+dy][x+dx];
+			return GetTraversalTimeBySize(unit->type->widthOnMap-1, x, y, dx, dy);
+		}
+
+		int GetTraversalTimeBySize(int size, int x, int y, int dx, int dy)
+		{
+			int time = traversalTimeBySize[size][y+dy][x+dx];
 			if (dy & dx)
 			{
 				time += time >> 1;
@@ -1598,6 +2473,11 @@ namespace Game
 				int j = type->widthOnMap-1;
 				int i = type->movementType;
 				
+				if (!clearanceMaps[i])
+				{
+					CalculateClearanceMap((MovementType) i);
+				}
+
 				if (!movementTypeWithSizeCanWalkOnSquare[j][i])
 				{
 					movementTypeWithSizeCanWalkOnSquare[j][i] = new char*[pWorld->height];
@@ -1657,8 +2537,58 @@ namespace Game
 							traversalTimeBySize[j][y][x] = char(10 + (steepness >> 1));
 						}
 					}
+
+					uniformTraversalTimeBySize[j] = new int*[bigSquareHeight];
+					for (int by = 0; by < bigSquareHeight; by++)
+					{
+						uniformTraversalTimeBySize[j][by] = new int[bigSquareWidth];
+						for (int bx = 0; bx < bigSquareWidth; bx++)
+						{
+							int time = -2;
+							int end_x = min(((bx+1) << bigSquareRightShift), pWorld->width);
+							int end_y = min(((by+1) << bigSquareRightShift), pWorld->height);
+							for (int y = by << bigSquareRightShift; y < end_y && time != -1; y++)
+							{
+								for (int x = bx << bigSquareRightShift; x < end_x; x++)
+								{
+									if (time == -2)
+									{
+										time = traversalTimeBySize[j][y][x];
+									}
+									else if (time != traversalTimeBySize[j][y][x])
+									{
+										time = -1;
+										break;
+									}
+								}
+							}
+							uniformTraversalTimeBySize[j][by][bx] = time;
+						}
+					}
+				}
+			}
+		}
+
+		int GetUniformTraversalTime(int size, int start_x, int start_y, int end_x, int end_y)
+		{
+			int time = -1;
+			if (!uniformTraversalTimeBySize[size])
+			{
+				return -1;
+			}
+			for (int by = start_y >> bigSquareRightShift; by <= end_y >> bigSquareRightShift; by++)
+			{
+				for (int bx = start_x >> bigSquareRightShift; bx <= end_x >> bigSquareRightShift; bx++)
+				{
+					int cur_time = uniformTraversalTimeBySize[size][by][bx];
+					if (cur_time < 0 || (time != -1 && cur_time != time))
+					{
+						return -1;
+					}
+					time = cur_time;
 				}
 			}
+			return time;
 		}
 
 		void InitUnitSquares()
@@ -1673,25 +2603,52 @@ namespace Game
 				}
 			}
 			
+			clearanceMaps = new unsigned char**[Game::Dimension::MOVEMENT_TYPES_NUM];
+			for (int i = 0; i < Game::Dimension::MOVEMENT_TYPES_NUM; i++)
+			{
+				clearanceMaps[i] = NULL;
+			}
+
+			walkabilityBits = new Uint64***[4];
+			for (int j = 0; j < 4; j++)
+			{
+				walkabilityBits[j] = new Uint64**[Game::Dimension::MOVEMENT_TYPES_NUM];
+				for (int i = 0; i < Game::Dimension::MOVEMENT_TYPES_NUM; i++)
+				{
+					walkabilityBits[j][i] = NULL;
+				}
+			}
+			walkabilityRowWords = (pWorld->width + 63) >> 6;
+
+			visibilityRowWords = (pWorld->width + 63) >> 6;
+			visibleBits = new Uint64**[pWorld->vPlayers.size()];
+			for (unsigned i = 0; i < pWorld->vPlayers.size(); i++)
+			{
+				visibleBits[i] = CreateBitmap();
+			}
+			lightedBits = CreateBitmap();
+
 			traversalTimeBySize = new char**[4];
+			uniformTraversalTimeBySize = new int**[4];
 			for (int j = 0; j < 4; j++)
 			{
 				traversalTimeBySize[j] = NULL;
+				uniformTraversalTimeBySize[j] = NULL;
 			}
 			
 			bigSquareWidth = (pWorld->width>>bigSquareRightShift)+1;
 			bigSquareHeight = (pWorld->height>>bigSquareRightShift)+1;
 
-			unitsInBigSquaresPerPlayer = new vector<gc_ptr<Unit> >***[pWorld->vPlayers.size()];
+			unitCells = new UnitCell***[pWorld->vPlayers.size()];
 			for (unsigned i = 0; i < pWorld->vPlayers.size(); i++)
 			{
-				unitsInBigSquaresPerPlayer[i] = new vector<gc_ptr<Unit> >**[bigSquareHeight];
+				unitCells[i] = new UnitCell**[bigSquareHeight];
 				for (int y = 0; y < bigSquareHeight; y++)
 				{
-					unitsInBigSquaresPerPlayer[i][y] = new vector<gc_ptr<Unit> >*[bigSquareWidth];
+					unitCells[i][y] = new UnitCell*[bigSquareWidth];
 					for (int x = 0; x < bigSquareWidth; x++)
 					{
-						unitsInBigSquaresPerPlayer[i][y][x] = new vector<gc_ptr<Unit> >;
+						unitCells[i][y][x] = new UnitCell;
 					}
 				}
 			}
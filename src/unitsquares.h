@@ -74,6 +74,14 @@ namespace Game
 		inline bool MovementTypeCanWalkOnSquare_UnGuarded(MovementType mType, int x, int y);
 		bool MovementTypeCanWalkOnSquare_Pathfinding(MovementType mType, int size, int pos_x, int pos_y);
 
+		//
+		// Get a row of bits telling which squares units of the movement type and
+		// size, as counted by MovementTypeCanWalkOnSquare_Pathfinding(), can walk
+		// on; bit x & 63 of word x >> 6 is set for square x. Returns NULL if the
+		// bits have not been calculated for the movement type yet.
+		//
+		const Uint64* GetWalkabilityRow(MovementType mType, int size, int y);
+
 		bool SquareIsWalkable(const gc_ptr<UnitType>& type, int x, int y, int flags);
 		bool SquaresAreWalkable(const gc_ptr<UnitType>& type, int x, int y, int flags);
 		inline bool SquareIsWalkable(const gc_ptr<UnitType>& type, int x, int y);
@@ -85,15 +93,42 @@ namespace Game
 		bool SquaresAreLighted(const gc_ptr<UnitType>& type, int x, int y);
 		bool SquaresAreLightedAround(const gc_ptr<UnitType>& type, int x, int y);
 		
+		//
+		// Queries on rectangles of squares, given by their first and last squares
+		// and clipped to the map. They work on words of the visibility bitmaps,
+		// and are faster than asking for each square.
+		//
+		bool AnySquareIsVisible(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y);
+		int CountVisibleSquares(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y);
+		int CountLightedSquares(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y);
+		bool AllSquaresAreLighted(const gc_ptr<Player>& player, int start_x, int start_y, int end_x, int end_y); // false if not all inside the map
+
 		bool GetNearestSuitableAndLightedPosition(const gc_ptr<UnitType>& type, int& x, int& y);
 		bool GetSuitablePositionForLightTower(const gc_ptr<UnitType>& type, int& x, int& y, bool needLighted);
 		
 		gc_ptr<Unit> GetNearestUnitInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state);
+		gc_ptr<Unit> GetNearestEnemyInRange(const gc_ptr<Unit>& unit, RangeType rangeType);
+
+		//
+		// Same as GetNearestEnemyInRange(unit, RANGE_SIGHT), but answered from the
+		// target found by AcquireTargets() in the last few frames, if it is still
+		// displayed and in sight.
+		//
+		gc_ptr<Unit> GetNearestEnemyInSight(const gc_ptr<Unit>& unit);
+
+		//
+		// Append the units within range of unit that belong to players matching
+		// state; GetNearestUnitsInRange() only appends the num nearest of them,
+		// nearest first.
+		//
+		void GetNearestUnitsInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state, unsigned num, std::vector<gc_ptr<Unit> >& units);
+		void GetUnitsInRange(const gc_ptr<Unit>& unit, RangeType rangeType, PlayerState state, std::vector<gc_ptr<Unit> >& units);
 		bool UnitIsVisible(const gc_ptr<Unit>& unit, const gc_ptr<Player>& player);
 		
 		bool UpdateAssociatedSquares(const gc_ptr<Unit>& unit, int new_x, int new_y, int old_x, int old_y);
-		bool SetAssociatedSquares(const gc_ptr<Unit>& unit, int new_x, int new_y);
-		void DeleteAssociatedSquares(const gc_ptr<Unit>& unit, int old_x, int old_y);
+		// update_ranges is false if the caller updates the seen and lighted squares itself
+		bool SetAssociatedSquares(const gc_ptr<Unit>& unit, int new_x, int new_y, bool update_ranges = true);
+		void DeleteAssociatedSquares(const gc_ptr<Unit>& unit, int old_x, int old_y, bool update_ranges = true);
 		
 		float GetLightAmountOnUnit(const gc_ptr<Unit>& unit);
 		void UpdateLightedSquares(const gc_ptr<Unit>& unit, int x, int y, int operation);
@@ -109,6 +144,13 @@ namespace Game
 		
 		int GetTraversalTime(const gc_ptr<Unit>& unit, int x, int y, int dx, int dy);
 		int GetTraversalTimeAdjusted(const gc_ptr<Unit>& unit, int x, int y, int dx, int dy);
+		int GetTraversalTimeBySize(int size, int x, int y, int dx, int dy);
+
+		//
+		// Returns the traversal time if it is the same for all squares of the big squares
+		// covering the given rectangle, otherwise -1.
+		//
+		int GetUniformTraversalTime(int size, int start_x, int start_y, int end_x, int end_y);
 		
 		bool SquareIsGoal(const gc_ptr<Unit>& unit, int x, int y, bool use_internal = false);
 		
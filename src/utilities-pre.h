@@ -46,6 +46,9 @@ namespace Utilities
 	
 	std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems);
 	std::vector<std::string> split(const std::string &s, char delim);
+
+	// Number of processors available, or 1 if it cannot be determined
+	int GetNumProcessors();
 }
 
 #endif
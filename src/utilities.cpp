@@ -35,6 +35,10 @@
 #include <cassert>
 #include <iostream>
 
+#ifndef WIN32
+	#include <unistd.h>
+#endif
+
 using namespace Window;
 using namespace std;
 
@@ -619,5 +623,19 @@ namespace Utilities
 		return split(s, delim, elems);
 	}
 
+	int GetNumProcessors()
+	{
+#ifdef WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+		long num = sysconf(_SC_NPROCESSORS_ONLN);
+		return num > 0 ? (int) num : 1;
+#else
+		return 1;
+#endif
+	}
+
 }
 